@@ -0,0 +1,336 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "batch.h"
+
+/*
+  Batched datagram I/O: receive and send as many datagrams as possible
+  with one  syscall. On linux  this uses recvmmsg() and  sendmmsg(),
+  elsewhere we loop over recvfrom() and sendmsg() with the same result,
+  just with more syscalls.
+
+  Sockets with UDP_GRO enabled may receive a run of datagrams from the
+  same sender as one buffer, which is sent on as one buffer as well,
+  with UDP_SEGMENT the kernel splits it into the original datagrams
+  again. If that doesn't work, the datagrams are sent one by one.
+*/
+
+#ifndef HAVE_MMSG
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
+/* receive up to max datagrams from fd without blocking, returns the
+   number of datagrams received or -1 on error, errno is set then */
+int batch_recv(int fd, pkt_t *pkts, int max) {
+#ifdef HAVE_MMSG
+  struct mmsghdr msgs[BATCH_MAX];
+  struct iovec iovs[BATCH_MAX];
+  int i, n;
+
+  if(max > BATCH_MAX)
+    max = BATCH_MAX;
+
+  for(i=0; i<max; i++) {
+    iovs[i].iov_base = pkts[i].buf;
+    iovs[i].iov_len  = pkts[i].size;
+    memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    msgs[i].msg_hdr.msg_name    = &pkts[i].addr;
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    msgs[i].msg_hdr.msg_iov     = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen  = 1;
+    msgs[i].msg_hdr.msg_control    = pkts[i].ctl.buf;
+    msgs[i].msg_hdr.msg_controllen = BATCH_CTLLEN;
+  }
+
+  do {
+    n = recvmmsg(fd, msgs, max, MSG_DONTWAIT, NULL);
+  } while(n < 0 && errno == EINTR);
+
+  for(i=0; i<n; i++) {
+    pkts[i].len     = msgs[i].msg_len;
+    pkts[i].addrlen = msgs[i].msg_hdr.msg_namelen;
+    pkts[i].gso     = batch_gro_size(&msgs[i].msg_hdr);
+  }
+
+  return n;
+#else
+  int n;
+  ssize_t len;
+
+  for(n=0; n<max; n++) {
+    pkts[n].addrlen = sizeof(struct sockaddr_storage);
+    len = recvfrom(fd, pkts[n].buf, pkts[n].size, MSG_DONTWAIT,
+                   (struct sockaddr *)&pkts[n].addr, &pkts[n].addrlen);
+    if(len < 0) {
+      if(errno == EINTR) {
+        n--;
+        continue;
+      }
+      break;
+    }
+    pkts[n].len = len;
+    pkts[n].gso = 0;
+  }
+
+  return (n == 0) ? -1 : n;
+#endif
+}
+
+/* let the kernel coalesce datagrams received on fd, -1 if not supported */
+int batch_gro(int fd) {
+#ifdef HAVE_GSO
+  int one = 1;
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+#else
+  (void)fd;
+  errno = ENOPROTOOPT;
+  return -1;
+#endif
+}
+
+/* the datagram size of a received buffer, 0 if it holds just one */
+size_t batch_gro_size(struct msghdr *msg) {
+#ifdef HAVE_GSO
+  struct cmsghdr *cm;
+  int size;
+
+  for(cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+    if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+      memcpy(&size, CMSG_DATA(cm), sizeof(int));
+      return size > 0 ? (size_t)size : 0;
+    }
+  }
+#else
+  (void)msg;
+#endif
+  return 0;
+}
+
+/* number of datagrams in a buffer of len bytes */
+int batch_segments(size_t len, size_t gso) {
+  if(gso == 0 || gso >= len)
+    return 1;
+  return (int)((len + gso - 1) / gso);
+}
+
+/* A send with UDP_SEGMENT failed with  err, returns 1 if the datagrams
+   should be sent one by one instead. If the kernel or the device can't
+   segment at all, we stop trying. */
+int batch_gso_failed(int err) {
+  switch(err) {
+  case EIO:
+  case EOPNOTSUPP:
+  case ENOPROTOOPT:
+    if(GSO) {
+      fprintf(stderr, "UDP segmentation offload not available, disabled: %s\n", strerror(err));
+      GSO = 0;
+    }
+    return 1;
+  case EINVAL:
+  case EMSGSIZE:
+    return 1; /* e.g. datagrams larger than the mtu of the device */
+  }
+  return 0;
+}
+
+/* attach a UDP_SEGMENT control message for datagrams of gso bytes */
+void batch_gso_set(struct msghdr *msg, cmsgbuf_t *ctl, size_t gso) {
+#ifdef HAVE_GSO
+  struct cmsghdr *cm;
+  uint16_t size = gso;
+
+  memset(ctl, 0, sizeof(cmsgbuf_t));
+  msg->msg_control    = ctl->buf;
+  msg->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+  cm = CMSG_FIRSTHDR(msg);
+  cm->cmsg_level = SOL_UDP;
+  cm->cmsg_type  = UDP_SEGMENT;
+  cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+  memcpy(CMSG_DATA(cm), &size, sizeof(uint16_t));
+#else
+  (void)msg; (void)ctl; (void)gso;
+#endif
+}
+
+txbatch_t *txbatch_new(int max, tx_error_f onerror, tx_block_f onblock,
+                       uint64_t *calls, uint64_t *pkts, uint64_t *bytes) {
+  txbatch_t *tx = malloc(sizeof(txbatch_t));
+  tx->fd      = -1;
+  tx->count   = 0;
+  tx->max     = max;
+  tx->msgs    = calloc(max, sizeof(struct mmsghdr));
+  tx->iovs    = calloc(max, sizeof(struct iovec));
+  tx->ctls    = calloc(max, sizeof(cmsgbuf_t));
+  tx->gsos    = calloc(max, sizeof(size_t));
+  tx->owners  = calloc(max, sizeof(void *));
+  tx->onerror = onerror;
+  tx->onblock = onblock;
+  tx->calls   = calls;
+  tx->pkts    = pkts;
+  tx->bytes   = bytes;
+  return tx;
+}
+
+void txbatch_free(txbatch_t *tx) {
+  free(tx->msgs);
+  free(tx->iovs);
+  free(tx->ctls);
+  free(tx->gsos);
+  free(tx->owners);
+  free(tx);
+}
+
+/* queue a datagram, buf and to must stay valid until the next flush.
+   Datagrams  for  another  socket  or  a  full  batch  cause  a  flush
+   first. If gso is set, buf holds datagrams of gso bytes each. */
+void txbatch_push(txbatch_t *tx, int fd, struct sockaddr *to, socklen_t tolen,
+                  void *buf, size_t len, size_t gso, void *owner) {
+  struct msghdr *hdr;
+  size_t off;
+
+  if(gso >= len)
+    gso = 0;
+
+  if(gso && !GSO) {
+    /* no segmentation offload, queue the datagrams one by one */
+    STATS->gso_split++;
+    for(off=0; off<len; off+=gso)
+      txbatch_push(tx, fd, to, tolen, (unsigned char *)buf + off,
+                   len - off < gso ? len - off : gso, 0, owner);
+    return;
+  }
+
+  if(tx->count > 0 && (tx->fd != fd || tx->count == tx->max))
+    txbatch_flush(tx);
+
+  tx->fd = fd;
+  tx->iovs[tx->count].iov_base = buf;
+  tx->iovs[tx->count].iov_len  = len;
+
+  hdr = &tx->msgs[tx->count].msg_hdr;
+  memset(hdr, 0, sizeof(struct msghdr));
+  hdr->msg_name    = to;
+  hdr->msg_namelen = tolen;
+  hdr->msg_iov     = &tx->iovs[tx->count];
+  hdr->msg_iovlen  = 1;
+  if(gso)
+    batch_gso_set(hdr, &tx->ctls[tx->count], gso);
+
+  tx->gsos[tx->count]   = gso;
+  tx->owners[tx->count] = owner;
+  tx->count++;
+}
+
+/* a send failed because the socket buffer is full */
+static int txbatch_blocked(int err) {
+  return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+/* send a buffer the kernel could not segment as single datagrams,
+   returns 1 if the socket buffer became full, the rest of the buffer
+   has been handed to tx->onblock then */
+static int txbatch_split(txbatch_t *tx, int i) {
+  struct msghdr hdr = tx->msgs[i].msg_hdr;
+  struct iovec iov;
+  unsigned char *buf = tx->iovs[i].iov_base;
+  size_t len = tx->iovs[i].iov_len;
+  size_t gso = tx->gsos[i];
+  size_t off;
+
+  STATS->gso_split++;
+
+  hdr.msg_iov        = &iov;
+  hdr.msg_iovlen     = 1;
+  hdr.msg_control    = NULL;
+  hdr.msg_controllen = 0;
+
+  for(off=0; off<len; off+=gso) {
+    iov.iov_base = buf + off;
+    iov.iov_len  = len - off < gso ? len - off : gso;
+    (*tx->calls)++;
+    if(sendmsg(tx->fd, &hdr, 0) < 0) {
+      if(txbatch_blocked(errno)) {
+        tx->iovs[i].iov_base = buf + off;
+        tx->iovs[i].iov_len  = len - off;
+        tx->onblock(tx, tx->owners[i], &tx->msgs[i].msg_hdr, tx->gsos[i]);
+        return 1;
+      }
+      tx->onerror(tx, tx->owners[i], errno);
+      break;
+    }
+    (*tx->pkts)++;
+    *tx->bytes += iov.iov_len;
+  }
+
+  return 0;
+}
+
+/* send all queued datagrams, failed ones are reported to tx->onerror
+   and skipped. If the socket buffer is full, the rest is handed to
+   tx->onblock. */
+void txbatch_flush(txbatch_t *tx) {
+  int off = 0;
+  int sent, i;
+
+  while(off < tx->count) {
+#ifdef HAVE_MMSG
+    sent = sendmmsg(tx->fd, &tx->msgs[off], tx->count - off, 0);
+#else
+    sent = (sendmsg(tx->fd, &tx->msgs[off].msg_hdr, 0) < 0) ? -1 : 1;
+#endif
+    (*tx->calls)++;
+
+    if(sent < 0) {
+      if(errno == EINTR)
+        continue;
+      if(txbatch_blocked(errno)) {
+        /* all of them are for the same socket */
+        for(i=off; i<tx->count; i++)
+          tx->onblock(tx, tx->owners[i], &tx->msgs[i].msg_hdr, tx->gsos[i]);
+        break;
+      }
+      /* the first datagram failed, the remaining ones may still work */
+      if(tx->gsos[off] && batch_gso_failed(errno)) {
+        if(txbatch_split(tx, off)) {
+          for(i=off+1; i<tx->count; i++)
+            tx->onblock(tx, tx->owners[i], &tx->msgs[i].msg_hdr, tx->gsos[i]);
+          break;
+        }
+      }
+      else
+        tx->onerror(tx, tx->owners[off], errno);
+      off++;
+    }
+    else {
+      for(i=off; i<off+sent; i++) {
+        *tx->pkts  += batch_segments(tx->iovs[i].iov_len, tx->gsos[i]);
+        *tx->bytes += tx->iovs[i].iov_len;
+      }
+      off += sent;
+    }
+  }
+
+  tx->count = 0;
+}
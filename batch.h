@@ -0,0 +1,124 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_BATCH_H
+#define _HAVE_BATCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "stats.h"
+
+#ifdef __linux__
+#define HAVE_MMSG
+#endif
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define HAVE_GSO
+#define GSO_DEFAULT 1
+#else
+#define GSO_DEFAULT 0
+#endif
+
+#define BATCH_DEFAULT 32    /* datagrams per syscall */
+#define BATCH_MAX     1024  /* kernel limit for recvmmsg()/sendmmsg(), UIO_MAXIOV */
+#define BATCH_CTLLEN  32    /* room for one UDP_GRO or UDP_SEGMENT control message */
+
+/* control message buffer, aligned for struct cmsghdr */
+union _cmsgbuf_t {
+  struct cmsghdr hdr;
+  char buf[BATCH_CTLLEN];
+};
+typedef union _cmsgbuf_t cmsgbuf_t;
+
+/* one  datagram, received  or to  be sent.  With UDP_GRO  the  kernel may
+   coalesce a run of datagrams of the same size from the same sender into
+   one buffer, gso is the size of the datagrams then (the last one may be
+   shorter) */
+struct _pkt_t {
+  struct sockaddr_storage addr; /* sender */
+  socklen_t addrlen;
+  unsigned char *buf;
+  size_t size;                  /* size of buf */
+  size_t len;                   /* bytes used in buf */
+  size_t gso;                   /* datagram size if buf holds several, 0 otherwise */
+  cmsgbuf_t ctl;                /* receives the UDP_GRO control message */
+};
+typedef struct _pkt_t pkt_t;
+
+struct _txbatch_t;
+
+/* called by txbatch_flush() for every datagram which could not be sent */
+typedef void (*tx_error_f)(struct _txbatch_t *tx, void *owner, int err);
+
+/* called by txbatch_flush() for every datagram which could not be sent
+   because the socket buffer is full */
+typedef void (*tx_block_f)(struct _txbatch_t *tx, void *owner, struct msghdr *msg, size_t gso);
+
+/* datagrams queued for sending from one socket with as few syscalls as possible */
+struct _txbatch_t {
+  int fd;                   /* socket all queued datagrams are sent from */
+  int count;                /* number of queued datagrams */
+  int max;                  /* capacity */
+  struct mmsghdr *msgs;
+  struct iovec *iovs;
+  cmsgbuf_t *ctls;          /* UDP_SEGMENT control messages */
+  size_t *gsos;             /* datagram size of each message, 0 if just one */
+  void **owners;            /* passed to onerror */
+  tx_error_f onerror;
+  tx_block_f onblock;
+  uint64_t *calls;          /* counter: send syscalls */
+  uint64_t *pkts;           /* counter: datagrams sent */
+  uint64_t *bytes;          /* counter: bytes sent */
+};
+typedef struct _txbatch_t txbatch_t;
+
+extern int GSO;
+
+int batch_recv(int fd, pkt_t *pkts, int max);
+int batch_gro(int fd);
+size_t batch_gro_size(struct msghdr *msg);
+int batch_segments(size_t len, size_t gso);
+int batch_gso_failed(int err);
+void batch_gso_set(struct msghdr *msg, cmsgbuf_t *ctl, size_t gso);
+
+txbatch_t *txbatch_new(int max, tx_error_f onerror, tx_block_f onblock,
+                       uint64_t *calls, uint64_t *pkts, uint64_t *bytes);
+void txbatch_push(txbatch_t *tx, int fd, struct sockaddr *to, socklen_t tolen,
+                  void *buf, size_t len, size_t gso, void *owner);
+void txbatch_flush(txbatch_t *tx);
+void txbatch_free(txbatch_t *tx);
+
+#endif
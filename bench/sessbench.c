@@ -0,0 +1,309 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+/*
+  sessbench - microbenchmark and scale test of the session table.
+
+  Drives client.c directly, without sockets and without udpxd, against
+  synthetic client populations of 10 to 1M sessions and measures the
+  cost of inserting, looking up and expiring sessions and the memory used
+  per session. Time is simulated: the clock of client.c is only set by
+  client_tick(), so expiring a million sessions after 30 seconds takes
+  no 30 seconds.
+
+  The sessions get fake socket numbers, which client.c closes when they
+  expire, close() below counts them instead. Every phase checks its
+  result, the exit code is 1 if any check failed, so this also serves as
+  a test for changes of the session table.
+
+  Run with "make bench-sessions", see usage() for the options.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <sys/syscall.h>
+
+#include "../client.h"
+#include "../net.h"
+
+#define FAKE_FD  (1 << 24)   /* socket numbers of the fake sessions start here */
+#define T0       1000000ULL  /* simulated start time, ms */
+#define LOOKUPS  1000000     /* minimum number of lookups per measurement */
+
+/* the globals of udpxd.c used by the linked modules */
+client_t *clients = NULL;
+int VERBOSE = 0;
+int FORKED = 0;
+int BATCH = BATCH_DEFAULT;
+int LOGRATE = 0;
+int LOGEVERY = 1;
+int TIMEOUT = MAXAGE;
+
+static int V6 = 0;
+static uint64_t closed = 0;
+static int failed = 0;
+
+/* net.c is not linked, the sessions have no sockets to watch */
+void client_watch(client_t *client) {
+  (void)client;
+}
+
+void client_unwatch(client_t *client) {
+  (void)client;
+}
+
+int bindsocket(host_t *sock_h, int reuseport) {
+  (void)sock_h; (void)reuseport;
+  return -1;
+}
+
+/* count the fake sockets closed by client.c */
+int close(int fd) {
+  if(fd >= FAKE_FD) {
+    closed++;
+    return 0;
+  }
+  return (int)syscall(SYS_close, fd);
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* bytes allocated from the heap, -1 if unknown */
+static int64_t heap_used() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  return (int64_t)(mi.uordblks + mi.hblkhd);
+#else
+  return -1;
+#endif
+}
+
+/* source address of synthetic client i, v4 from 10/8, v6 from 2001:db8::/32 */
+static void client_addr(struct sockaddr_storage *ss, uint32_t i) {
+  memset(ss, 0, sizeof(*ss));
+  if(V6) {
+    struct sockaddr_in6 *a = (struct sockaddr_in6 *)ss;
+    a->sin6_family = AF_INET6;
+    a->sin6_addr.s6_addr[0] = 0x20;
+    a->sin6_addr.s6_addr[1] = 0x01;
+    a->sin6_addr.s6_addr[2] = 0x0d;
+    a->sin6_addr.s6_addr[3] = 0xb8;
+    memcpy(&a->sin6_addr.s6_addr[12], &i, 4);
+    a->sin6_port = htons(1024 + i % 60000);
+  }
+  else {
+    struct sockaddr_in *a = (struct sockaddr_in *)ss;
+    a->sin_family      = AF_INET;
+    a->sin_addr.s_addr = htonl(0x0a000000 | (i / 60000));
+    a->sin_port        = htons(1024 + i % 60000);
+  }
+}
+
+static uint32_t xorshift(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static void check(int ok, const char *what, int n) {
+  if(! ok) {
+    fprintf(stderr, "FAILED with %d sessions: %s\n", n, what);
+    failed = 1;
+  }
+}
+
+/* all measurements for n sessions, times in ns per operation */
+static void run(int n) {
+  struct sockaddr_storage src, dst;
+  client_t *client, **all;
+  host_t src_h;
+  uint64_t t, now;
+  double insert, hit, miss, byfd, bysrc, seen, idle, rearm, expire;
+  int64_t heap0, heap1;
+  uint32_t rnd = 2463534242U;
+  int i, lookups = n > LOOKUPS ? n : LOOKUPS;
+  int ok, ticks;
+
+  all = malloc(sizeof(client_t *) * n);
+  client_addr(&dst, 0);
+  closed = 0;
+
+  heap0 = heap_used();
+  client_init(T0, 0);
+
+  /* insert */
+  t = now_ns();
+  for(i=0; i<n; i++) {
+    client_addr(&src, i);
+    client = client_new(FAKE_FD + i, (struct sockaddr *)&src, (struct sockaddr *)&dst, NULL, 0, TIMEOUT);
+    client_add(client);
+    all[i] = client;
+  }
+  insert = (double)(now_ns() - t) / n;
+  heap1 = heap_used();
+  check(HASH_COUNT(clients) == (unsigned)n, "sessions after insert", n);
+
+  /* lookups of known clients in random order, by address */
+  ok = 1;
+  t = now_ns();
+  for(i=0; i<lookups; i++) {
+    uint32_t k = xorshift(&rnd) % n;
+    client_addr(&src, k);
+    client = client_find_addr(0, (struct sockaddr *)&src);
+    ok &= (client == all[k]);
+  }
+  hit = (double)(now_ns() - t) / lookups;
+  check(ok, "find by address", n);
+
+  /* unknown clients */
+  ok = 1;
+  t = now_ns();
+  for(i=0; i<lookups; i++) {
+    client_addr(&src, n + xorshift(&rnd) % (1 << 24));
+    ok &= (client_find_addr(0, (struct sockaddr *)&src) == NULL);
+  }
+  miss = (double)(now_ns() - t) / lookups;
+  check(ok, "miss of unknown address", n);
+
+  /* by socket */
+  ok = 1;
+  t = now_ns();
+  for(i=0; i<lookups; i++) {
+    uint32_t k = xorshift(&rnd) % n;
+    ok &= (client_find_fd(FAKE_FD + k) == all[k]);
+  }
+  byfd = (double)(now_ns() - t) / lookups;
+  check(ok, "find by socket", n);
+
+  /* by host_t, as used with parsed addresses */
+  ok = 1;
+  t = now_ns();
+  for(i=0; i<lookups; i++) {
+    uint32_t k = xorshift(&rnd) % n;
+    client_addr(&src, k);
+    host_set(&src_h, (struct sockaddr *)&src);
+    ok &= (client_find_src(0, &src_h) == all[k]);
+  }
+  bysrc = (double)(now_ns() - t) / lookups;
+  check(ok, "find by host", n);
+
+  /* traffic halfway through MAXAGE */
+  now = T0 + MAXAGE * 1000 / 2;
+  client_tick(now);
+  t = now_ns();
+  for(i=0; i<n; i++)
+    client_seen(all[i]);
+  seen = (double)(now_ns() - t) / n;
+
+  /* loop iterations without anything to expire, one per wheel tick */
+  ticks = 0;
+  t = now_ns();
+  for(now = T0; now < T0 + MAXAGE * 1000 - WHEEL_TICK; now += WHEEL_TICK) {
+    client_tick(now);
+    client_clean(0);
+    ticks++;
+  }
+  idle = (double)(now_ns() - t) / ticks;
+  check(HASH_COUNT(clients) == (unsigned)n, "sessions before MAXAGE", n);
+
+  /* MAXAGE after the insert: all timers fire, but the sessions have been
+     seen since, so they are re-armed instead */
+  client_tick(T0 + MAXAGE * 1000 + WHEEL_TICK);
+  t = now_ns();
+  client_clean(0);
+  rearm = (double)(now_ns() - t) / n;
+  check(HASH_COUNT(clients) == (unsigned)n, "sessions seen are kept", n);
+
+  /* MAXAGE after they have been seen, all expire */
+  client_tick(T0 + MAXAGE * 1000 / 2 + MAXAGE * 1000 + WHEEL_TICK);
+  t = now_ns();
+  client_clean(0);
+  client_reap();
+  expire = (double)(now_ns() - t) / n;
+  check(HASH_COUNT(clients) == 0, "all sessions expired", n);
+  check(closed == (uint64_t)n, "all sockets closed", n);
+
+  client_done();
+  free(all);
+
+  printf("%8d %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f %8.1f %8.1f",
+         n, insert, hit, miss, byfd, bysrc, seen, idle / 1000.0, rearm, expire);
+  if(heap0 >= 0)
+    printf(" %8.0f\n", (double)(heap1 - heap0) / n);
+  else
+    printf(" %8s\n", "-");
+  fflush(stdout);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: sessbench [-6] [-n sessions,sessions,..]\n\n"
+          "-6             v6 clients instead of v4\n"
+          "-n <n,n,..>    session counts, default: 10,100,1000,10000,100000,1000000\n");
+}
+
+int main(int argc, char **argv) {
+  char *list = "10,100,1000,10000,100000,1000000";
+  char *copy, *tok, *save = NULL;
+  int opt, n;
+
+  while((opt = getopt(argc, argv, "6n:h")) != -1) {
+    switch(opt) {
+    case '6': V6 = 1; break;
+    case 'n': list = optarg; break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  printf("# %s clients, times in ns per operation, idle in us per loop iteration\n",
+         V6 ? "v6" : "v4");
+  printf("%8s %8s %8s %8s %8s %8s %8s %9s %8s %8s %8s\n",
+         "sessions", "insert", "hit", "miss", "byfd", "bysrc", "seen",
+         "idle", "rearm", "expire", "bytes");
+
+  copy = strdup(list);
+  for(tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    n = atoi(tok);
+    if(n > 0 && n <= (1 << 24))
+      run(n);
+  }
+  free(copy);
+
+  return failed;
+}
@@ -0,0 +1,1546 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+/*
+  udpxbench - loopback benchmark for udpxd.
+
+  Starts udpxd between a multi-threaded load generator and an echo sink,
+  all on 127.0.0.1 (or ::1 with -6), and sweeps over the number of
+  concurrent clients (source ports), payload sizes and traffic modes:
+
+  rr      every client sends a request and waits for the answer before
+          sending the next one (closed loop)
+  oneway  the clients send as fast as they can, the sink doesn't answer
+
+  For each combination it reports the datagrams relayed per second, the
+  latency added by udpxd (p50/p99/p999) and the cpu time udpxd and its
+  workers spent per relayed datagram. Linux only.
+
+  The latency is measured with probes: during the run a separate client
+  sends paced requests at a fixed rate, open loop, in turns through
+  udpxd and directly to the sink, which answers them in both modes. The
+  added latency is the difference of the two, both measured under the
+  same load. Percentiles with too few samples beyond them are shown as
+  "-", differences below zero (noise) as 0.
+
+  With -k it runs a soak test instead: for the given time new clients
+  (source ports) arrive at a steady rate, each sends one request, waits
+  for the answer and disappears, so udpxd creates and expires sessions
+  all the time. Every few seconds the rss, open fds, heap usage (from
+  the statistics of udpxd, see SIGUSR1) and the latency of the first
+  datagram of a new session are reported. At the end the second half of
+  the run is compared to the first half (after udpxd had time to reach
+  its steady state), the exit code is 1 if anything kept growing.
+
+  With -p udpxd relays a range of ports instead of one, each port to its
+  own port of the sink, and the clients are spread over the ports. The
+  rss and open fds of udpxd are reported after each run.
+
+  With -L it checks that late answers don't reach the wrong client: the
+  sink answers a few clients once more after their sessions aged out,
+  while new clients are talking. Those must only see their own answers,
+  the exit code is 1 otherwise.
+
+  Run with "make bench", see usage() for the options.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <stddef.h>
+
+#include <dirent.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MODE_RR      0
+#define MODE_ONEWAY  1
+
+#define LPORT        15353     /* udpxd listens here */
+#define SPORT        15354     /* the sink listens here */
+#define LBASE        10000     /* -p: udpxd listens on LBASE..LBASE+ports-1 */
+#define SBASE        20000     /* -p: the sink listens on SBASE..SBASE+ports-1 */
+#define PORTS_MAX    10000
+
+#define THREADS_MAX  16
+#define SINK_VLEN    32        /* datagrams per recvmmsg() of the sink */
+#define PAYLOAD_MIN  16        /* room for the timestamp and client id */
+#define PAYLOAD_MAX  65000
+#define RR_TIMEOUT   500000000ULL  /* ns after which a request counts as lost */
+#define RR_START     256       /* clients started per loop iteration */
+
+#define PROBE_RATE   5000      /* probes per second and path */
+#define PROBE_TAIL   5         /* samples needed beyond a percentile */
+#define PROBE_DIRECT 0
+#define PROBE_VIA    1
+#define STAMP_PROBE  1         /* stamp_t.kind: answer even in oneway mode */
+
+#define SOAK_MAXAGE  30        /* MAXAGE of client.h, sessions live that long */
+#define SOAK_SLOTS   65536     /* new clients waiting for their answer */
+#define SOAK_SAMPLES 100000
+
+#define LATE_CLIENTS 8         /* -L: clients per generation */
+#define LATE_NEW     2500      /* -L: ms until the new clients start, sessions live 1s */
+#define LATE_DELAY   3000      /* -L: ms until the sink answers the old clients again */
+#define LATE_END     4500      /* -L: ms until the check ends */
+
+/*
+  latency histogram, log-linear: values below 32 ns have their own
+  bucket, above that 32 buckets per power of 2, about 3% precision
+*/
+#define HIST_SUB     32
+#define HIST_BUCKETS (HIST_SUB + 59 * HIST_SUB)
+
+struct _hist_t {
+  uint64_t count[HIST_BUCKETS];
+  uint64_t total;
+};
+typedef struct _hist_t hist_t;
+
+/* what a client puts in front of every datagram */
+struct _stamp_t {
+  uint64_t sent;            /* CLOCK_MONOTONIC, ns */
+  uint32_t client;
+  uint32_t kind;            /* 0 or STAMP_PROBE */
+};
+typedef struct _stamp_t stamp_t;
+
+/* one thread of the load generator and its clients */
+struct _gen_t {
+  pthread_t thread;
+  int mode;
+  size_t size;
+  int nsock;
+  int *fds;
+  uint64_t *outstanding;    /* rr: timestamp of the pending request per client */
+  int first;                /* global number of the first client */
+  int epfd;
+  uint64_t sent;
+  uint64_t recvd;
+  uint64_t lost;
+};
+typedef struct _gen_t gen_t;
+
+/* paced requests through udpxd and directly, see probe_main() */
+struct _probe_t {
+  pthread_t thread;
+  size_t size;
+  int fds[2];               /* PROBE_DIRECT and PROBE_VIA */
+  uint64_t recvd[2];
+  hist_t hist[2];           /* round trip time */
+};
+typedef struct _probe_t probe_t;
+
+/* one thread of the echo sink */
+struct _sink_t {
+  pthread_t thread;
+  int mode;
+  int fd;                   /* without -p */
+  int *fds;                 /* -p: the ports of this thread */
+  int nfd;
+  int epfd;
+  uint64_t pkts;            /* without probes */
+};
+typedef struct _sink_t sink_t;
+
+/* the result of one run */
+struct _result_t {
+  int clients;              /* clients actually created */
+  double pps;               /* datagrams relayed per second */
+  double lat[3];            /* added latency p50/p99/p999 in us, -1 if too few samples */
+  double cpu;               /* udpxd cpu ns per datagram, -1 if unknown */
+  double loss;              /* percent */
+  double rss;               /* udpxd, kB */
+  double fds;               /* udpxd */
+};
+typedef struct _result_t result_t;
+
+/* soak test: one thread creating clients */
+struct _soak_t {
+  pthread_t thread;
+  int *fds;                 /* per slot, -1 if free */
+  uint64_t *sent;           /* per slot */
+  int *free;                /* stack of free slots */
+  int nfree;
+  int epfd;
+  uint64_t made;            /* clients created */
+  uint64_t lost;            /* no answer within RR_TIMEOUT */
+  uint64_t failed;          /* no socket */
+  pthread_mutex_t lock;     /* protects hist */
+  hist_t hist;              /* latency of the first datagram, per interval */
+};
+typedef struct _soak_t soak_t;
+
+/* one line of the soak report */
+struct _sample_t {
+  double t;
+  double rss;               /* kB */
+  double fds;
+  double sessions;
+  double heap_used;         /* bytes */
+  double heap_total;
+  double frag;              /* percent of the heap not in use */
+  double p99;               /* ns */
+};
+typedef struct _sample_t sample_t;
+
+/* -L: an answer the sink sends once more */
+struct _late_t {
+  struct sockaddr_storage addr; /* outgoing socket of udpxd */
+  socklen_t len;
+  stamp_t st;
+  uint64_t due;             /* ns */
+};
+typedef struct _late_t late_t;
+
+static char *UDPXD     = "./udpxd";
+static int V6          = 0;
+static int THREADS     = 0;
+static double DURATION = 1.0;
+static int NOBASE      = 0;
+static int VERBOSE     = 0;
+static char **XARGS    = NULL;
+static int NXARGS      = 0;
+static int FDMAX       = 1024;  /* clients we can open, see main() */
+static int SOAK        = 0;     /* seconds */
+static int RATE        = 500;   /* new clients per second */
+static int INTERVAL    = 10;    /* seconds between samples */
+static int PORTS       = 0;     /* relay a range of ports, see -p */
+static int LATE        = 0;     /* -L */
+static char *CONFIG    = NULL;  /* setup file for udpxd -f instead of -l/-t/-b */
+
+static volatile int MEASURING = 0;
+static volatile int GEN_STOP  = 0;
+static volatile int SINK_STOP = 0;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_s(double s) {
+  struct timespec ts;
+  ts.tv_sec  = (time_t)s;
+  ts.tv_nsec = (long)((s - ts.tv_sec) * 1e9);
+  while(nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+static int hist_index(uint64_t v) {
+  int e;
+  if(v < HIST_SUB)
+    return (int)v;
+  e = 63 - __builtin_clzll(v);
+  return HIST_SUB + (e - 5) * HIST_SUB + (int)((v >> (e - 5)) - HIST_SUB);
+}
+
+static uint64_t hist_value(int i) {
+  int e;
+  if(i < HIST_SUB)
+    return i;
+  e = (i - HIST_SUB) / HIST_SUB + 5;
+  return (uint64_t)(HIST_SUB + (i - HIST_SUB) % HIST_SUB) << (e - 5);
+}
+
+static void hist_add(hist_t *h, uint64_t v) {
+  h->count[hist_index(v)]++;
+  h->total++;
+}
+
+/* the value below which p percent of the samples are */
+static uint64_t hist_pct(hist_t *h, double p) {
+  uint64_t want = (uint64_t)(h->total * p / 100.0);
+  uint64_t seen = 0;
+  int i;
+
+  for(i=0; i<HIST_BUCKETS; i++) {
+    seen += h->count[i];
+    if(seen > want)
+      return hist_value(i);
+  }
+  return 0;
+}
+
+static void addr_make(struct sockaddr_storage *ss, socklen_t *len, int host, int port) {
+  memset(ss, 0, sizeof(*ss));
+  if(V6) {
+    struct sockaddr_in6 *a = (struct sockaddr_in6 *)ss;
+    a->sin6_family = AF_INET6;
+    a->sin6_addr   = in6addr_loopback;
+    a->sin6_port   = htons(port);
+    *len = sizeof(*a);
+  }
+  else {
+    /* the whole 127/8 is loopback, more addresses for more source ports */
+    struct sockaddr_in *a = (struct sockaddr_in *)ss;
+    a->sin_family      = AF_INET;
+    a->sin_addr.s_addr = htonl(0x7f000000 | host);
+    a->sin_port        = htons(port);
+    *len = sizeof(*a);
+  }
+}
+
+static void gen_send(gen_t *g, int i, unsigned char *buf) {
+  stamp_t *st = (stamp_t *)buf;
+
+  st->sent   = now_ns();
+  st->client = g->first + i;
+
+  if(send(g->fds[i], buf, g->size, MSG_DONTWAIT) < 0)
+    return;
+
+  if(g->mode == MODE_RR)
+    g->outstanding[i] = st->sent;
+  if(MEASURING)
+    g->sent++;
+}
+
+/* rr: got an answer, record it and send the next request */
+static void gen_answer(gen_t *g, int i, unsigned char *buf, unsigned char *out) {
+  stamp_t st;
+  ssize_t len;
+
+  while((len = recv(g->fds[i], buf, PAYLOAD_MAX, MSG_DONTWAIT)) > 0) {
+    if((size_t)len < sizeof(stamp_t))
+      continue;
+    memcpy(&st, buf, sizeof(stamp_t));
+    if(st.sent != g->outstanding[i])
+      continue; /* answer to a request we already gave up on */
+    if(MEASURING)
+      g->recvd++;
+    gen_send(g, i, out);
+  }
+}
+
+static void *gen_main(void *arg) {
+  gen_t *g = arg;
+  struct epoll_event evs[256];
+  unsigned char *buf = malloc(PAYLOAD_MAX);
+  unsigned char *out = calloc(1, g->size);
+  uint64_t now, lastscan = now_ns();
+  int i, n, started = 0;
+
+  if(g->mode == MODE_ONEWAY) {
+    for(i=0; ! GEN_STOP; i = (i + 1) % g->nsock)
+      gen_send(g, i, out);
+  }
+  else {
+    while(! GEN_STOP) {
+      /* don't start all clients at once, the burst would be dropped */
+      for(n=0; started < g->nsock && n < RR_START; n++)
+        gen_send(g, started++, out);
+
+      n = epoll_wait(g->epfd, evs, 256, started < g->nsock ? 1 : 10);
+      for(i=0; i<n; i++)
+        gen_answer(g, evs[i].data.u32, buf, out);
+
+      /* resend lost requests */
+      now = now_ns();
+      if(now - lastscan > RR_TIMEOUT / 5) {
+        lastscan = now;
+        for(i=0; i<started; i++) {
+          if(now - g->outstanding[i] > RR_TIMEOUT) {
+            if(MEASURING)
+              g->lost++;
+            gen_send(g, i, out);
+          }
+        }
+      }
+    }
+  }
+
+  free(buf);
+  free(out);
+  return NULL;
+}
+
+/* send the probes of both paths at PROBE_RATE, whatever the load, and
+   take their answers right away */
+static void *probe_main(void *arg) {
+  probe_t *p = arg;
+  struct pollfd pfd[2];
+  struct timespec ts;
+  unsigned char *buf = malloc(PAYLOAD_MAX);
+  unsigned char *out = calloc(1, p->size);
+  stamp_t *st = (stamp_t *)out, in;
+  uint64_t now, next = now_ns();
+  ssize_t len;
+  int i, first = PROBE_DIRECT;
+
+  st->kind = STAMP_PROBE;
+  for(i=0; i<2; i++) {
+    pfd[i].fd = p->fds[i];
+    pfd[i].events = POLLIN;
+  }
+
+  while(! GEN_STOP) {
+    now = now_ns();
+    if(now >= next) {
+      /* in turns first, so neither path waits for the other */
+      for(i=0; i<2; i++) {
+        st->sent = now_ns();
+        send(p->fds[(first + i) % 2], out, p->size, MSG_DONTWAIT);
+      }
+      first ^= 1;
+      next += 1000000000ULL / PROBE_RATE;
+      if(next < now)
+        next = now; /* behind, don't send a burst */
+      continue;
+    }
+
+    ts.tv_sec  = (next - now) / 1000000000ULL;
+    ts.tv_nsec = (next - now) % 1000000000ULL;
+    if(ppoll(pfd, 2, &ts, NULL) <= 0)
+      continue;
+
+    for(i=0; i<2; i++) {
+      if(! (pfd[i].revents & POLLIN))
+        continue;
+      while((len = recv(p->fds[i], buf, PAYLOAD_MAX, MSG_DONTWAIT)) > 0) {
+        if((size_t)len < sizeof(stamp_t) || ! MEASURING)
+          continue;
+        memcpy(&in, buf, sizeof(stamp_t));
+        hist_add(&p->hist[i], now_ns() - in.sent);
+        p->recvd[i]++;
+      }
+    }
+  }
+
+  free(buf);
+  free(out);
+  return NULL;
+}
+
+/* receive what is there on fd and answer or count it, returns -1 if
+   nothing was received */
+static int sink_batch(sink_t *s, int fd, int flags, unsigned char *bufs) {
+  struct mmsghdr msgs[SINK_VLEN];
+  struct iovec iovs[SINK_VLEN];
+  struct sockaddr_storage addrs[SINK_VLEN];
+  stamp_t st;
+  int i, n, rr;
+
+  for(i=0; i<SINK_VLEN; i++) {
+    iovs[i].iov_base = bufs + (size_t)i * PAYLOAD_MAX;
+    iovs[i].iov_len  = PAYLOAD_MAX;
+    memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    msgs[i].msg_hdr.msg_name    = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    msgs[i].msg_hdr.msg_iov     = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen  = 1;
+  }
+
+  n = recvmmsg(fd, msgs, SINK_VLEN, flags, NULL);
+  if(n <= 0)
+    return -1; /* timeout, see SO_RCVTIMEO */
+
+  /* probes are answered in both modes and not counted */
+  for(i=0, rr=0; i<n; i++) {
+    iovs[i].iov_len = msgs[i].msg_len;
+    st.kind = 0;
+    if(msgs[i].msg_len >= sizeof(stamp_t))
+      memcpy(&st, iovs[i].iov_base, sizeof(stamp_t));
+    if(st.kind == STAMP_PROBE) {
+      sendto(fd, iovs[i].iov_base, msgs[i].msg_len, MSG_DONTWAIT,
+             (struct sockaddr *)&addrs[i], msgs[i].msg_hdr.msg_namelen);
+      continue;
+    }
+    if(MEASURING)
+      s->pkts++;
+    msgs[rr++] = msgs[i];
+  }
+
+  if(s->mode == MODE_RR && rr > 0)
+    sendmmsg(fd, msgs, rr, MSG_DONTWAIT);
+
+  return 0;
+}
+
+static void *sink_main(void *arg) {
+  sink_t *s = arg;
+  struct epoll_event evs[256];
+  unsigned char *bufs = malloc((size_t)SINK_VLEN * PAYLOAD_MAX);
+  int i, n;
+
+  while(! SINK_STOP) {
+    if(s->nfd == 0) {
+      sink_batch(s, s->fd, MSG_WAITFORONE, bufs);
+      continue;
+    }
+
+    /* -p: many ports, drain the ready ones */
+    n = epoll_wait(s->epfd, evs, 256, 50);
+    for(i=0; i<n; i++)
+      while(sink_batch(s, s->fds[evs[i].data.u32], MSG_DONTWAIT, bufs) == 0)
+        ;
+  }
+
+  free(bufs);
+  return NULL;
+}
+
+static int sink_socket(int port);
+
+/* the sockets of sink thread t, one or with -p every THREADS-th port */
+static int sink_open(sink_t *s, int t) {
+  struct epoll_event ev;
+  int port;
+
+  if(PORTS == 0)
+    return (s->fd = sink_socket(SPORT)) < 0 ? -1 : 0;
+
+  s->fds  = malloc(sizeof(int) * (PORTS / THREADS + 1));
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+  for(port=t; port<PORTS; port+=THREADS) {
+    if((s->fds[s->nfd] = sink_socket(SBASE + port)) < 0)
+      return -1;
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u32 = s->nfd++;
+    epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->fds[s->nfd - 1], &ev);
+  }
+
+  return 0;
+}
+
+static void sink_close(sink_t *s) {
+  int i;
+
+  if(s->nfd == 0) {
+    close(s->fd);
+    return;
+  }
+  for(i=0; i<s->nfd; i++)
+    close(s->fds[i]);
+  close(s->epfd);
+  free(s->fds);
+}
+
+static int sink_socket(int port) {
+  struct sockaddr_storage ss;
+  struct timeval tv = { 0, 50000 };
+  socklen_t len;
+  int one = 1, size = 4 << 20;
+  int fd = socket(V6 ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if(fd < 0)
+    return -1;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+  addr_make(&ss, &len, 1, port);
+  if(bind(fd, (struct sockaddr *)&ss, len) != 0) {
+    perror("unable to bind sink");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* client number i, connected to port */
+static int gen_socket(int i, int port) {
+  struct sockaddr_storage ss;
+  socklen_t len;
+  int fd = socket(V6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+
+  if(fd < 0)
+    return -1;
+
+  /* 127.0.0.2 and up, 20000 clients each, udpxd uses 127.0.0.1 */
+  addr_make(&ss, &len, 2 + i / 20000, 0);
+  if(bind(fd, (struct sockaddr *)&ss, len) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  addr_make(&ss, &len, 1, port);
+  if(connect(fd, (struct sockaddr *)&ss, len) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* errfd, if given, is set to a pipe connected to stderr of udpxd */
+static pid_t udpxd_start(int *errfd) {
+  char *argv[32 + 64];
+  char listen[64], to[64];
+  int argc = 0, i, null;
+  int pfd[2];
+  pid_t pid;
+
+  if(errfd != NULL && pipe(pfd) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  if(PORTS > 0) {
+    snprintf(listen, sizeof(listen), V6 ? "[::1]:%d-%d" : "127.0.0.1:%d-%d",
+             LBASE, LBASE + PORTS - 1);
+    snprintf(to, sizeof(to), V6 ? "[::1]:%d" : "127.0.0.1:%d", SBASE);
+  }
+  else {
+    snprintf(listen, sizeof(listen), V6 ? "[::1]:%d" : "127.0.0.1:%d", LPORT);
+    snprintf(to, sizeof(to), V6 ? "[::1]:%d" : "127.0.0.1:%d", SPORT);
+  }
+
+  argv[argc++] = UDPXD;
+  if(CONFIG != NULL) {
+    argv[argc++] = "-f";
+    argv[argc++] = CONFIG;
+  }
+  else {
+    argv[argc++] = "-l";
+    argv[argc++] = listen;
+    argv[argc++] = "-t";
+    argv[argc++] = to;
+    argv[argc++] = "-b";
+    argv[argc++] = V6 ? "::1" : "127.0.0.1";
+  }
+  for(i=0; i<NXARGS && argc < 32 + 63; i++)
+    argv[argc++] = XARGS[i];
+  argv[argc] = NULL;
+
+  pid = fork();
+  if(pid < 0) {
+    perror("fork");
+    return -1;
+  }
+
+  if(pid == 0) {
+    if(! VERBOSE && (null = open("/dev/null", O_WRONLY)) >= 0) {
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+    if(errfd != NULL) {
+      dup2(pfd[1], STDERR_FILENO);
+      close(pfd[0]);
+      close(pfd[1]);
+    }
+    execv(UDPXD, argv);
+    perror(UDPXD);
+    _exit(127);
+  }
+
+  if(errfd != NULL) {
+    close(pfd[1]);
+    fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+    *errfd = pfd[0];
+  }
+
+  sleep_s(0.3);
+  if(waitpid(pid, NULL, WNOHANG) == pid) {
+    fprintf(stderr, "%s did not start\n", UDPXD);
+    return -1;
+  }
+
+  return pid;
+}
+
+static void udpxd_stop(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+/* user + system time of a process in ns, -1 if unknown. ppid, if
+   given, is set to its parent. */
+static int64_t proc_cpu(pid_t pid, pid_t *ppid) {
+  char path[64], line[1024], *p;
+  unsigned long utime, stime;
+  int ok, parent;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  if((f = fopen(path, "r")) == NULL)
+    return -1;
+  p = fgets(line, sizeof(line), f);
+  fclose(f);
+
+  /* the command may contain spaces, the fields start after it */
+  if(p == NULL || (p = strrchr(line, ')')) == NULL)
+    return -1;
+
+  ok = sscanf(p + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &parent, &utime, &stime);
+  if(ok != 3)
+    return -1;
+  if(ppid != NULL)
+    *ppid = parent;
+
+  return (int64_t)(utime + stime) * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+/* user + system time of udpxd and its workers (-w) in ns, -1 if unknown */
+static int64_t udpxd_cpu(pid_t pid) {
+  int64_t total = proc_cpu(pid, NULL), cpu;
+  struct dirent *de;
+  pid_t child, parent;
+  DIR *d;
+
+  if(total < 0 || (d = opendir("/proc")) == NULL)
+    return total;
+  while((de = readdir(d)) != NULL) {
+    if((child = atoi(de->d_name)) <= 0 || child == pid)
+      continue;
+    if((cpu = proc_cpu(child, &parent)) >= 0 && parent == pid)
+      total += cpu;
+  }
+  closedir(d);
+
+  return total;
+}
+
+/* a field of /proc/pid/status, in kB */
+static double proc_status(pid_t pid, const char *field) {
+  char path[64], line[256];
+  double value = -1;
+  size_t flen = strlen(field);
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  if((f = fopen(path, "r")) == NULL)
+    return -1;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(strncmp(line, field, flen) == 0 && line[flen] == ':') {
+      value = atof(line + flen + 1);
+      break;
+    }
+  }
+  fclose(f);
+
+  return value;
+}
+
+static double proc_fds(pid_t pid) {
+  char path[64];
+  struct dirent *de;
+  double n = 0;
+  DIR *d;
+
+  snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+  if((d = opendir(path)) == NULL)
+    return -1;
+  while((de = readdir(d)) != NULL)
+    if(de->d_name[0] != '.')
+      n++;
+  closedir(d);
+
+  return n;
+}
+
+/* latency added at percentile pct in us, -1 if too few probes got
+   beyond it on either path. Below zero it is noise, both paths had the
+   same load. With -n the latency through udpxd. */
+static double probe_added(probe_t *pr, double pct) {
+  double via, direct;
+  int i;
+
+  for(i=0; i<2; i++)
+    if(pr->hist[i].total * (1 - pct / 100) < PROBE_TAIL)
+      return -1;
+
+  via    = hist_pct(&pr->hist[PROBE_VIA], pct) / 1000.0;
+  direct = hist_pct(&pr->hist[PROBE_DIRECT], pct) / 1000.0;
+  if(NOBASE)
+    return via;
+  return via > direct ? via - direct : 0;
+}
+
+/* one run through udpxd */
+static int run(int mode, size_t size, int clients, result_t *res) {
+  sink_t sinks[THREADS_MAX];
+  gen_t gens[THREADS_MAX];
+  struct epoll_event ev;
+  probe_t *pr;
+  uint64_t relayed = 0, sent = 0, lost = 0;
+  int64_t cpu0 = -1, cpu1 = -1;
+  pid_t pid;
+  int i, j, t, fd, made = 0;
+
+  memset(sinks, 0, sizeof(sinks));
+  memset(gens, 0, sizeof(gens));
+  pr = calloc(1, sizeof(probe_t));
+
+  MEASURING = GEN_STOP = SINK_STOP = 0;
+
+  for(t=0; t<THREADS; t++) {
+    sinks[t].mode = mode;
+    if(sink_open(&sinks[t], t) != 0)
+      return -1;
+    pthread_create(&sinks[t].thread, NULL, sink_main, &sinks[t]);
+  }
+
+  if((pid = udpxd_start(NULL)) < 0) {
+    SINK_STOP = 1;
+    for(t=0; t<THREADS; t++) {
+      pthread_join(sinks[t].thread, NULL);
+      sink_close(&sinks[t]);
+    }
+    return -1;
+  }
+
+  /* the probes, to the first port of the sink and through udpxd */
+  pr->size = size;
+  pr->fds[PROBE_DIRECT] = gen_socket(0, PORTS > 0 ? SBASE : SPORT);
+  pr->fds[PROBE_VIA]    = gen_socket(0, PORTS > 0 ? LBASE : LPORT);
+  if(pr->fds[PROBE_DIRECT] < 0 || pr->fds[PROBE_VIA] < 0) {
+    perror("unable to create the probes");
+    return -1;
+  }
+  made = 2;
+
+  /* the clients, spread over the generator threads */
+  for(t=0; t<THREADS; t++) {
+    gen_t *g = &gens[t];
+    g->mode  = mode;
+    g->size  = size;
+    g->first = made - 2;
+    g->nsock = clients / THREADS + (t < clients % THREADS);
+    g->fds   = calloc(g->nsock + 1, sizeof(int));
+    g->outstanding = calloc(g->nsock + 1, sizeof(uint64_t));
+    g->epfd  = epoll_create1(0);
+
+    /* with -p the sink needs PORTS sockets as well */
+    for(j=0; j<g->nsock && made < FDMAX - PORTS; j++) {
+      if(PORTS > 0)
+        fd = gen_socket(made, LBASE + made % PORTS);
+      else
+        fd = gen_socket(made, LPORT);
+      if(fd < 0)
+        break;
+      g->fds[j] = fd;
+      memset(&ev, 0, sizeof(ev));
+      ev.events   = EPOLLIN;
+      ev.data.u32 = j;
+      epoll_ctl(g->epfd, EPOLL_CTL_ADD, fd, &ev);
+      made++;
+    }
+    g->nsock = j;
+  }
+  res->clients = made - 2;
+
+  for(t=0; t<THREADS; t++)
+    if(gens[t].nsock > 0)
+      pthread_create(&gens[t].thread, NULL, gen_main, &gens[t]);
+  pthread_create(&pr->thread, NULL, probe_main, pr);
+
+  /* time to set up the sessions */
+  sleep_s(0.5 + made / 20000.0);
+
+  cpu0 = udpxd_cpu(pid);
+  MEASURING = 1;
+  sleep_s(DURATION);
+  MEASURING = 0;
+  cpu1 = udpxd_cpu(pid);
+  res->rss = proc_status(pid, "VmRSS");
+  res->fds = proc_fds(pid);
+
+  GEN_STOP = 1;
+  for(t=0; t<THREADS; t++) {
+    if(gens[t].nsock > 0)
+      pthread_join(gens[t].thread, NULL);
+  }
+  pthread_join(pr->thread, NULL);
+  SINK_STOP = 1;
+  for(t=0; t<THREADS; t++) {
+    pthread_join(sinks[t].thread, NULL);
+    sink_close(&sinks[t]);
+  }
+  udpxd_stop(pid);
+
+  for(t=0; t<THREADS; t++) {
+    sent += gens[t].sent;
+    lost += gens[t].lost;
+    if(mode == MODE_RR)
+      relayed += gens[t].recvd * 2; /* request and answer */
+    else
+      relayed += sinks[t].pkts;
+    for(i=0; i<gens[t].nsock; i++)
+      close(gens[t].fds[i]);
+    close(gens[t].epfd);
+    free(gens[t].fds);
+    free(gens[t].outstanding);
+  }
+  close(pr->fds[PROBE_DIRECT]);
+  close(pr->fds[PROBE_VIA]);
+
+  res->pps    = relayed / DURATION;
+  res->lat[0] = probe_added(pr, 50);
+  res->lat[1] = probe_added(pr, 99);
+  res->lat[2] = probe_added(pr, 99.9);
+
+  if(mode == MODE_RR)
+    res->loss = sent ? 100.0 * lost / sent : 0;
+  else
+    res->loss = sent > relayed ? 100.0 * (sent - relayed) / sent : 0;
+
+  /* udpxd relayed the probes as well */
+  relayed += pr->recvd[PROBE_VIA] * 2;
+  res->cpu = (cpu0 >= 0 && cpu1 >= 0 && relayed) ? (double)(cpu1 - cpu0) / relayed : -1;
+
+  free(pr);
+  return 0;
+}
+
+/* soak: a new client sends its first request */
+static void soak_new(soak_t *k, unsigned char *out, size_t size) {
+  struct sockaddr_storage ss;
+  struct epoll_event ev;
+  stamp_t *st = (stamp_t *)out;
+  socklen_t len;
+  int fd, slot;
+
+  fd = socket(V6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+  if(fd < 0) {
+    k->failed++;
+    return;
+  }
+
+  /* spread the clients over 64 addresses, so source ports are not
+     reused while udpxd still has a session for them */
+  addr_make(&ss, &len, 2 + k->made % 64, 0);
+  if(bind(fd, (struct sockaddr *)&ss, len) != 0) {
+    close(fd);
+    k->failed++;
+    return;
+  }
+  addr_make(&ss, &len, 1, LPORT);
+  if(connect(fd, (struct sockaddr *)&ss, len) != 0) {
+    close(fd);
+    k->failed++;
+    return;
+  }
+
+  slot = k->free[--k->nfree];
+  k->fds[slot] = fd;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events   = EPOLLIN;
+  ev.data.u32 = slot;
+  epoll_ctl(k->epfd, EPOLL_CTL_ADD, fd, &ev);
+
+  st->sent   = now_ns();
+  st->client = (uint32_t)k->made++;
+  k->sent[slot] = st->sent;
+  send(fd, out, size, MSG_DONTWAIT);
+}
+
+/* soak: the client is done, its session in udpxd will age out */
+static void soak_done(soak_t *k, int slot) {
+  close(k->fds[slot]);
+  k->fds[slot] = -1;
+  k->free[k->nfree++] = slot;
+}
+
+static void *soak_main(void *arg) {
+  soak_t *k = arg;
+  struct epoll_event evs[256];
+  unsigned char buf[PAYLOAD_MIN * 4];
+  unsigned char out[PAYLOAD_MIN * 4];
+  uint64_t now, next = now_ns(), lastscan = next;
+  stamp_t st;
+  ssize_t len;
+  int i, n, slot;
+
+  memset(out, 0, sizeof(out));
+
+  while(! GEN_STOP) {
+    now = now_ns();
+
+    /* new clients at a steady rate */
+    while(next <= now && k->nfree > 0) {
+      soak_new(k, out, sizeof(out));
+      next += 1000000000ULL / RATE;
+    }
+    if(next <= now)
+      next = now; /* too many waiting, don't try to catch up */
+
+    n = epoll_wait(k->epfd, evs, 256, 1);
+    for(i=0; i<n; i++) {
+      slot = evs[i].data.u32;
+      len = recv(k->fds[slot], buf, sizeof(buf), MSG_DONTWAIT);
+      if(len < (ssize_t)sizeof(stamp_t))
+        continue;
+      memcpy(&st, buf, sizeof(stamp_t));
+      if(st.sent != k->sent[slot])
+        continue;
+      pthread_mutex_lock(&k->lock);
+      hist_add(&k->hist, now_ns() - st.sent);
+      pthread_mutex_unlock(&k->lock);
+      soak_done(k, slot);
+    }
+
+    now = now_ns();
+    if(now - lastscan > RR_TIMEOUT / 5) {
+      lastscan = now;
+      for(slot=0; slot<SOAK_SLOTS; slot++) {
+        if(k->fds[slot] >= 0 && now - k->sent[slot] > RR_TIMEOUT) {
+          k->lost++;
+          soak_done(k, slot);
+        }
+      }
+    }
+  }
+
+  for(slot=0; slot<SOAK_SLOTS; slot++)
+    if(k->fds[slot] >= 0)
+      soak_done(k, slot);
+
+  return NULL;
+}
+
+/* ask udpxd for its statistics and pick sessions and heap usage */
+static int udpxd_stats(pid_t pid, int errfd, sample_t *sm) {
+  static char buf[8192];
+  static size_t fill = 0;
+  struct pollfd pfd;
+  unsigned long long a, b;
+  uint64_t until = now_ns() + 1000000000ULL;
+  char *line, *nl, *p;
+  ssize_t len;
+
+  kill(pid, SIGUSR1);
+
+  while(now_ns() < until) {
+    pfd.fd = errfd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, 100) <= 0)
+      continue;
+
+    len = read(errfd, buf + fill, sizeof(buf) - 1 - fill);
+    if(len <= 0)
+      return -1;
+    fill += len;
+    buf[fill] = '\0';
+
+    for(line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+      *nl = '\0';
+      if(strncmp(line, "stats:", 6) != 0)
+        continue;
+      if((p = strstr(line, "sessions ")) != NULL && sscanf(p, "sessions %llu/%llu", &a, &b) == 2)
+        sm->sessions = a;
+      if((p = strstr(line, "heap ")) != NULL && sscanf(p, "heap %llu/%llu", &a, &b) == 2) {
+        sm->heap_used  = a;
+        sm->heap_total = b;
+        sm->frag = b ? 100.0 * (b - a) / b : 0;
+      }
+      fill -= (nl + 1) - buf;
+      memmove(buf, nl + 1, fill);
+      return 0;
+    }
+
+    /* keep the incomplete line */
+    fill -= line - buf;
+    memmove(buf, line, fill);
+    if(fill == sizeof(buf) - 1)
+      fill = 0;
+  }
+
+  return -1;
+}
+
+/* compare the maximum of the second half with the first half */
+static int soak_grew(const char *what, sample_t *sm, int from, int to, size_t off,
+                     double factor, double slack) {
+  double first = 0, second = 0, v;
+  int i, mid = from + (to - from) / 2;
+
+  for(i=from; i<to; i++) {
+    v = *(double *)((char *)&sm[i] + off);
+    if(i < mid && v > first)
+      first = v;
+    if(i >= mid && v > second)
+      second = v;
+  }
+
+  if(second > first * factor + slack) {
+    printf("# FAIL: %s keeps growing, from %.0f to %.0f\n", what, first, second);
+    return 1;
+  }
+  printf("# ok: %s stable (%.0f, %.0f)\n", what, first, second);
+  return 0;
+}
+
+static int soak() {
+  sink_t sinks[THREADS_MAX];
+  sample_t *sm;
+  soak_t k;
+  hist_t *hist;
+  uint64_t start;
+  int nsm = 0, errfd = -1, t, i, from, fail = 0;
+  pid_t pid;
+
+  memset(sinks, 0, sizeof(sinks));
+  memset(&k, 0, sizeof(k));
+  sm   = calloc(SOAK_SAMPLES, sizeof(sample_t));
+  hist = calloc(1, sizeof(hist_t));
+
+  k.fds  = malloc(sizeof(int) * SOAK_SLOTS);
+  k.sent = calloc(SOAK_SLOTS, sizeof(uint64_t));
+  k.free = malloc(sizeof(int) * SOAK_SLOTS);
+  for(i=0; i<SOAK_SLOTS; i++) {
+    k.fds[i] = -1;
+    k.free[i] = SOAK_SLOTS - 1 - i;
+  }
+  k.nfree = SOAK_SLOTS;
+  k.epfd  = epoll_create1(0);
+  pthread_mutex_init(&k.lock, NULL);
+
+  MEASURING = GEN_STOP = SINK_STOP = 0;
+
+  for(t=0; t<THREADS; t++) {
+    sinks[t].mode = MODE_RR;
+    if((sinks[t].fd = sink_socket(SPORT)) < 0)
+      return 1;
+    pthread_create(&sinks[t].thread, NULL, sink_main, &sinks[t]);
+  }
+
+  if((pid = udpxd_start(&errfd)) < 0)
+    return 1;
+
+  printf("# soak: %s, %s, %d new clients/s for %ds, sessions live %ds\n",
+         UDPXD, V6 ? "::1" : "127.0.0.1", RATE, SOAK, SOAK_MAXAGE);
+  printf("%7s %10s %8s %9s %9s %7s %11s %11s %6s %9s %9s\n",
+         "time", "clients", "lost", "sessions", "rss(kB)", "fds",
+         "heap used", "heap total", "frag%", "p50(us)", "p99(us)");
+
+  start = now_ns();
+  pthread_create(&k.thread, NULL, soak_main, &k);
+
+  while(nsm < SOAK_SAMPLES) {
+    sample_t *s = &sm[nsm];
+
+    sleep_s(INTERVAL);
+    s->t = (now_ns() - start) / 1e9;
+
+    if(waitpid(pid, NULL, WNOHANG) == pid) {
+      printf("# FAIL: udpxd died\n");
+      fail = 1;
+      pid = -1;
+      break;
+    }
+
+    s->rss = proc_status(pid, "VmRSS");
+    s->fds = proc_fds(pid);
+    if(udpxd_stats(pid, errfd, s) != 0)
+      fprintf(stderr, "no statistics from udpxd\n");
+
+    pthread_mutex_lock(&k.lock);
+    memcpy(hist, &k.hist, sizeof(hist_t));
+    memset(&k.hist, 0, sizeof(hist_t));
+    pthread_mutex_unlock(&k.lock);
+    s->p99 = hist_pct(hist, 99);
+
+    printf("%7.0f %10llu %8llu %9.0f %9.0f %7.0f %11.0f %11.0f %6.1f %9.1f %9.1f\n",
+           s->t, (unsigned long long)k.made, (unsigned long long)k.lost, s->sessions,
+           s->rss, s->fds, s->heap_used, s->heap_total, s->frag,
+           hist_pct(hist, 50) / 1000.0, s->p99 / 1000.0);
+    fflush(stdout);
+    nsm++;
+
+    if(s->t >= SOAK)
+      break;
+  }
+
+  GEN_STOP = 1;
+  pthread_join(k.thread, NULL);
+  SINK_STOP = 1;
+  for(t=0; t<THREADS; t++) {
+    pthread_join(sinks[t].thread, NULL);
+    close(sinks[t].fd);
+  }
+  if(pid > 0)
+    udpxd_stop(pid);
+  close(errfd);
+
+  if(k.failed)
+    printf("# %llu clients could not be created\n", (unsigned long long)k.failed);
+
+  /* sessions live up to MAXAGE plus a wheel tick, judge afterwards */
+  for(from=0; from<nsm && sm[from].t < 2 * SOAK_MAXAGE + INTERVAL; from++)
+    ;
+
+  if(! fail) {
+    if(nsm - from < 4) {
+      printf("# too short to judge, run for at least %ds\n", 2 * SOAK_MAXAGE + 5 * INTERVAL);
+    }
+    else {
+      fail |= soak_grew("sessions", sm, from, nsm, offsetof(sample_t, sessions), 1.2, 100);
+      fail |= soak_grew("rss", sm, from, nsm, offsetof(sample_t, rss), 1.2, 1024);
+      fail |= soak_grew("open fds", sm, from, nsm, offsetof(sample_t, fds), 1.2, 32);
+      fail |= soak_grew("heap", sm, from, nsm, offsetof(sample_t, heap_total), 1.2, 1 << 20);
+      fail |= soak_grew("heap fragmentation", sm, from, nsm, offsetof(sample_t, frag), 1.0, 10);
+      fail |= soak_grew("new session p99 latency", sm, from, nsm, offsetof(sample_t, p99), 2.0, 1000000);
+    }
+  }
+
+  free(sm);
+  free(hist);
+  free(k.fds);
+  free(k.sent);
+  free(k.free);
+  close(k.epfd);
+
+  return fail;
+}
+
+/* -L: a client sends a request with its number */
+static void late_send(int fd, int client) {
+  stamp_t st;
+
+  memset(&st, 0, sizeof(st));
+  st.sent   = now_ns();
+  st.client = (uint32_t)client;
+  send(fd, &st, sizeof(st), MSG_DONTWAIT);
+}
+
+/* -L: the old clients talk once, their sessions age out after a second.
+   Then new clients start and the sink answers the old ones again, to
+   the outgoing sockets their sessions had. Nothing of that may reach a
+   new client, e.g. because its session got the socket of an old one. */
+static int late() {
+  struct pollfd pfd[1 + 2 * LATE_CLIENTS];
+  late_t pending[LATE_CLIENTS * 4];
+  struct sockaddr_storage addr;
+  char path[] = "/tmp/udpxbench.XXXXXX";
+  unsigned char buf[PAYLOAD_MIN * 4];
+  uint64_t start, now, next = 0;
+  uint64_t own = 0, leaked = 0, again = 0, stale = 0;
+  int npending = 0, i, fd, fail = 0;
+  socklen_t len;
+  stamp_t st;
+  ssize_t n;
+  FILE *f;
+  pid_t pid;
+
+  if((fd = mkstemp(path)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+    perror("unable to create a setup file for udpxd");
+    return 1;
+  }
+  fprintf(f, V6 ? "listen [::1]:%d to [::1]:%d bind ::1 timeout 1\n"
+                : "listen 127.0.0.1:%d to 127.0.0.1:%d bind 127.0.0.1 timeout 1\n",
+          LPORT, SPORT);
+  fclose(f);
+  CONFIG = path;
+
+  for(i=0; i<1 + 2 * LATE_CLIENTS; i++) {
+    pfd[i].fd = -1;
+    pfd[i].events = POLLIN;
+    pfd[i].revents = 0;
+  }
+
+  if((pfd[0].fd = sink_socket(SPORT)) < 0 || (pid = udpxd_start(NULL)) < 0) {
+    unlink(path);
+    return 1;
+  }
+
+  printf("# late answers: %s, %s, %d clients, answered again after %dms, sessions live 1s\n",
+         UDPXD, V6 ? "::1" : "127.0.0.1", LATE_CLIENTS, LATE_DELAY);
+
+  for(i=1; i<=LATE_CLIENTS; i++) {
+    if((pfd[i].fd = gen_socket(i - 1, LPORT)) < 0) {
+      perror("unable to create a client");
+      fail = 1;
+      break;
+    }
+    late_send(pfd[i].fd, i - 1);
+  }
+
+  start = now_ns();
+  while(! fail && (now = now_ns()) - start < LATE_END * 1000000ULL) {
+    /* the new clients, once the old sessions are gone, every 100ms */
+    if(now - start >= LATE_NEW * 1000000ULL && now >= next) {
+      for(i=1 + LATE_CLIENTS; i<1 + 2 * LATE_CLIENTS; i++) {
+        if(pfd[i].fd < 0 && (pfd[i].fd = gen_socket(i - 1, LPORT)) < 0) {
+          perror("unable to create a client");
+          fail = 1;
+          break;
+        }
+        late_send(pfd[i].fd, i - 1);
+      }
+      next = now + 100000000ULL;
+    }
+
+    for(i=0; i<npending; ) {
+      if(pending[i].due <= now) {
+        sendto(pfd[0].fd, &pending[i].st, sizeof(stamp_t), 0,
+               (struct sockaddr *)&pending[i].addr, pending[i].len);
+        again++;
+        pending[i] = pending[--npending];
+      }
+      else
+        i++;
+    }
+
+    if(poll(pfd, 1 + 2 * LATE_CLIENTS, 10) <= 0)
+      continue;
+
+    /* the sink answers right away, the old clients once more later */
+    if(pfd[0].revents & POLLIN) {
+      len = sizeof(addr);
+      n = recvfrom(pfd[0].fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&addr, &len);
+      if(n >= (ssize_t)sizeof(stamp_t)) {
+        sendto(pfd[0].fd, buf, n, 0, (struct sockaddr *)&addr, len);
+        memcpy(&st, buf, sizeof(stamp_t));
+        if(st.client < LATE_CLIENTS && npending < LATE_CLIENTS * 4) {
+          pending[npending].addr = addr;
+          pending[npending].len  = len;
+          pending[npending].st   = st;
+          pending[npending].due  = now + LATE_DELAY * 1000000ULL;
+          npending++;
+        }
+      }
+    }
+
+    for(i=1; i<1 + 2 * LATE_CLIENTS; i++) {
+      if(pfd[i].fd < 0 || ! (pfd[i].revents & POLLIN))
+        continue;
+      while((n = recv(pfd[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        if(n < (ssize_t)sizeof(stamp_t))
+          continue;
+        memcpy(&st, buf, sizeof(stamp_t));
+        if(st.client != (uint32_t)(i - 1))
+          leaked++;
+        else if(i > LATE_CLIENTS)
+          own++;
+        else if(now - start >= LATE_DELAY * 1000000ULL)
+          stale++; /* the old session was still there */
+      }
+    }
+  }
+
+  udpxd_stop(pid);
+  for(i=0; i<1 + 2 * LATE_CLIENTS; i++)
+    if(pfd[i].fd >= 0)
+      close(pfd[i].fd);
+  unlink(path);
+  CONFIG = NULL;
+
+  if(fail)
+    return 1;
+  if(again == 0 || own == 0) {
+    printf("# FAIL: no answers relayed (%llu sent again, %llu for new clients)\n",
+           (unsigned long long)again, (unsigned long long)own);
+    return 1;
+  }
+  if(stale > 0) {
+    printf("# FAIL: %llu late answers reached their old client, sessions did not age out\n",
+           (unsigned long long)stale);
+    return 1;
+  }
+  if(leaked > 0) {
+    printf("# FAIL: %llu answers for aged out sessions reached new clients\n",
+           (unsigned long long)leaked);
+    return 1;
+  }
+  printf("# ok: %llu late answers sent, new clients got only their own %llu answers\n",
+         (unsigned long long)again, (unsigned long long)own);
+  return 0;
+}
+
+static void report(int mode, size_t size, int clients, result_t *res) {
+  char cpu[32], lat[3][32];
+  int i;
+
+  if(res->cpu >= 0)
+    snprintf(cpu, sizeof(cpu), "%.0f", res->cpu);
+  else
+    snprintf(cpu, sizeof(cpu), "-");
+  for(i=0; i<3; i++) {
+    if(res->lat[i] >= 0)
+      snprintf(lat[i], sizeof(lat[i]), "%.1f", res->lat[i]);
+    else
+      snprintf(lat[i], sizeof(lat[i]), "-");
+  }
+
+  printf("%-7s %7d%s %6d %11.0f %9s %9s %9s %9s %7.2f\n",
+         mode == MODE_RR ? "rr" : "oneway",
+         res->clients, res->clients < clients ? "*" : " ",
+         (int)size, res->pps, lat[0], lat[1], lat[2], cpu, res->loss);
+  if(PORTS > 0)
+    printf("# udpxd with %d listen ports: rss %.0f kB, %.0f open fds\n",
+           PORTS, res->rss, res->fds);
+  fflush(stdout);
+}
+
+/* comma separated list of numbers, returns the count */
+static int parse_list(char *arg, int *list, int max) {
+  char *copy = strdup(arg), *tok, *save = NULL;
+  int n = 0;
+
+  for(tok = strtok_r(copy, ",", &save); tok != NULL && n < max; tok = strtok_r(NULL, ",", &save))
+    list[n++] = atoi(tok);
+
+  free(copy);
+  return n;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: udpxbench [-x udpxd] [-6] [-T threads] [-d seconds] [-c clients]\n"
+          "                 [-s sizes] [-m modes] [-p ports] [-n] [-v] [-- udpxd options]\n"
+          "       udpxbench -k seconds [-r rate] [-i seconds] [-x udpxd] [-6] [-- udpxd options]\n"
+          "       udpxbench -L [-x udpxd] [-6] [-- udpxd options]\n\n"
+          "-x <path>      udpxd binary, default: ./udpxd\n"
+          "-6             use ::1 instead of 127.0.0.1\n"
+          "-T <n>         generator and sink threads, default: number of cpus\n"
+          "-d <seconds>   measuring time per run, default: 1\n"
+          "-c <n,n,..>    concurrent clients, default: 1,10,100,1000,10000,100000\n"
+          "-s <n,n,..>    payload sizes, default: 64,512,1400\n"
+          "-m <modes>     rr, oneway or rr,oneway (default)\n"
+          "-p <n>         relay n ports (up to %d) instead of one, -l %d-...\n"
+          "-n             report the latency through udpxd, not the added one\n"
+          "-v             show the output of udpxd\n"
+          "-k <seconds>   soak test, sessions come and go for this long\n"
+          "-r <n>         soak: new clients per second, default: 500\n"
+          "-i <seconds>   soak: report interval, default: 10\n"
+          "-L             check that late answers don't reach new clients\n\n"
+          "Options after -- are passed to udpxd, e.g. -- -e uring\n", PORTS_MAX, LBASE);
+}
+
+int main(int argc, char **argv) {
+  int clients[32], sizes[32], modes[2];
+  int nclients, nsizes, nmodes = 0;
+  int opt, m, s, c;
+  struct rlimit rl;
+  result_t res;
+
+  nclients = parse_list("1,10,100,1000,10000,100000", clients, 32);
+  nsizes   = parse_list("64,512,1400", sizes, 32);
+  modes[nmodes++] = MODE_RR;
+  modes[nmodes++] = MODE_ONEWAY;
+
+  while((opt = getopt(argc, argv, "x:6T:d:c:s:m:p:nvk:r:i:Lh")) != -1) {
+    switch(opt) {
+    case 'x': UDPXD = optarg; break;
+    case '6': V6 = 1; break;
+    case 'T': THREADS = atoi(optarg); break;
+    case 'd': DURATION = atof(optarg); break;
+    case 'c': nclients = parse_list(optarg, clients, 32); break;
+    case 's': nsizes = parse_list(optarg, sizes, 32); break;
+    case 'm':
+      nmodes = 0;
+      if(strstr(optarg, "rr"))
+        modes[nmodes++] = MODE_RR;
+      if(strstr(optarg, "oneway"))
+        modes[nmodes++] = MODE_ONEWAY;
+      break;
+    case 'p': PORTS = atoi(optarg); break;
+    case 'n': NOBASE = 1; break;
+    case 'v': VERBOSE = 1; break;
+    case 'k': SOAK = atoi(optarg); break;
+    case 'r': RATE = atoi(optarg); break;
+    case 'i': INTERVAL = atoi(optarg); break;
+    case 'L': LATE = 1; break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  XARGS  = &argv[optind];
+  NXARGS = argc - optind;
+
+  if(THREADS <= 0)
+    THREADS = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if(THREADS < 1)
+    THREADS = 1;
+  if(THREADS > THREADS_MAX)
+    THREADS = THREADS_MAX;
+  if(DURATION <= 0 || nmodes == 0 || RATE <= 0 || INTERVAL <= 0 || PORTS < 0
+     || PORTS > PORTS_MAX || (PORTS > 0 && (SOAK > 0 || LATE))) {
+    usage();
+    return 1;
+  }
+
+  /* one socket per client, here and in udpxd, which inherits the limit */
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+    /* some left for the sinks, epoll and /proc */
+    if(rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < 0x7fffffff)
+      FDMAX = (int)rl.rlim_cur - 64;
+    else
+      FDMAX = 0x7fffffff;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if(SOAK > 0)
+    return soak();
+  if(LATE)
+    return late();
+
+  printf("# udpxd: %s, %s, %d threads, %.1fs per run, latency in us, cpu in ns per datagram\n",
+         UDPXD, V6 ? "::1" : "127.0.0.1", THREADS, DURATION);
+  if(PORTS > 0)
+    printf("# relaying ports %d-%d to %d-%d\n", LBASE, LBASE + PORTS - 1, SBASE, SBASE + PORTS - 1);
+  printf("# latency %s, probes at %d/s, - if too few samples\n",
+         NOBASE ? "through udpxd" : "added by udpxd", PROBE_RATE);
+  printf("# * less clients than requested, out of sockets or ports\n");
+  printf("%-7s %8s %6s %11s %9s %9s %9s %9s %7s\n",
+         "mode", "clients", "size", "pps", "p50", "p99", "p999", "cpu/pkt", "loss%");
+
+  for(m=0; m<nmodes; m++) {
+    for(s=0; s<nsizes; s++) {
+      size_t size = sizes[s];
+      if(size < PAYLOAD_MIN)
+        size = PAYLOAD_MIN;
+      if(size > PAYLOAD_MAX)
+        size = PAYLOAD_MAX;
+
+      for(c=0; c<nclients; c++) {
+        if(clients[c] < 1)
+          continue;
+
+        if(run(modes[m], size, clients[c], &res) != 0)
+          return 1;
+
+        report(modes[m], size, clients[c], &res);
+      }
+    }
+  }
+
+  return 0;
+}
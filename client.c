@@ -22,12 +22,67 @@
 #include "client.h"
 #include "log.h"
 
+/* clients closed during the current loop iteration, see client_reap() */
+static client_t *graveyard = NULL;
+
+/* second index of the clients list, by source address */
+static client_t *clients_src = NULL;
+
+/* expiry timers of all clients */
+static wheel_t wheel;
+
+/* memory of all clients */
+static pool_t *pool = NULL;
+
+/* open cursors, see client_cursor_open() */
+static ccursor_t *cursors = NULL;
+
+/* the current time in milliseconds, set once per loop iteration by
+   client_tick() */
+static uint64_t now = 0;
+
+/* fill the source index key from a sockaddr, padding included, because
+   the whole struct is hashed and compared */
+static void client_key(srckey_t *key, int owner, struct sockaddr *addr) {
+  memset(key, 0, sizeof(srckey_t));
+  key->owner  = owner;
+  key->family = addr->sa_family;
+  if(addr->sa_family == AF_INET6) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    key->port  = v6->sin6_port;
+    key->scope = v6->sin6_scope_id;
+    memcpy(key->addr, &v6->sin6_addr, 16);
+  }
+  else {
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    key->port = v4->sin_port;
+    memcpy(key->addr, &v4->sin_addr, 4);
+  }
+}
+
 void client_del(client_t *client) {
+  ccursor_t *cursor;
+
+  /* cursors pointing to it move on to the next one */
+  for(cursor = cursors; cursor != NULL; cursor = cursor->link) {
+    if(cursor->next == client)
+      cursor->next = (client_t *)client->hh.next;
+  }
+
   HASH_DEL(clients, client);
+  HASH_DELETE(hs, clients_src, client);
+  wheel_del(&wheel, &client->timer);
+  client_unwatch(client);
 }
 
+/* register the client with the engine as well, so main_loop() gets the
+   client itself back when its socket becomes readable */
 void client_add(client_t *client) {
   HASH_ADD_INT(clients, socket, client);
+  HASH_ADD(hs, clients_src, key, sizeof(srckey_t), client);
+  wheel_add(&wheel, &client->timer, client->lastseen + client->timeout * 1000);
+  client_watch(client);
+  STATS->sess_new++;
 }
 
 client_t *client_find_fd(int fd) {
@@ -36,47 +91,207 @@ client_t *client_find_fd(int fd) {
   return client; /*  maybe NULL! */
 }
 
-client_t *client_find_src(host_t *src) {
-  client_t *current = NULL;
-  client_iter(clients, current) {
-    if(strcmp(current->src->ip, src->ip) == 0 && current->src->port == src->port)
-      return current;
-  }
-  return NULL;
+client_t *client_find_src(int owner, host_t *src) {
+  return client_find_addr(owner, host_sa(src));
+}
+
+/* the client with source address addr, talking to listener owner */
+client_t *client_find_addr(int owner, struct sockaddr *addr) {
+  client_t *client = NULL;
+  srckey_t key;
+  client_key(&key, owner, addr);
+  HASH_FIND(hs, clients_src, &key, sizeof(srckey_t), client);
+  return client; /*  maybe NULL! */
 }
 
+/* called per datagram, therefore this does not touch the expiry timer,
+   client_expire() re-arms it if the client has been seen in between */
 void client_seen(client_t *client) {
-  client->lastseen = (long)time(0);
+  client->lastseen = now;
 }
 
-client_t *client_new(int fd, host_t *src, host_t *dst) {
-  client_t *client = malloc(sizeof(client_t));
+/* returns NULL if we are out of memory */
+client_t *client_new(int fd, struct sockaddr *src, struct sockaddr *dst, sockpool_t *sockpool,
+                     int owner, int timeout) {
+  client_t *client = pool_get(pool);
+
+  if(client == NULL)
+    return NULL;
+
+  STATS->pool_used  = pool->used;
+  STATS->pool_total = pool->total;
+
+  client->evtype = EV_CLIENT;
   client->socket = fd;
-  client->src = src;
-  client->dst = dst;
+  client->next = NULL;
+  client->timer.next = client->timer.prev = NULL;
+  client->timer.data = client;
+  host_set(&client->src, src);
+  host_set(&client->dst, dst);
+  client->sockpool = sockpool;
+  client->busy = 0;
+  client->txq = NULL;
+  client->created = now;
+  client->fwd_pkts = client->fwd_bytes = 0;
+  client->rep_pkts = client->rep_bytes = 0;
+  client->waiting = 0;
+  client->timeout = timeout;
+  client->listener = NULL;
+  client->up = NULL;
+  client_key(&client->key, owner, src);
   client_seen(client);
   return client;
 }
 
-void client_close(client_t *client) {
+/* the  client might still be referenced  by a pending event of  the current
+   loop iteration, therefore we only mark it closed here and free it later */
+static void client_release(client_t *client) {
   client_del(client);
-  close(client->socket);
-  host_clean(client->src);
-  host_clean(client->dst);
-  free(client);
+  if(client->up != NULL)
+    upstream_done(client->up, client->waiting != 0);
+  if(client->sockpool != NULL)
+    sockpool_close(client->sockpool, client->socket, client->dst.port);
+  else
+    close(client->socket);
+  client->socket = -1;
+  client->next = graveyard;
+  graveyard = client;
+}
+
+void client_close(client_t *client) {
+  STATS->sess_closed++;
+  client_release(client);
+}
+
+/* free clients closed during the last loop iteration, those with pending
+   io_uring requests stay until the requests have completed */
+void client_reap() {
+  client_t *client, *busy = NULL;
+  while(graveyard != NULL) {
+    client = graveyard;
+    graveyard = client->next;
+    if(client->busy) {
+      client->next = busy;
+      busy = client;
+    }
+    else
+      pool_put(pool, client);
+  }
+  graveyard = busy;
+  STATS->pool_used = pool->used;
+}
+
+/* the socket of an aged out client is closed, not reused: late answers
+   for it must not reach another client */
+static void client_age(client_t *client) {
+  if(VERBOSE)
+    log_event(LOGEV_AGED, host_sa(&client->src), host_sa(&client->dst), NULL, client->timeout);
+  client_release(client);
+}
+
+/* timer callback: close the client if it has been idle long enough */
+static void client_expire(wtimer_t *timer) {
+  client_t *client = (client_t *)timer->data;
+  uint64_t deadline = client->lastseen + client->timeout * 1000;
+
+  if(deadline > now)
+    wheel_add(&wheel, &client->timer, deadline);
+  else {
+    STATS->sess_expired++;
+    client_age(client);
+  }
 }
 
+/* close aged out clients or all of them if asap is set */
 void client_clean(int asap) {
-  uint32_t now = (long)time(0);
-  uint32_t diff;
   client_t *current;
-  client_iter(clients, current) {
-    diff = now - current->lastseen;
-    if(diff >= MAXAGE || asap) {
-      verbose("closing socket %s:%d for client %s:%d (aged out after %d seconds)\n",
-              current->src->ip, current->src->port, current->dst->ip, current->dst->port, MAXAGE);
-      client_close(current);
+
+  if(asap) {
+    client_iter(clients, current) {
+      client_age(current);
     }
   }
+  else {
+    wheel_advance(&wheel, now, client_expire);
+  }
+}
+
+/* close the clients of listener owner, e.g. to release a fixed bind port */
+void client_clean_owner(int owner) {
+  client_t *current;
+
+  client_iter(clients, current) {
+    if(current->key.owner == (uint32_t)owner)
+      client_age(current);
+  }
+}
+
+void client_init(uint64_t ms, int prealloc) {
+  now = ms;
+  wheel_init(&wheel, now);
+  pool = pool_new(sizeof(client_t), prealloc);
+  STATS->pool_used  = pool->used;
+  STATS->pool_total = pool->total;
+}
+
+/* release the memory of all clients, they must have been closed and reaped */
+void client_done() {
+  pool_free(pool);
+  pool = NULL;
+  graveyard = NULL;
+}
+
+/* set the current time, the only clock used by the client functions */
+void client_tick(uint64_t ms) {
+  now = ms;
+}
+
+/* change the idle timeout of the clients of listener owner, or of all
+   if owner is -1. Timers of clients which would live longer than the
+   new timeout are re-armed, rare enough to do them all at once. A
+   longer timeout is picked up by client_expire(). */
+void client_timeout_set(int owner, int seconds) {
+  client_t *current;
+  int lower;
+
+  client_iter(clients, current) {
+    if(owner >= 0 && current->key.owner != (uint32_t)owner)
+      continue;
+    lower = seconds < current->timeout;
+    current->timeout = seconds;
+    if(lower)
+      wheel_add(&wheel, &current->timer, current->lastseen + seconds * 1000);
+  }
+}
+
+/* milliseconds until the next client may age out, -1 if there are none */
+int client_timeout() {
+  return wheel_timeout(&wheel, now);
 }
 
+/* start walking the list of clients, clients added meanwhile are
+   included, deleted ones skipped */
+void client_cursor_open(ccursor_t *cursor) {
+  cursor->next = clients;
+  cursor->link = cursors;
+  cursors = cursor;
+}
+
+/* the next client, NULL at the end */
+client_t *client_cursor_next(ccursor_t *cursor) {
+  client_t *client = cursor->next;
+  if(client != NULL)
+    cursor->next = (client_t *)client->hh.next;
+  return client;
+}
+
+void client_cursor_close(ccursor_t *cursor) {
+  ccursor_t **c;
+
+  for(c = &cursors; *c != NULL; c = &(*c)->link) {
+    if(*c == cursor) {
+      *c = cursor->link;
+      break;
+    }
+  }
+}
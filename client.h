@@ -40,21 +40,67 @@ typedef uint8_t byte;
 
 #include "uthash.h"
 #include "host.h"
+#include "event.h"
+#include "wheel.h"
+#include "pool.h"
+#include "stats.h"
+#include "sockpool.h"
+#include "queue.h"
+#include "upstream.h"
+
+#define MAXAGE         30 /* default of TIMEOUT, seconds after which to close outgoing sockets and forget client src */
+#define SESSIONS_DEFAULT 1024 /* sessions to preallocate */
+
+/* binary client source address, key of the source index, see client_find_src() */
+struct _srckey_t {
+  uint16_t family;
+  uint16_t port;            /* network byte order */
+  uint32_t scope;           /* v6 scope id, 0 for v4 */
+  uint8_t addr[16];         /* v4 addresses use the first 4 bytes */
+  uint32_t owner;           /* id of the listener, a client may use several */
+};
+typedef struct _srckey_t srckey_t;
 
-#define MAXAGE         30 /* seconds after which to close outgoing sockets and forget client src */
-
+/* a session, allocated from a pool in one piece, see client_new() */
 struct _client_t {
+  int evtype;               /* EV_CLIENT, must be first, see event.h */
   int socket;               /* bind socket for outgoing traffic */
-  host_t *src;              /* client src (ip+port) from incoming socket */
-  host_t *dst;              /* client dst (ip+port) to outgoing socket */
-  uint64_t lastseen;        /* when did we recv last time from it */
-  UT_hash_handle hh;
+  uint64_t lastseen;        /* when did we recv last time from it, ms */
+  uint64_t created;         /* ms */
+  uint64_t fwd_pkts;        /* datagrams forwarded to the destination */
+  uint64_t fwd_bytes;
+  uint64_t rep_pkts;        /* datagrams sent back to the client */
+  uint64_t rep_bytes;
+  uint64_t waiting;         /* first forward not answered yet, us, 0 if none */
+  int timeout;              /* idle timeout, seconds */
+  struct _listener_t *listener; /* the forwarding setup, set by net.c */
+  host_t src;               /* client src (ip+port) from incoming socket */
+  host_t dst;               /* client dst (ip+port) to outgoing socket */
+  host_t upstream;          /* where its datagrams are forwarded to */
+  upstream_t *up;           /* the destination it was chosen from, see dstset_pick() */
+  sockpool_t *sockpool;     /* where the socket came from */
+  int busy;                 /* pending io_uring requests referring to it */
+  txqueue_t *txq;           /* forwards waiting for the socket, or NULL */
+  wtimer_t timer;           /* expiry, see client_clean() */
+  struct _client_t *next;   /* list of closed clients, see client_reap() */
+  srckey_t key;             /* binary src, key of the source index */
+  UT_hash_handle hh;        /* index by socket */
+  UT_hash_handle hs;        /* index by src */
 };
 typedef struct _client_t client_t;
 
+/* a position in the list of clients, which stays valid when clients
+   are deleted, so the list can be walked over several loop iterations */
+struct _ccursor_t {
+  client_t *next;           /* returned by the next client_cursor_next() */
+  struct _ccursor_t *link;  /* list of open cursors */
+};
+typedef struct _ccursor_t ccursor_t;
+
 extern client_t *clients;
 extern int VERBOSE;
 extern int FORKED;
+extern int TIMEOUT;
 
 /*  wrapper for HASH_ITER */
 /** Iterate over the list of clients.
@@ -78,10 +124,27 @@ void client_add(client_t *client);
 void client_seen(client_t *client);
 void client_close(client_t *client);
 void client_clean(int asap);
+void client_clean_owner(int owner);
+void client_reap();
+void client_init(uint64_t now, int prealloc);
+void client_done();
+void client_tick(uint64_t now);
+int  client_timeout();
+void client_timeout_set(int owner, int seconds);
+
+void client_cursor_open(ccursor_t *cursor);
+client_t *client_cursor_next(ccursor_t *cursor);
+void client_cursor_close(ccursor_t *cursor);
 
 client_t *client_find_fd(int fd);
-client_t *client_find_src(host_t *src);
-client_t *client_new(int fd, host_t *src, host_t *dst);
+client_t *client_find_src(int owner, host_t *src);
+client_t *client_find_addr(int owner, struct sockaddr *addr);
+client_t *client_new(int fd, struct sockaddr *src, struct sockaddr *dst, sockpool_t *sockpool,
+                     int owner, int timeout);
+
+/* from net.c, (un)register the socket with the engine in use */
+void client_watch(client_t *client);
+void client_unwatch(client_t *client);
 
 
 #endif
@@ -0,0 +1,587 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "config.h"
+
+/*
+  The config file (--config), one forwarding setup per line:
+
+    listen <ip:port> to <ip:port> [bind <ip[:port]>] [timeout <s>]
+           [limit <n>] [prebind <n>] [spread least|rr] [balance hash|rtt]
+           [probe <payload>] [expect <answer>]
+
+  bind, timeout, prebind, spread, balance, probe and expect are like
+  -b, the idle timeout, -P, -m, -a, -k and -K, limit is the maximum
+  number of sessions of the setup, further clients are refused. Empty lines and everything
+  after a # are ignored. All setups are served by the same loop, or by
+  each worker with -w.
+
+  Like with -l and -t the listen port may be a range lo-hi, which
+  becomes one setup per port, see config_range(). The port of bind may
+  be a range too, which the sessions take their ports from. bind may
+  list several addresses or prefixes, separated by commas, see
+  config_binds(), and to several destinations, see config_dsts().
+*/
+
+/* a port or a range lo-hi, returns 0 if valid */
+static int config_ports(char *pt, int *lo, int *hi) {
+  char *end;
+  long a, b;
+
+  a = b = strtol(pt, &end, 10);
+  if(*end == '-')
+    b = strtol(end + 1, &end, 10);
+  if(*end != '\0' || a < 1 || b < a || b > 65535)
+    return -1;
+
+  *lo = (int)a;
+  *hi = (int)b;
+
+  return 0;
+}
+
+/* one bind address, like -b the port is optional and may be a range.
+   A prefix, e.g. 10.0.0.0/29, is returned in prefix, -1 if there is
+   none. Returns 0 if valid. */
+static int config_bind(char *word, char *ip, char *pt, int *prefix) {
+  char buf[INET6_ADDRSTRLEN+PORT_LEN+8], *slash, *end, *colon;
+  long n;
+
+  if(*word == '\0' || strlen(word) >= sizeof(buf))
+    return 1;
+  strcpy(buf, word);
+
+  /* cut the prefix out, [fd00::/120]:53 becomes [fd00::]:53 */
+  *prefix = -1;
+  if((slash = strchr(buf, '/')) != NULL) {
+    n = strtol(slash + 1, &end, 10);
+    if(end == slash + 1 || n < 0 || n > 128 || (*end != '\0' && *end != ':' && *end != ']'))
+      return 1;
+    *prefix = (int)n;
+    memmove(slash, end, strlen(end) + 1);
+  }
+
+  colon = strchr(buf, ':');
+  if(buf[0] == '[' || (colon != NULL && strchr(colon + 1, ':') == NULL)) {
+    if(parse_ip(buf, ip, pt) != 0)
+      return 1;
+  }
+  else {
+    if(strlen(buf) > INET6_ADDRSTRLEN)
+      return 1;
+    strcpy(ip, buf);
+    strcpy(pt, "0");
+  }
+
+  return 0;
+}
+
+/* append the addresses of ip/prefix to hosts, without the network and
+   broadcast address of v4 networks or the anycast address of v6 ones */
+static const char *config_cidr(char *ip, int prefix, int port, host_t **hosts, int *count) {
+  struct in6_addr a6;
+  struct in_addr a4;
+  uint32_t base, n, i, first, last;
+  host_t *h;
+
+  if(is_v6(ip)) {
+    if(inet_pton(AF_INET6, ip, &a6) != 1)
+      return "invalid bind address";
+    if(prefix < 120 || prefix > 128)
+      return "bind prefix of v6 addresses must be 120 to 128";
+    n    = 1 << (128 - prefix);
+    base = a6.s6_addr[15] & ~(n - 1);
+    first = prefix < 127 ? 1 : 0;
+    last  = n - 1;
+  }
+  else {
+    if(inet_pton(AF_INET, ip, &a4) != 1)
+      return "invalid bind address";
+    if(prefix < 24 || prefix > 32)
+      return "bind prefix of v4 addresses must be 24 to 32";
+    n    = 1 << (32 - prefix);
+    base = ntohl(a4.s_addr) & ~(n - 1);
+    first = prefix < 31 ? 1 : 0;
+    last  = prefix < 31 ? n - 2 : n - 1;
+  }
+
+  for(i = first; i <= last; i++) {
+    if(*count == BIND_MAX)
+      return "too many bind addresses";
+    h = get_host(ip, port, NULL);
+    if(h->is_v6)
+      h->sock.v6.sin6_addr.s6_addr[15] = base + i;
+    else
+      h->sock.v4.sin_addr.s_addr = htonl(base + i);
+    hosts[(*count)++] = h;
+  }
+
+  return NULL;
+}
+
+/* the bind addresses of spec, a comma separated list of addresses and
+   prefixes with the same port or range. NULL binds to any address, v6
+   if set. Returns NULL on success, otherwise what is wrong. */
+static const char *config_binds(char *spec, int v6, bindset_t **bs) {
+  char ip[INET6_ADDRSTRLEN+1], pt[PORT_LEN], first[PORT_LEN];
+  char *copy, *word, *next = NULL;
+  int count = 0, lo = 0, hi = 0, range = 0, prefix, i, j;
+  const char *msg = NULL;
+  host_t **hosts;
+
+  if((hosts = malloc(sizeof(host_t *) * BIND_MAX)) == NULL)
+    return strerror(errno);
+
+  if(spec == NULL) {
+    hosts[count++] = get_host(v6 ? "::0" : "0.0.0.0", 0, NULL);
+    copy = NULL;
+  }
+  else if((copy = strdup(spec)) == NULL) {
+    free(hosts);
+    return strerror(errno);
+  }
+
+  for(word = copy; msg == NULL && word != NULL; word = next) {
+    if((next = strchr(word, ',')) != NULL)
+      *next++ = '\0';
+
+    if(config_bind(word, ip, pt, &prefix) != 0)
+      msg = "invalid bind address";
+    else if(word != copy && strcmp(pt, first) != 0)
+      msg = "all bind addresses need the same port or range";
+    else if(is_v6(ip) != v6)
+      msg = "bind ip and destination ip must be both v4 or v6";
+    else if(strcmp(pt, "0") != 0 && config_ports(pt, &lo, &hi) != 0)
+      msg = "invalid bind port or range";
+    else if(prefix >= 0)
+      msg = config_cidr(ip, prefix, lo, hosts, &count);
+    else if(count == BIND_MAX)
+      msg = "too many bind addresses";
+    else
+      hosts[count++] = get_host(ip, lo, NULL);
+
+    strcpy(first, pt);
+    range = strchr(pt, '-') != NULL;
+  }
+  free(copy);
+
+  for(i=1; msg == NULL && i<count; i++)
+    for(j=0; j<i; j++)
+      if(host_is_ip(hosts[j], host_sa(hosts[i]))) {
+        msg = "bind address given twice";
+        break;
+      }
+
+  /* with several addresses a fixed port is a range of one port each */
+  if(! range)
+    hi = count > 1 ? lo : 0;
+
+  if(msg == NULL && (*bs = bindset_new(hosts, count, hi)) == NULL)
+    msg = strerror(errno);
+
+  if(msg != NULL) {
+    for(i=0; i<count; i++)
+      host_clean(hosts[i]);
+    free(hosts);
+    return msg;
+  }
+
+  (*bs)->mode = BINDMODE;
+
+  return NULL;
+}
+
+/* a probe payload or expected answer, with the escapes \xNN, \0, \t,
+   \r, \n and \\, replaces *buf, returns 0 if valid */
+static int config_bytes(const char *word, char **buf, size_t *len) {
+  char hex[3] = { 0, 0, 0 };
+  char *out;
+  size_t n = 0;
+
+  free(*buf);
+  *buf = NULL;
+  if((out = malloc(strlen(word) + 1)) == NULL)
+    return -1;
+
+  while(*word != '\0') {
+    if(*word != '\\') {
+      out[n++] = *word++;
+      continue;
+    }
+    word++;
+    if(*word == 'x' && isxdigit((unsigned char)word[1]) && isxdigit((unsigned char)word[2])) {
+      hex[0] = word[1];
+      hex[1] = word[2];
+      out[n++] = (char)strtol(hex, NULL, 16);
+      word += 3;
+      continue;
+    }
+    if(*word == '0')
+      out[n++] = '\0';
+    else if(*word == 't')
+      out[n++] = '\t';
+    else if(*word == 'r')
+      out[n++] = '\r';
+    else if(*word == 'n')
+      out[n++] = '\n';
+    else if(*word == '\\')
+      out[n++] = '\\';
+    else {
+      n = 0; /* invalid escape */
+      break;
+    }
+    word++;
+  }
+
+  if(n == 0 || n > HEALTH_MAXLEN) {
+    free(out);
+    return -1;
+  }
+  *buf = out;
+  *len = n;
+
+  return 0;
+}
+
+/* the probes of the destinations of ds, see health.c, returns NULL
+   on success, otherwise what is wrong */
+static const char *config_probe(dstset_t *ds, char *probe, char *expect) {
+  if(probe == NULL)
+    return expect == NULL ? NULL : "expect needs a probe";
+  if(config_bytes(probe, &ds->probe, &ds->probe_len) != 0)
+    return "invalid probe payload";
+
+  if(expect == NULL) {
+    free(ds->expect);
+    ds->expect = NULL;
+  }
+  else if(config_bytes(expect, &ds->expect, &ds->expect_len) != 0)
+    return "invalid expected answer";
+
+  return NULL;
+}
+
+/* the destinations of spec, a comma separated list of ip:port, each
+   port may be a range of span+1 ports. Returns NULL on success,
+   otherwise what is wrong. */
+static const char *config_dsts(char *spec, int span, dstset_t **ds) {
+  char ip[INET6_ADDRSTRLEN+1], pt[PORT_LEN];
+  char *copy, *word, *next = NULL;
+  int count = 0, lo, hi, i, j;
+  const char *msg = NULL;
+  host_t **hosts;
+
+  if((hosts = malloc(sizeof(host_t *) * UPSTREAM_MAX)) == NULL)
+    return strerror(errno);
+  if((copy = strdup(spec)) == NULL) {
+    free(hosts);
+    return strerror(errno);
+  }
+
+  for(word = copy; msg == NULL && word != NULL; word = next) {
+    if((next = strchr(word, ',')) != NULL)
+      *next++ = '\0';
+
+    if(*word == '\0' || parse_ip(word, ip, pt) != 0)
+      msg = "invalid destination address";
+    else if(config_ports(pt, &lo, &hi) != 0)
+      msg = "invalid destination port or range";
+    else if(hi != lo && hi - lo != span)
+      msg = "listen and destination range must have the same size";
+    else if(lo + span > 65535)
+      msg = "destination range exceeds port 65535";
+    else if(count > 0 && is_v6(ip) != hosts[0]->is_v6)
+      msg = "destinations must be all v4 or all v6";
+    else if(count == UPSTREAM_MAX)
+      msg = "too many destinations";
+    else
+      hosts[count++] = get_host(ip, lo, NULL);
+  }
+  free(copy);
+
+  for(i=1; msg == NULL && i<count; i++)
+    for(j=0; j<i; j++)
+      if(host_is(hosts[j], host_sa(hosts[i]))) {
+        msg = "destination given twice";
+        break;
+      }
+
+  if(msg == NULL && (*ds = dstset_new(hosts, count)) == NULL)
+    msg = strerror(errno);
+  else if(msg == NULL) {
+    (*ds)->mode = BALANCE;
+    if((msg = config_probe(*ds, PROBE, EXPECT)) != NULL) {
+      dstset_free(*ds); /* with the hosts */
+      return msg;
+    }
+  }
+
+  if(msg != NULL) {
+    for(i=0; i<count; i++)
+      host_clean(hosts[i]);
+    free(hosts);
+    return msg;
+  }
+
+  return NULL;
+}
+
+/* append the setups for a listen port or range of ports to list, port
+   N of the range is forwarded to the destination port with the same
+   offset in a range of the same size, or counted from a single
+   destination port. All of them send to the destinations of dst, see
+   config_dsts(), and bind to the addresses of bind, see config_binds().
+   Returns NULL on success, otherwise what is wrong. */
+const char *config_range(listener_t **list, char *inip, char *inpt, char *bind, char *dst) {
+  static char err[128];
+  char in[6];
+  int inlo, inhi, port;
+  listener_t **last;
+  bindset_t *binds = NULL;
+  dstset_t *dsts = NULL;
+  const char *msg;
+  host_t *probe;
+
+  if(config_ports(inpt, &inlo, &inhi) != 0)
+    return "invalid listen port or range";
+
+  /* we don't listen twice on the same address */
+  probe = get_host(inip, inlo, NULL);
+  for(last = list; *last != NULL; last = &(*last)->next) {
+    port = (*last)->listen_h->port;
+    if(port >= inlo && port <= inhi && host_is_ip((*last)->listen_h, host_sa(probe))) {
+      snprintf(err, sizeof(err), "already listening on %s:%d",
+               host_ip((*last)->listen_h), port);
+      host_clean(probe);
+      return err;
+    }
+  }
+  host_clean(probe);
+
+  if((msg = config_dsts(dst, inhi - inlo, &dsts)) != NULL)
+    return msg;
+  if((msg = config_binds(bind, dsts->ups[0].host->is_v6, &binds)) != NULL) {
+    dstset_free(dsts);
+    return msg;
+  }
+
+  for(port = inlo; port <= inhi; port++) {
+    snprintf(in, sizeof(in), "%d", port);
+    if((*last = listener_new(inip, in, dsts, port - inlo, binds)) == NULL) {
+      msg = strerror(errno);
+      break;
+    }
+    last = &(*last)->next;
+  }
+
+  /* the setups hold their own references */
+  dstset_free(dsts);
+  bindset_free(binds);
+
+  return msg;
+}
+
+/* the value of -m or spread, -1 if invalid */
+int config_spread(char *word) {
+  if(strcmp(word, "least") == 0)
+    return BIND_LEAST;
+  if(strcmp(word, "rr") == 0)
+    return BIND_RR;
+  return -1;
+}
+
+/* the value of -a or balance, -1 if invalid */
+int config_balance(char *word) {
+  if(strcmp(word, "hash") == 0)
+    return BALANCE_HASH;
+  if(strcmp(word, "rtt") == 0)
+    return BALANCE_RTT;
+  return -1;
+}
+
+/* a non-negative number, at least min */
+static int config_int(char *word, int min, int *value) {
+  char *end;
+  long v;
+
+  errno = 0;
+  v = strtol(word, &end, 10);
+  if(errno != 0 || *end != '\0' || v < min || v > 0x7fffffff)
+    return 1;
+  *value = (int)v;
+
+  return 0;
+}
+
+/* one line, appends its setups to list, returns 0 on success */
+static int config_line(const char *file, int lineno, char **words, int n, listener_t **list) {
+  char inip[INET6_ADDRSTRLEN+1], inpt[PORT_LEN];
+  int timeout = TIMEOUT, limit = 0, prebind = PREBIND;
+  int i, has_in = 0, mode = -1, balance = -1;
+  listener_t **last, *l;
+  const char *msg;
+  char *key, *val, *bind = NULL, *dst = NULL, *probe = NULL, *expect = NULL;
+
+  for(i=0; i<n; i+=2) {
+    key = words[i];
+    if(i + 1 == n) {
+      fprintf(stderr, "%s:%d: %s needs a value\n", file, lineno, key);
+      return 1;
+    }
+    val = words[i+1];
+
+    if(strcmp(key, "listen") == 0) {
+      if(parse_ip(val, inip, inpt) != 0) {
+        fprintf(stderr, "%s:%d: listen has the format <ip-address:port>\n", file, lineno);
+        return 1;
+      }
+      has_in = 1;
+    }
+    else if(strcmp(key, "to") == 0) {
+      dst = val; /* checked by config_range() */
+    }
+    else if(strcmp(key, "bind") == 0) {
+      bind = val; /* checked by config_range() */
+    }
+    else if(strcmp(key, "probe") == 0) {
+      probe = val; /* checked by config_probe() */
+    }
+    else if(strcmp(key, "expect") == 0) {
+      expect = val;
+    }
+    else if(strcmp(key, "balance") == 0) {
+      if((balance = config_balance(val)) < 0) {
+        fprintf(stderr, "%s:%d: balance must be hash or rtt\n", file, lineno);
+        return 1;
+      }
+    }
+    else if(strcmp(key, "spread") == 0) {
+      if((mode = config_spread(val)) < 0) {
+        fprintf(stderr, "%s:%d: spread must be least or rr\n", file, lineno);
+        return 1;
+      }
+    }
+    else if(strcmp(key, "timeout") == 0) {
+      if(config_int(val, 1, &timeout) != 0) {
+        fprintf(stderr, "%s:%d: timeout must be 1 or more seconds\n", file, lineno);
+        return 1;
+      }
+    }
+    else if(strcmp(key, "limit") == 0) {
+      if(config_int(val, 0, &limit) != 0) {
+        fprintf(stderr, "%s:%d: limit must be a positive number\n", file, lineno);
+        return 1;
+      }
+    }
+    else if(strcmp(key, "prebind") == 0) {
+      if(config_int(val, 0, &prebind) != 0) {
+        fprintf(stderr, "%s:%d: prebind must be a positive number\n", file, lineno);
+        return 1;
+      }
+    }
+    else {
+      fprintf(stderr, "%s:%d: unknown keyword %s\n", file, lineno, key);
+      return 1;
+    }
+  }
+
+  if(! has_in || dst == NULL) {
+    fprintf(stderr, "%s:%d: listen and to are required\n", file, lineno);
+    return 1;
+  }
+
+  for(last = list; *last != NULL; last = &(*last)->next)
+    ;
+  if((msg = config_range(list, inip, inpt, bind, dst)) != NULL) {
+    fprintf(stderr, "%s:%d: %s\n", file, lineno, msg);
+    return 1;
+  }
+
+  /* shared by the setups of the range */
+  if((probe != NULL || expect != NULL)
+     && (msg = config_probe((*last)->dsts, probe ? probe : PROBE, expect ? expect : EXPECT)) != NULL) {
+    fprintf(stderr, "%s:%d: %s\n", file, lineno, msg);
+    return 1;
+  }
+
+  for(l = *last; l != NULL; l = l->next) {
+    l->timeout = timeout;
+    l->limit   = limit;
+    l->prebind = prebind;
+    if(mode >= 0)
+      l->binds->mode = mode;
+    if(balance >= 0)
+      l->dsts->mode = balance;
+  }
+
+  return 0;
+}
+
+/* read the forwarding setups in file and append them to list, returns 0
+   on success */
+int config_load(const char *file, listener_t **list) {
+  char line[CONFIG_LINE];
+  char *words[CONFIG_WORDS];
+  int lineno = 0, n, err = 0;
+  char *p;
+  FILE *fd;
+
+  if((fd = fopen(file, "r")) == NULL) {
+    fprintf(stderr, "unable to open config file %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+
+  while(fgets(line, sizeof(line), fd) != NULL) {
+    lineno++;
+
+    if(strchr(line, '\n') == NULL && ! feof(fd)) {
+      fprintf(stderr, "%s:%d: line is too long\n", file, lineno);
+      err = 1;
+      break;
+    }
+    if((p = strchr(line, '#')) != NULL)
+      *p = '\0';
+
+    /* split first, parse_ip() uses strtok() as well */
+    n = 0;
+    for(p = strtok(line, " \t\r\n"); p != NULL; p = strtok(NULL, " \t\r\n")) {
+      if(n == CONFIG_WORDS)
+        break;
+      words[n++] = p;
+    }
+    if(n == 0)
+      continue;
+    if(p != NULL) {
+      fprintf(stderr, "%s:%d: too many words\n", file, lineno);
+      err = 1;
+      break;
+    }
+
+    if(config_line(file, lineno, words, n, list) != 0) {
+      err = 1;
+      break;
+    }
+  }
+
+  fclose(fd);
+
+  return err;
+}
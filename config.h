@@ -0,0 +1,43 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_CONFIG_H
+#define _HAVE_CONFIG_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "net.h"
+#include "udpxd.h"
+#include "health.h"
+
+#define CONFIG_LINE  1024 /* max length of a line */
+#define CONFIG_WORDS 24   /* max words per line */
+
+int config_load(const char *file, listener_t **list);
+const char *config_range(listener_t **list, char *inip, char *inpt, char *bind, char *dst);
+int config_spread(char *word);
+int config_balance(char *word);
+
+#endif
@@ -0,0 +1,467 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "ctl.h"
+#include "net.h"
+#include "log.h"
+
+/*
+  The control socket (--control), a UNIX stream socket accepting one
+  command per line, used by udpxctl:
+
+    list                 one line per session, see ctl_list()
+    kill <ip:port> [<listen ip:port>]
+                         close the sessions of a client
+    timeout [<seconds> [<listen ip:port>]]
+                         show or change the idle timeout of sessions
+    upstreams            one line per destination, see ctl_upstreams()
+
+  Every answer ends with a line starting with "ok" or "error:".
+
+  Connections are served by the loop like any other socket, commands
+  are run by ctl_run() at the end of a loop iteration, after the
+  datagrams have been handled. A listing is produced in chunks of
+  CTL_CHUNK sessions per iteration, so forwarding goes on while a large
+  session table is listed.
+*/
+
+static int ctl_socket = -1;
+static int ctl_evtype = EV_CTL;     /* registered for the listening socket */
+static char ctl_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ctlconn_t *conns = NULL;
+static int nconns = 0;
+
+/* create the control socket, must be called before dropping privileges,
+   only root may connect */
+int ctl_bind(const char *path) {
+  struct sockaddr_un sun;
+  struct stat st;
+  mode_t mask;
+  int fd, bound;
+
+  memset(&sun, 0, sizeof(sun));
+  if(strlen(path) >= sizeof(sun.sun_path)) {
+    fprintf(stderr, "control socket path is too long: %s\n", path);
+    return -1;
+  }
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+  /* left over from a previous run, but don't remove anything else */
+  if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  /* daemonize() cleared the umask, the socket must not be created
+     accessible to others, not even until the chmod() */
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  mask = umask(077);
+  bound = fd >= 0 && bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0;
+  umask(mask);
+  if(! bound || chmod(path, 0600) != 0 || listen(fd, CTL_CONNS) != 0) {
+    fprintf(stderr, "Cannot create control socket %s\n", path);
+    perror(NULL);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
+
+/* serve the control socket fd created by ctl_bind(), -1 if none */
+void ctl_init(int fd, const char *path) {
+  ctl_socket = fd;
+  if(fd < 0)
+    return;
+
+  strncpy(ctl_path, path, sizeof(ctl_path) - 1);
+  if(ev_add(fd, EV_READ, &ctl_evtype) != 0)
+    perror("unable to watch control socket");
+}
+
+static void ctl_close(ctlconn_t *c) {
+  ctlconn_t **p;
+
+  for(p = &conns; *p != NULL; p = &(*p)->next) {
+    if(*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+
+  if(c->listing)
+    client_cursor_close(&c->cursor);
+  ev_del(c->socket);
+  close(c->socket);
+  free(c);
+  nconns--;
+}
+
+void ctl_done() {
+  while(conns != NULL)
+    ctl_close(conns);
+
+  if(ctl_socket >= 0) {
+    ev_del(ctl_socket);
+    close(ctl_socket);
+    unlink(ctl_path); /* fails after chroot, never mind */
+  }
+  ctl_socket = -1;
+}
+
+static void ctl_accept() {
+  ctlconn_t *c;
+  int fd;
+
+  while((fd = accept(ctl_socket, NULL, NULL)) >= 0) {
+    if(nconns >= CTL_CONNS || (c = malloc(sizeof(ctlconn_t))) == NULL) {
+      close(fd);
+      continue;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    memset(c, 0, sizeof(ctlconn_t));
+    c->evtype = EV_CTL;
+    c->socket = fd;
+    c->events = EV_READ;
+    if(ev_add(fd, EV_READ, c) != 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+
+    c->next = conns;
+    conns = c;
+    nconns++;
+  }
+}
+
+/* called by the loop if the control socket or a connection is ready,
+   only does the I/O, see ctl_run() */
+void ctl_handle(void *data, int events) {
+  ctlconn_t *c = (ctlconn_t *)data;
+  ssize_t len;
+
+  if(data == &ctl_evtype) {
+    ctl_accept();
+    return;
+  }
+
+  if((events & (EV_READ | EV_ERROR)) && c->inlen < CTL_INLEN) {
+    len = recv(c->socket, c->in + c->inlen, CTL_INLEN - c->inlen, 0);
+    if(len > 0)
+      c->inlen += len;
+    else if(len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+      c->eof = 1;
+  }
+}
+
+static void ctl_printf(ctlconn_t *c, const char *fmt, ...) {
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(c->out + c->outlen, CTL_OUTLEN - c->outlen, fmt, ap);
+  va_end(ap);
+
+  if(len > 0)
+    c->outlen += (size_t)len < CTL_OUTLEN - c->outlen ? (size_t)len : CTL_OUTLEN - c->outlen - 1;
+}
+
+/* list the next chunk of sessions, one line each:
+   client address, local port, age and idle time in seconds,
+   datagrams and bytes forwarded, datagrams and bytes sent back, the
+   listen address of its forwarding setup and its destination */
+static void ctl_list(ctlconn_t *c) {
+  uint64_t now = clock_ms();
+  client_t *client;
+  int n;
+
+  for(n=0; n<CTL_CHUNK && CTL_OUTLEN - c->outlen > 256; n++) {
+    client = client_cursor_next(&c->cursor);
+    if(client == NULL) {
+      client_cursor_close(&c->cursor);
+      c->listing = 0;
+      ctl_printf(c, "ok %llu sessions\n", (unsigned long long)c->listed);
+      return;
+    }
+
+    ctl_printf(c, "%s:%d %d %.1f %.1f %llu %llu %llu %llu %s:%d %s:%d\n",
+               host_ip(&client->src), client->src.port, client->dst.port,
+               (now - client->created) / 1000.0, (now - client->lastseen) / 1000.0,
+               (unsigned long long)client->fwd_pkts, (unsigned long long)client->fwd_bytes,
+               (unsigned long long)client->rep_pkts, (unsigned long long)client->rep_bytes,
+               host_ip(client->listener->listen_h), client->listener->listen_h->port,
+               host_ip(&client->upstream), client->upstream.port);
+    c->listed++;
+  }
+}
+
+/* parse ip:port or [ip]:port, returns 0 on success */
+static int ctl_addr(char *arg, struct sockaddr_storage *ss) {
+  struct sockaddr_in *v4 = (struct sockaddr_in *)ss;
+  struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)ss;
+  char *port;
+
+  memset(ss, 0, sizeof(struct sockaddr_storage));
+
+  if(arg[0] == '[') {
+    if((port = strstr(arg, "]:")) == NULL)
+      return -1;
+    *port = '\0';
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(atoi(port + 2));
+    return inet_pton(AF_INET6, arg + 1, &v6->sin6_addr) == 1 ? 0 : -1;
+  }
+
+  if((port = strrchr(arg, ':')) == NULL)
+    return -1;
+  *port = '\0';
+  v4->sin_family = AF_INET;
+  v4->sin_port = htons(atoi(port + 1));
+  return inet_pton(AF_INET, arg, &v4->sin_addr) == 1 ? 0 : -1;
+}
+
+/* the forwarding setup listening on arg, NULL with an error message if
+   there is none */
+static listener_t *ctl_listener(ctlconn_t *c, char *arg) {
+  struct sockaddr_storage ss;
+  char addr[128];
+  listener_t *l;
+
+  snprintf(addr, sizeof(addr), "%s", arg); /* ctl_addr() modifies arg */
+
+  if(ctl_addr(arg, &ss) != 0)
+    ctl_printf(c, "error: listen address must be ip:port or [ip]:port\n");
+  else if((l = listener_find((struct sockaddr *)&ss)) == NULL)
+    ctl_printf(c, "error: not listening on %s\n", addr);
+  else
+    return l;
+
+  return NULL;
+}
+
+/* the destinations of all setups, one line each: listen address (a
+   range if shared by the ports of a range), destination, sessions,
+   smoothed time to the first answer in ms, lost requests in % and up
+   or down if ejected, see health.c */
+static void ctl_upstreams(ctlconn_t *c) {
+  char listen[HOST_IPLEN + 16], dst[HOST_IPLEN + 16];
+  listener_t *l, *last;
+  upstream_t *up;
+  int i;
+
+  for(l = listeners; l != NULL; l = last->next) {
+    for(last = l; last->next != NULL && last->next->dsts == l->dsts; last = last->next)
+      ;
+    if(last != l)
+      snprintf(listen, sizeof(listen), "%s:%d-%d", host_ip(l->listen_h), l->listen_h->port,
+               last->listen_h->port);
+    else
+      snprintf(listen, sizeof(listen), "%s:%d", host_ip(l->listen_h), l->listen_h->port);
+
+    for(i=0; i<l->dsts->count; i++) {
+      if(CTL_OUTLEN - c->outlen < 256) {
+        ctl_printf(c, "error: too many destinations to list\n");
+        return;
+      }
+      up = &l->dsts->ups[i];
+      if(last != l)
+        snprintf(dst, sizeof(dst), "%s:%d-%d", host_ip(up->host), up->host->port + l->dst_off,
+                 up->host->port + last->dst_off);
+      else
+        snprintf(dst, sizeof(dst), "%s:%d", host_ip(up->host), up->host->port + l->dst_off);
+      ctl_printf(c, "%s %s %d %.3f %.1f %s\n", listen, dst, up->sessions, up->rtt / 1000.0,
+                 up->loss * 100.0 / UPSTREAM_ONE, up->down ? "down" : "up");
+    }
+  }
+
+  ctl_printf(c, "ok\n");
+}
+
+static void ctl_command(ctlconn_t *c, char *line) {
+  struct sockaddr_storage ss;
+  listener_t *l, *last, *only = NULL;
+  client_t *client;
+  char *cmd, *arg, *arg2;
+  int seconds, killed = 0;
+
+  cmd  = strtok(line, " \t\r");
+  arg  = strtok(NULL, " \t\r");
+  arg2 = strtok(NULL, " \t\r");
+
+  if(cmd == NULL)
+    return;
+
+  if(strcmp(cmd, "list") == 0) {
+    c->listing = 1;
+    c->listed  = 0;
+    client_cursor_open(&c->cursor);
+  }
+  else if(strcmp(cmd, "kill") == 0) {
+    if(arg == NULL || ctl_addr(arg, &ss) != 0) {
+      ctl_printf(c, "error: kill needs ip:port or [ip]:port\n");
+      return;
+    }
+    if(arg2 != NULL && (only = ctl_listener(c, arg2)) == NULL)
+      return;
+
+    /* a client may have a session with every forwarding setup */
+    for(l = listeners; l != NULL; l = l->next) {
+      if(only != NULL && l != only)
+        continue;
+      if((client = client_find_addr(l->id, (struct sockaddr *)&ss)) == NULL)
+        continue;
+      if(VERBOSE)
+        verbose("closing socket %s:%d for client %s:%d (killed)\n", host_ip(&client->dst),
+                client->dst.port, host_ip(&client->src), client->src.port);
+      client_close(client);
+      killed++;
+    }
+
+    if(killed == 0)
+      ctl_printf(c, "error: no such session\n");
+    else
+      ctl_printf(c, "ok\n");
+  }
+  else if(strcmp(cmd, "timeout") == 0) {
+    if(arg == NULL) {
+      if(listeners != NULL && listeners->next == NULL) {
+        ctl_printf(c, "ok timeout %d\n", listeners->timeout);
+        return;
+      }
+      for(l = listeners; l != NULL; l = last->next) {
+        /* the ports of a range in one line */
+        for(last = l; last->next != NULL; last = last->next) {
+          if(last->next->timeout != l->timeout
+             || last->next->listen_h->port != last->listen_h->port + 1
+             || ! host_is_ip(l->listen_h, host_sa(last->next->listen_h)))
+            break;
+        }
+        if(CTL_OUTLEN - c->outlen < 256) {
+          ctl_printf(c, "error: too many setups to list\n");
+          return;
+        }
+        if(last != l)
+          ctl_printf(c, "%s:%d-%d %d\n", host_ip(l->listen_h), l->listen_h->port,
+                     last->listen_h->port, l->timeout);
+        else
+          ctl_printf(c, "%s:%d %d\n", host_ip(l->listen_h), l->listen_h->port, l->timeout);
+      }
+      ctl_printf(c, "ok\n");
+      return;
+    }
+
+    seconds = atoi(arg);
+    if(seconds < 1) {
+      ctl_printf(c, "error: timeout must be 1 or more seconds\n");
+      return;
+    }
+
+    if(arg2 != NULL) {
+      if((l = ctl_listener(c, arg2)) == NULL)
+        return;
+      l->timeout = seconds;
+      client_timeout_set(l->id, seconds);
+    }
+    else {
+      TIMEOUT = seconds;
+      for(l = listeners; l != NULL; l = l->next)
+        l->timeout = seconds;
+      client_timeout_set(-1, seconds);
+    }
+    ctl_printf(c, "ok timeout %d\n", seconds);
+  }
+  else if(strcmp(cmd, "upstreams") == 0)
+    ctl_upstreams(c);
+  else
+    ctl_printf(c, "error: unknown command %s\n", cmd);
+}
+
+/* send what we can, returns -1 if the connection is broken */
+static int ctl_send(ctlconn_t *c) {
+  ssize_t len;
+
+  if(c->outoff < c->outlen) {
+    len = send(c->socket, c->out + c->outoff, c->outlen - c->outoff, MSG_NOSIGNAL);
+    if(len < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    c->outoff += len;
+  }
+
+  if(c->outoff == c->outlen)
+    c->outoff = c->outlen = 0;
+
+  return 0;
+}
+
+/* run the commands received, continue listings and send the answers,
+   called by the loop once per iteration */
+void ctl_run() {
+  ctlconn_t *c, *next;
+  char *nl;
+  size_t len;
+  int events;
+
+  for(c = conns; c != NULL; c = next) {
+    next = c->next;
+
+    /* one command at a time, a listing has to finish first */
+    while(! c->listing && c->outlen < CTL_OUTLEN / 2
+          && (nl = memchr(c->in, '\n', c->inlen)) != NULL) {
+      *nl = '\0';
+      len = nl + 1 - c->in;
+      ctl_command(c, c->in);
+      memmove(c->in, nl + 1, c->inlen - len);
+      c->inlen -= len;
+    }
+
+    if(c->inlen == CTL_INLEN && memchr(c->in, '\n', c->inlen) == NULL) {
+      ctl_printf(c, "error: command too long\n");
+      c->inlen = 0;
+      c->eof = 1;
+    }
+
+    if(c->listing)
+      ctl_list(c);
+
+    if(ctl_send(c) != 0
+       || (c->eof && ! c->listing && c->outlen == 0 && memchr(c->in, '\n', c->inlen) == NULL)) {
+      ctl_close(c);
+      continue;
+    }
+
+    /* wait for room in the socket buffer, or come back in the next
+       iteration to continue the listing */
+    events = (c->eof || c->inlen == CTL_INLEN) ? 0 : EV_READ;
+    if(c->outlen > 0 || c->listing)
+      events |= EV_WRITE;
+    if(events != c->events) {
+      ev_mod(c->socket, events, c);
+      c->events = events;
+    }
+  }
+}
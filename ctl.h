@@ -0,0 +1,75 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_CTL_H
+#define _HAVE_CTL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "client.h"
+#include "event.h"
+
+#define CTL_CONNS   8       /* control connections at the same time */
+#define CTL_CHUNK   256     /* sessions listed per loop iteration */
+#define CTL_INLEN   256     /* longest command */
+#define CTL_OUTLEN  32768   /* output waiting to be sent */
+
+/* a connection to the control socket */
+struct _ctlconn_t {
+  int evtype;               /* EV_CTL, must be first, see event.h */
+  int socket;
+  char in[CTL_INLEN];       /* commands received */
+  size_t inlen;
+  char out[CTL_OUTLEN];     /* answers not sent yet */
+  size_t outlen;
+  size_t outoff;            /* bytes of out already sent */
+  int listing;              /* a list command is in progress */
+  uint64_t listed;          /* sessions listed so far */
+  ccursor_t cursor;         /* where the listing continues */
+  int events;               /* registered with the event engine */
+  int eof;                  /* the client has sent everything */
+  struct _ctlconn_t *next;
+};
+typedef struct _ctlconn_t ctlconn_t;
+
+extern char *CONTROL;
+
+int  ctl_bind(const char *path);
+void ctl_init(int fd, const char *path);
+void ctl_done();
+void ctl_handle(void *data, int events);
+void ctl_run();
+
+#endif
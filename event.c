@@ -0,0 +1,234 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "event.h"
+
+/*
+  Small event  engine used by  main_loop(). Every socket  is registered
+  once with a pointer to the object  owning it and we get that pointer
+  back when the socket becomes ready, so there is no need to rebuild fd
+  sets or to look up the owner of a socket per packet.
+
+  On linux we use epoll (level triggered), everywhere else (e.g. cygwin)
+  a poll() based fallback with the same interface.
+*/
+
+#ifdef HAVE_EPOLL
+
+static int epfd = -1;
+
+int ev_init() {
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  return 0;
+}
+
+void ev_done() {
+  if(epfd >= 0)
+    close(epfd);
+  epfd = -1;
+}
+
+static uint32_t ev_mask(int events) {
+  uint32_t mask = 0;
+  if(events & EV_READ)
+    mask |= EPOLLIN;
+  if(events & EV_WRITE)
+    mask |= EPOLLOUT;
+  return mask;
+}
+
+static int ev_ctl(int op, int fd, int events, void *data) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events   = ev_mask(events);
+  ev.data.ptr = data;
+  return epoll_ctl(epfd, op, fd, &ev);
+}
+
+/* the epoll descriptor, readable if any registered socket is ready */
+int ev_fd() {
+  return epfd;
+}
+
+int ev_add(int fd, int events, void *data) {
+  return ev_ctl(EPOLL_CTL_ADD, fd, events, data);
+}
+
+int ev_mod(int fd, int events, void *data) {
+  return ev_ctl(EPOLL_CTL_MOD, fd, events, data);
+}
+
+int ev_del(int fd) {
+  struct epoll_event ev; /* required by kernels < 2.6.9 */
+  return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int ev_wait(ev_event_t *events, int max, int timeout) {
+  struct epoll_event evs[EV_MAXEVENTS];
+  int i, n;
+
+  if(max > EV_MAXEVENTS)
+    max = EV_MAXEVENTS;
+
+  n = epoll_wait(epfd, evs, max, timeout);
+
+  for(i=0; i<n; i++) {
+    events[i].events = 0;
+    events[i].data   = evs[i].data.ptr;
+    if(evs[i].events & EPOLLIN)
+      events[i].events |= EV_READ;
+    if(evs[i].events & EPOLLOUT)
+      events[i].events |= EV_WRITE;
+    if(evs[i].events & (EPOLLERR|EPOLLHUP))
+      events[i].events |= EV_ERROR;
+  }
+
+  return n;
+}
+
+#else /* poll() fallback */
+
+static struct pollfd *pfds = NULL;  /* registered sockets */
+static void **datas        = NULL;  /* owner pointers, same index as pfds */
+static int *slots          = NULL;  /* fd => index into pfds, -1 if unused */
+static int npfds   = 0;
+static int maxpfds = 0;
+static int maxfd   = 0;
+
+int ev_init() {
+  return 0;
+}
+
+void ev_done() {
+  free(pfds);
+  free(datas);
+  free(slots);
+  pfds  = NULL;
+  datas = NULL;
+  slots = NULL;
+  npfds = maxpfds = maxfd = 0;
+}
+
+/* there is no descriptor to wait for */
+int ev_fd() {
+  return -1;
+}
+
+static short ev_mask(int events) {
+  short mask = 0;
+  if(events & EV_READ)
+    mask |= POLLIN;
+  if(events & EV_WRITE)
+    mask |= POLLOUT;
+  return mask;
+}
+
+int ev_add(int fd, int events, void *data) {
+  int i;
+
+  if(fd >= maxfd) {
+    int newmax = (fd + 1) * 2;
+    slots = realloc(slots, sizeof(int) * newmax);
+    for(i=maxfd; i<newmax; i++)
+      slots[i] = -1;
+    maxfd = newmax;
+  }
+
+  if(slots[fd] != -1) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  if(npfds == maxpfds) {
+    maxpfds = maxpfds ? maxpfds * 2 : 64;
+    pfds  = realloc(pfds,  sizeof(struct pollfd) * maxpfds);
+    datas = realloc(datas, sizeof(void *) * maxpfds);
+  }
+
+  pfds[npfds].fd      = fd;
+  pfds[npfds].events  = ev_mask(events);
+  pfds[npfds].revents = 0;
+  datas[npfds] = data;
+  slots[fd] = npfds++;
+
+  return 0;
+}
+
+int ev_mod(int fd, int events, void *data) {
+  if(fd >= maxfd || slots[fd] == -1) {
+    errno = ENOENT;
+    return -1;
+  }
+  pfds[slots[fd]].events = ev_mask(events);
+  datas[slots[fd]] = data;
+  return 0;
+}
+
+int ev_del(int fd) {
+  int i;
+
+  if(fd >= maxfd || slots[fd] == -1) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  /* move the last entry into the free slot */
+  i = slots[fd];
+  npfds--;
+  if(i != npfds) {
+    pfds[i]  = pfds[npfds];
+    datas[i] = datas[npfds];
+    slots[pfds[i].fd] = i;
+  }
+  slots[fd] = -1;
+
+  return 0;
+}
+
+int ev_wait(ev_event_t *events, int max, int timeout) {
+  int i, n, ready;
+
+  ready = poll(pfds, npfds, timeout);
+  if(ready <= 0)
+    return ready;
+
+  for(i=0, n=0; i<npfds && n<max; i++) {
+    if(pfds[i].revents) {
+      events[n].events = 0;
+      events[n].data   = datas[i];
+      if(pfds[i].revents & POLLIN)
+        events[n].events |= EV_READ;
+      if(pfds[i].revents & POLLOUT)
+        events[n].events |= EV_WRITE;
+      if(pfds[i].revents & (POLLERR|POLLHUP|POLLNVAL))
+        events[n].events |= EV_ERROR;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_EVENT_H
+#define _HAVE_EVENT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#define HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+/* interest flags, passed to ev_add() and ev_mod() */
+#define EV_READ  0x01
+#define EV_WRITE 0x02
+
+/* readiness flags, returned in ev_event_t.events */
+#define EV_ERROR 0x04
+
+/* every structure registered with  the event engine starts with one of
+   these as its  first member, so the dispatcher in  main_loop() can tell
+   what kind of object the data pointer refers to */
+#define EV_LISTEN  1
+#define EV_CLIENT  2
+#define EV_CTL     3
+#define EV_METRICS 4
+#define EV_PROBE   5
+
+#define EV_MAXEVENTS 256 /* events fetched per ev_wait() call */
+
+struct _ev_event_t {
+  int events;     /* EV_READ, EV_WRITE and/or EV_ERROR */
+  void *data;     /* pointer given to ev_add() */
+};
+typedef struct _ev_event_t ev_event_t;
+
+int  ev_init();
+void ev_done();
+int  ev_fd();
+int  ev_add(int fd, int events, void *data);
+int  ev_mod(int fd, int events, void *data);
+int  ev_del(int fd);
+int  ev_wait(ev_event_t *events, int max, int timeout);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+
+#include "health.h"
+#include "net.h"
+
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+/*
+  Health of the destinations, see upstream.c for what happens to an
+  unhealthy one.
+
+  Passively, the outgoing sockets of sessions ask the kernel for icmp
+  errors (IP_RECVERR, see sockpool.c), a destination or port
+  unreachable for the destination of a session ejects it at once, see
+  health_unreachable(). Requests which got no answer are counted by
+  upstream_lost().
+
+  Actively, with --probe every destination of a setup gets the probe
+  payload every --interval seconds, from a socket of its own connected
+  to it. An answer (starting with --expect, if given) takes it back
+  when ejected, UPSTREAM_FAILS probes in a row without one or an icmp
+  error eject it. Probes go to the first port of a destination range,
+  with -w every worker probes on its own.
+
+  Without probes an ejected destination gets another chance after
+  UPSTREAM_HOLD seconds, checked by the same timer.
+*/
+
+static probe_t *probes = NULL;   /* one per destination of all setups */
+static int probing = 0;          /* sockets sending probes */
+static uint64_t last = 0;        /* us, the last round of health_run() */
+
+/* read the icmp errors queued for fd, returns how many of them say that
+   dst is unreachable */
+int health_unreachable(int fd, host_t *dst) {
+#ifdef IP_RECVERR
+  struct sockaddr_storage name;
+  struct sock_extended_err *ee;
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  struct iovec iov;
+  char ctrl[512], data[1];
+  int n = 0;
+
+  while(1) {
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = data;
+    iov.iov_len        = sizeof(data);
+    msg.msg_name       = &name;
+    msg.msg_namelen    = sizeof(name);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      return n;
+
+    /* the name is where the datagram went to */
+    for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      if(! (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR)
+         && ! (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if(((ee->ee_origin == SO_EE_ORIGIN_ICMP && ee->ee_type == ICMP_DEST_UNREACH
+           && ee->ee_code != ICMP_FRAG_NEEDED)
+          || (ee->ee_origin == SO_EE_ORIGIN_ICMP6 && ee->ee_type == ICMP6_DST_UNREACH))
+         && msg.msg_namelen > 0 && host_is(dst, (struct sockaddr *)&name))
+        n++;
+    }
+  }
+#else
+  (void)fd;
+  (void)dst;
+  return 0;
+#endif
+}
+
+/* a probe socket of a destination for each destination of the setups
+   with --probe, and an entry without one for the others */
+void health_init() {
+  listener_t *l;
+  dstset_t *ds;
+  probe_t *p;
+  host_t src;
+  int i;
+
+  for(l = listeners; l != NULL; l = l->next) {
+    /* the ports of a range share the destinations */
+    ds = l->dsts;
+    for(p = probes; p != NULL && p->up->set != ds; p = p->next)
+      ;
+    if(p != NULL)
+      continue;
+
+    for(i=0; i<ds->count; i++) {
+      if((p = calloc(1, sizeof(probe_t))) == NULL) {
+        perror("unable to allocate probe");
+        return;
+      }
+      p->evtype = EV_PROBE;
+      p->socket = -1;
+      p->up     = &ds->ups[i];
+      p->next   = probes;
+      probes    = p;
+
+      if(ds->probe == NULL)
+        continue;
+
+      /* from the first bind address, like the sessions */
+      src = *l->binds->hosts[0];
+      host_port(&src, 0);
+      if((p->socket = bindsocket(&src, 0)) < 0)
+        continue;
+      if(connect(p->socket, host_sa(p->up->host), p->up->host->size) != 0
+         || ev_add(p->socket, EV_READ, p) != 0) {
+        fprintf(stderr, "unable to probe %s:%d: %s\n", host_ip(p->up->host), p->up->host->port,
+                strerror(errno));
+        close(p->socket);
+        p->socket = -1;
+        continue;
+      }
+      probing++;
+    }
+  }
+}
+
+void health_done() {
+  probe_t *p;
+
+  while(probes != NULL) {
+    p = probes;
+    probes = p->next;
+    if(p->socket >= 0) {
+      ev_del(p->socket);
+      close(p->socket);
+    }
+    free(p);
+  }
+  probing = 0;
+  last = 0;
+}
+
+/* us between two rounds, 0 if there is nothing to do */
+static uint64_t health_period() {
+  if(probing)
+    return (uint64_t)INTERVAL * 1000000;
+  if(upstream_ejected() > 0)
+    return 1000000;
+  return 0;
+}
+
+/* milliseconds until the next round, -1 if there is none */
+int health_timeout(uint64_t us) {
+  uint64_t period = health_period();
+
+  if(period == 0)
+    return -1;
+  if(us - last >= period)
+    return 0;
+  return (int)((period - (us - last)) / 1000) + 1;
+}
+
+/* sending or receiving a probe failed */
+static void health_error(probe_t *p, int err) {
+  if(err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH) {
+    p->waiting = 0;
+    upstream_fail(p->up, 1);
+  }
+  else if(err != EAGAIN && err != EWOULDBLOCK)
+    fprintf(stderr, "unable to probe %s:%d: %s\n", host_ip(p->up->host), p->up->host->port,
+            strerror(err));
+}
+
+/* once per loop iteration: every --interval seconds a probe to every
+   destination, counting the unanswered previous one as failure, and
+   another chance for ejected destinations without probes */
+void health_run(uint64_t us) {
+  uint64_t period = health_period();
+  time_t now;
+  probe_t *p;
+
+  if(period == 0 || us - last < period)
+    return;
+  last = us;
+  now  = time(NULL);
+
+  for(p = probes; p != NULL; p = p->next) {
+    if(p->socket >= 0) {
+      if(p->waiting)
+        upstream_fail(p->up, 0);
+      p->waiting = 1;
+      if(send(p->socket, p->up->set->probe, p->up->set->probe_len, 0) < 0)
+        health_error(p, errno);
+    }
+    else if(p->up->down && now - p->up->since >= UPSTREAM_HOLD)
+      upstream_retry(p->up);
+  }
+}
+
+/* answers to probes, anything else from the destination is ignored */
+void health_handle(void *data, int events) {
+  probe_t *p = (probe_t *)data;
+  dstset_t *ds = p->up->set;
+  char buf[HEALTH_MAXLEN];
+  ssize_t n;
+
+  (void)events;
+
+  while(1) {
+    n = recv(p->socket, buf, sizeof(buf), MSG_DONTWAIT);
+    if(n < 0) {
+      health_error(p, errno);
+      return;
+    }
+    if(ds->expect != NULL
+       && ((size_t)n < ds->expect_len || memcmp(buf, ds->expect, ds->expect_len) != 0))
+      continue;
+    p->waiting = 0;
+    upstream_alive(p->up);
+  }
+}
@@ -0,0 +1,67 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+
+#ifndef _HAVE_HEALTH_H
+#define _HAVE_HEALTH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/fcntl.h>
+#include <netinet/in.h>
+
+#include "host.h"
+#include "event.h"
+#include "upstream.h"
+
+#define HEALTH_INTERVAL 2      /* default seconds between two probes */
+#define HEALTH_MAXLEN   512    /* longest probe payload and expected answer */
+
+/* health probes of one destination */
+struct _probe_t {
+  int evtype;               /* EV_PROBE, must be first, see event.h */
+  int socket;               /* connected to the destination, -1 if not probed */
+  int waiting;              /* the last probe got no answer yet */
+  upstream_t *up;
+  struct _probe_t *next;
+};
+typedef struct _probe_t probe_t;
+
+extern char *PROBE;
+extern char *EXPECT;
+extern int INTERVAL;
+
+int  health_unreachable(int fd, host_t *dst);
+void health_init();
+void health_done();
+int  health_timeout(uint64_t us);
+void health_run(uint64_t us);
+void health_handle(void *data, int events);
+
+#endif
@@ -25,16 +25,14 @@
    which is easier to pass between functions,
    maybe v4 or v6, filled from existing structs or from strings,
    which create the sockaddr* structs */
-host_t *get_host(char *ip, int port, struct sockaddr_in *v4, struct sockaddr_in6 *v6) {
+host_t *get_host(char *ip, int port, struct sockaddr *addr) {
   host_t *host = malloc(sizeof(host_t));
-  host->sock = NULL;
-  host->is_v6 = 0;
+  memset(host, 0, sizeof(host_t));
   host->port = port;
 
   if(ip != NULL) {
     if(is_v6(ip)) {
-      struct sockaddr_in6 *tmp = malloc(sizeof(struct sockaddr_in6));
-      memset(tmp, 0, sizeof(struct sockaddr_in6));
+      struct sockaddr_in6 *tmp = &host->sock.v6;
       
       inet_pton(AF_INET6, ip, (struct in6_addr*)&tmp->sin6_addr);
       
@@ -48,60 +46,19 @@ host_t *get_host(char *ip, int port, struct sockaddr_in *v4, struct sockaddr_in6
         tmp->sin6_scope_id = 0;
 
       host->is_v6 = 1;
-      host->sock  = (struct sockaddr*)tmp;
       host->size = sizeof(struct sockaddr_in6);
-      if(tmp->sin6_scope_id != 0) {
-        host->ip = malloc(INET6_ADDRSTRLEN + 9); /* plus [ % ] \0 , scope*/
-        sprintf(host->ip, "[%s%%%d]", ip, scope);
-      }
-      else {
-        host->ip = malloc(INET6_ADDRSTRLEN + 3); /* plus [ ] \0 */
-        sprintf(host->ip, "[%s]", ip);
-      }
     }
     else {
-      struct sockaddr_in *tmp = malloc(sizeof(struct sockaddr_in));
-      memset(tmp, 0, sizeof(struct sockaddr_in));
+      struct sockaddr_in *tmp = &host->sock.v4;
       tmp->sin_family = AF_INET;
       tmp->sin_addr.s_addr = inet_addr( ip );
       tmp->sin_port = htons( port );
 
-      host->sock   = (struct sockaddr*)tmp;
       host->size = sizeof(struct sockaddr_in);
-      host->ip = malloc(INET_ADDRSTRLEN+1);
-      memcpy(host->ip, ip, INET_ADDRSTRLEN);
     }
   }
-  else if(v4 != NULL) {
-    struct sockaddr_in *tmp = malloc(sizeof(struct sockaddr_in));
-    memcpy(tmp, v4, sizeof(struct sockaddr_in));
-    host->ip = malloc(INET_ADDRSTRLEN);
-    inet_ntop(AF_INET, (struct in_addr *)&tmp->sin_addr, host->ip, INET_ADDRSTRLEN);
-
-    host->port = ntohs(tmp->sin_port);
-    host->sock = (struct sockaddr*)tmp;
-    host->size = sizeof(struct sockaddr_in);
-  }
-  else if(v6 != NULL) {
-    struct sockaddr_in6 *tmp = malloc(sizeof(struct sockaddr_in6));
-    memcpy(tmp, v6, sizeof(struct sockaddr_in6));
-    char *myip = malloc(INET6_ADDRSTRLEN);
-    inet_ntop(AF_INET6, (struct in6_addr *)&tmp->sin6_addr, myip, INET6_ADDRSTRLEN);
-
-    host->port = ntohs(tmp->sin6_port);
-    host->sock = (struct sockaddr*)tmp;
-    host->is_v6 = 1;
-    host->size = sizeof(struct sockaddr_in6);
-
-    if(tmp->sin6_scope_id != 0) {
-      host->ip = malloc(INET6_ADDRSTRLEN + 9); /* plus [ % ] \0 , scope*/
-      sprintf(host->ip, "[%s%%%d]", myip, tmp->sin6_scope_id);
-    }
-    else {
-      host->ip = malloc(INET6_ADDRSTRLEN + 3); /* plus [ ] \0 */      
-      sprintf(host->ip, "[%s]", myip);
-    }
-    free(myip);
+  else if(addr != NULL) {
+    host_set(host, addr);
   }
   else {
     fprintf(stderr, "call invalid!\n");
@@ -111,6 +68,94 @@ host_t *get_host(char *ip, int port, struct sockaddr_in *v4, struct sockaddr_in6
   return host;
 }
 
+/* fill an existing host from a sockaddr, doesn't allocate anything */
+void host_set(host_t *host, struct sockaddr *addr) {
+  if(addr->sa_family == AF_INET6) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    memcpy(&host->sock.v6, v6, sizeof(struct sockaddr_in6));
+    host->port  = ntohs(v6->sin6_port);
+    host->is_v6 = 1;
+    host->size  = sizeof(struct sockaddr_in6);
+  }
+  else {
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    memcpy(&host->sock.v4, v4, sizeof(struct sockaddr_in));
+    host->port  = ntohs(v4->sin_port);
+    host->is_v6 = 0;
+    host->size  = sizeof(struct sockaddr_in);
+  }
+}
+
+/* change the port of a host */
+void host_port(host_t *host, int port) {
+  host->port = port;
+  if(host->is_v6)
+    host->sock.v6.sin6_port = htons(port);
+  else
+    host->sock.v4.sin_port = htons(port);
+}
+
+/* does addr have the address and port of host? */
+int host_is(host_t *host, struct sockaddr *addr) {
+  if(host->is_v6) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    return addr->sa_family == AF_INET6 && v6->sin6_port == host->sock.v6.sin6_port
+      && memcmp(&v6->sin6_addr, &host->sock.v6.sin6_addr, sizeof(struct in6_addr)) == 0;
+  }
+  else {
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    return addr->sa_family == AF_INET && v4->sin_port == host->sock.v4.sin_port
+      && v4->sin_addr.s_addr == host->sock.v4.sin_addr.s_addr;
+  }
+}
+
+/* does addr have the address of host, whatever the port? */
+int host_is_ip(host_t *host, struct sockaddr *addr) {
+  if(host->is_v6) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    return addr->sa_family == AF_INET6
+      && memcmp(&v6->sin6_addr, &host->sock.v6.sin6_addr, sizeof(struct in6_addr)) == 0;
+  }
+  else {
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    return addr->sa_family == AF_INET && v4->sin_addr.s_addr == host->sock.v4.sin_addr.s_addr;
+  }
+}
+
+/* return the ip address as string, v6 addresses in brackets, e.g. for
+   logging. The string is only valid until the 4th next call. */
+const char *host_ip(host_t *host) {
+  static char bufs[4][HOST_IPLEN];
+  static int next = 0;
+  char addr[INET6_ADDRSTRLEN];
+  char *buf = bufs[next];
+
+  next = (next + 1) % 4;
+
+  if(host->is_v6) {
+    struct sockaddr_in6 *v6 = &host->sock.v6;
+    inet_ntop(AF_INET6, &v6->sin6_addr, addr, INET6_ADDRSTRLEN);
+    if(v6->sin6_scope_id != 0)
+      snprintf(buf, HOST_IPLEN, "[%s%%%d]", addr, v6->sin6_scope_id);
+    else
+      snprintf(buf, HOST_IPLEN, "[%s]", addr);
+  }
+  else {
+    struct sockaddr_in *v4 = &host->sock.v4;
+    inet_ntop(AF_INET, &v4->sin_addr, buf, HOST_IPLEN);
+  }
+
+  return buf;
+}
+
+/* true if the address is 0.0.0.0 or :: */
+int host_is_any(host_t *host) {
+  if(host->is_v6)
+    return IN6_IS_ADDR_UNSPECIFIED(&host->sock.v6.sin6_addr);
+  else
+    return host->sock.v4.sin_addr.s_addr == htonl(INADDR_ANY);
+}
+
 int is_v6(char *ip) {
   char *IS = strchr(ip, ':');
   if(IS == NULL)
@@ -159,15 +204,13 @@ int is_linklocal(struct in6_addr *a) {
 }
 
 void host_dump(host_t *host) {
-  fprintf(stderr, "host -   ip: %s\n", host->ip);
+  fprintf(stderr, "host -   ip: %s\n", host_ip(host));
   fprintf(stderr, "       port: %d\n", host->port);
   fprintf(stderr, "       isv6: %d\n", host->is_v6);
   fprintf(stderr, "       size: %ld\n", (long int)host->size);
-  fprintf(stderr, "        src: %p\n", host->sock);
+  fprintf(stderr, "        src: %p\n", (void *)host_sa(host));
 }
 
 void host_clean(host_t *host) {
-  free(host->sock);
-  free(host->ip);
   free(host);
 }
@@ -37,18 +37,37 @@
 #include <net/if.h> // if_nametoindex()
 #include <ifaddrs.h>
 
+/* just large enough for v4 and v6, sockaddr_storage would be 128 bytes */
+union _hostaddr_t {
+  struct sockaddr sa;
+  struct sockaddr_in v4;
+  struct sockaddr_in6 v6;
+};
+typedef union _hostaddr_t hostaddr_t;
+
 struct _host_t {
   int is_v6;
-  struct sockaddr *sock;
-  size_t size;
-  char *ip;
+  hostaddr_t sock;          /* v4 or v6 address, use host_sa() */
+  socklen_t size;           /* used part of sock */
   int port;
 };
 typedef struct _host_t host_t;
 
+/* the address of a host as generic sockaddr, for bind(), sendto() etc */
+#define host_sa(host) (&(host)->sock.sa)
+
+/* max length of the string returned by host_ip(): [ % ] \0 + scope */
+#define HOST_IPLEN (INET6_ADDRSTRLEN + 16)
+
 unsigned get_v6_scope(const char *ip);
 int is_linklocal(struct in6_addr *a);
-host_t *get_host(char *ip, int port, struct sockaddr_in *v4, struct sockaddr_in6 *v6);
+host_t *get_host(char *ip, int port, struct sockaddr *addr);
+void host_set(host_t *host, struct sockaddr *addr);
+void host_port(host_t *host, int port);
+int host_is(host_t *host, struct sockaddr *addr);
+int host_is_ip(host_t *host, struct sockaddr *addr);
+const char *host_ip(host_t *host);
+int host_is_any(host_t *host);
 int is_v6(char *ip);
 void host_dump(host_t *host);
 void host_clean(host_t *host);
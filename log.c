@@ -21,22 +21,249 @@
 
 #include "log.h"
 
+/*
+  With -v every datagram is logged, which is far too slow if done in
+  the loop. So the loop only copies a small binary record into a ring
+  and a separate thread formats and emits it. The ring has exactly one
+  writer (the loop) and one reader (the log thread), so it doesn't need
+  locks. If it is full, records are dropped and counted, --lograte and
+  --logevery limit the number of datagrams logged in the first place.
+  The thread reports both once per second, if there were any.
+
+  Every record carries the time of the loop iteration which produced
+  it, the thread prints it as wall clock time in front of the message,
+  so it is the time the datagram was handled, not the one it was
+  formatted.
+
+  Before log_start() and after log_stop() messages are written right
+  away, as before.
+*/
+
+static logrec_t *ring = NULL;
+static _Atomic uint64_t head = 0;      /* next record to write, by the loop */
+static _Atomic uint64_t tail = 0;      /* next record to read, by the thread */
+static _Atomic uint64_t dropped = 0;   /* ring was full */
+static _Atomic uint64_t limited = 0;   /* over --lograte */
+static atomic_int stop = 0;
+static pthread_t thread;
+
+/* state of the loop side, see log_event() */
+static uint64_t now = 0;               /* us, set by log_tick() */
+static uint64_t second = 0;            /* rate limit: current second */
+static int budget = 0;                 /* rate limit: records left in it */
+static uint64_t seen = 0;              /* datagrams, for --logevery */
+
+/* the last message didn't end its line, verbose() may be called for
+   parts of a line. Only used by whoever formats, the thread or, without
+   it, the loop. */
+static int midline = 0;
+
+/* the wall clock time of us on the monotonic clock as text, the
+   current time if us is 0 */
+static char *log_time(uint64_t us, char *buf) {
+  struct timespec mono, real;
+  int64_t wall;
+  time_t sec;
+  struct tm tm;
+
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  wall = (int64_t)real.tv_sec * 1000000 + real.tv_nsec / 1000;
+  if(us != 0)
+    wall -= (int64_t)mono.tv_sec * 1000000 + mono.tv_nsec / 1000 - (int64_t)us;
+
+  sec = wall / 1000000;
+  localtime_r(&sec, &tm);
+  strftime(buf, LOG_TIMELEN, "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(buf + strlen(buf), LOG_TIMELEN - strlen(buf), ".%06d ", (int)(wall % 1000000));
+
+  return buf;
+}
+
+/* where all messages end up. Those to stderr get the time of us in
+   front, unless they continue a line, syslog has its own. */
+static void log_emit(uint64_t us, const char *msg) {
+  char when[LOG_TIMELEN];
+
+  if(FORKED)
+    syslog(LOG_INFO, "%s", msg);
+  else
+    fprintf(stderr, "%s%s", midline ? "" : log_time(us, when), msg);
+  midline = msg[0] != '\0' && msg[strlen(msg) - 1] != '\n';
+}
+
+static char *log_ntop(logaddr_t *la, char *buf) {
+  inet_ntop(la->family == AF_INET6 ? AF_INET6 : AF_INET, la->addr, buf, INET6_ADDRSTRLEN);
+  return buf;
+}
+
+static void log_format(logrec_t *rec) {
+  char msg[512], src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN], bind[INET6_ADDRSTRLEN];
+  char from[INET6_ADDRSTRLEN + 16];
+  logaddr_t any;
+
+  from[0] = '\0';
+  memset(&any, 0, sizeof(any));
+  any.family = rec->u.addr.bind.family;
+
+  switch(rec->event) {
+  case LOGEV_TEXT:
+    log_emit(rec->us, rec->u.text);
+    return;
+  case LOGEV_KNOWN:
+  case LOGEV_NEW:
+    /* the bind address, unless it is the default */
+    if(memcmp(&rec->u.addr.bind, &any, sizeof(any)) != 0)
+      snprintf(from, sizeof(from), " from %s:%d", log_ntop(&rec->u.addr.bind, bind),
+               ntohs(rec->u.addr.bind.port));
+    snprintf(msg, sizeof(msg), "Client %s:%d is %s, forwarding %d bytes to %s:%d%s\n",
+             log_ntop(&rec->u.addr.src, src), ntohs(rec->u.addr.src.port),
+             rec->event == LOGEV_KNOWN ? "known" : "unknown", (int)rec->len,
+             log_ntop(&rec->u.addr.dst, dst), ntohs(rec->u.addr.dst.port), from);
+    break;
+  case LOGEV_AGED:
+    snprintf(msg, sizeof(msg), "closing socket %s:%d for client %s:%d (aged out after %d seconds)\n",
+             log_ntop(&rec->u.addr.dst, dst), ntohs(rec->u.addr.dst.port),
+             log_ntop(&rec->u.addr.src, src), ntohs(rec->u.addr.src.port), (int)rec->len);
+    break;
+  default:
+    return;
+  }
+
+  log_emit(rec->us, msg);
+}
+
+/* tell about records which didn't make it since the last time */
+static void log_report(uint64_t *lastdrop, uint64_t *lastlimit) {
+  uint64_t d = atomic_load_explicit(&dropped, memory_order_relaxed);
+  uint64_t l = atomic_load_explicit(&limited, memory_order_relaxed);
+  char msg[128];
+
+  if(d == *lastdrop && l == *lastlimit)
+    return;
+
+  snprintf(msg, sizeof(msg), "log: %llu records dropped, %llu over --lograte\n",
+           (unsigned long long)(d - *lastdrop), (unsigned long long)(l - *lastlimit));
+  log_emit(0, msg);
+  *lastdrop  = d;
+  *lastlimit = l;
+}
+
+/* the log thread, polls the ring, the loop never has to wake it up */
+static void *log_main(void *arg) {
+  struct timespec idle = { 0, 10 * 1000000 };
+  uint64_t h, t, lastdrop = 0, lastlimit = 0;
+  time_t reported = 0;
+  (void)arg;
+
+  for(;;) {
+    h = atomic_load_explicit(&head, memory_order_acquire);
+    t = atomic_load_explicit(&tail, memory_order_relaxed);
+
+    for(; t != h; t++) {
+      log_format(&ring[t & (LOG_RING - 1)]);
+      atomic_store_explicit(&tail, t + 1, memory_order_release);
+    }
+
+    if(time(NULL) != reported) {
+      reported = time(NULL);
+      log_report(&lastdrop, &lastlimit);
+    }
+
+    if(h == atomic_load_explicit(&head, memory_order_acquire)) {
+      if(atomic_load(&stop))
+        break;
+      nanosleep(&idle, NULL);
+    }
+  }
+
+  log_report(&lastdrop, &lastlimit);
+  return NULL;
+}
 
+/* start the log thread, if verbose. Signals stay with the loop. */
+int log_start() {
+  sigset_t all, old;
+  int err;
+
+  if(! VERBOSE)
+    return 0;
+
+  ring = calloc(LOG_RING, sizeof(logrec_t));
+  if(ring == NULL) {
+    perror("unable to allocate log buffer");
+    return -1;
+  }
+
+  atomic_store(&head, 0);
+  atomic_store(&tail, 0);
+  atomic_store(&stop, 0);
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  err = pthread_create(&thread, NULL, log_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if(err != 0) {
+    fprintf(stderr, "unable to start log thread: %s\n", strerror(err));
+    free(ring);
+    ring = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* emit what is left in the ring and stop the log thread */
+void log_stop() {
+  if(ring == NULL)
+    return;
+
+  atomic_store(&stop, 1);
+  pthread_join(thread, NULL);
+  free(ring);
+  ring = NULL;
+}
+
+/* a free record, NULL if the ring is full */
+static logrec_t *log_get() {
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+
+  if(h - atomic_load_explicit(&tail, memory_order_acquire) >= LOG_RING) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  return &ring[h & (LOG_RING - 1)];
+}
+
+/* hand the record returned by log_get() over to the thread */
+static void log_put() {
+  atomic_store_explicit(&head, atomic_load_explicit(&head, memory_order_relaxed) + 1,
+                        memory_order_release);
+}
 
 void verbose(const char * fmt, ...) {
   if(VERBOSE) {
     char *msg = NULL;
+    logrec_t *rec;
     va_list ap;
     va_start(ap, fmt);
 
-    if(vasprintf(&msg, fmt, ap) >= 0) {
-
-      if(FORKED) {
-        syslog(LOG_INFO, "%s", msg);
-      }
-      else {
-        fprintf(stderr, "%s", msg);
+    if(ring != NULL) {
+      /* no allocation, longer messages are cut */
+      if((rec = log_get()) != NULL) {
+        rec->us    = now;
+        rec->event = LOGEV_TEXT;
+        vsnprintf(rec->u.text, LOG_TEXTLEN, fmt, ap);
+        log_put();
       }
+      va_end(ap);
+      return;
+    }
+
+    if(vasprintf(&msg, fmt, ap) >= 0) {
+      log_emit(0, msg);
       free(msg);
       va_end(ap);
     }
@@ -46,3 +273,66 @@ void verbose(const char * fmt, ...) {
     }
   }
 }
+
+static void log_addr(logaddr_t *la, struct sockaddr *sa) {
+  memset(la, 0, sizeof(logaddr_t));
+  if(sa == NULL)
+    return;
+  la->family = sa->sa_family;
+  if(sa->sa_family == AF_INET6) {
+    la->port = ((struct sockaddr_in6 *)sa)->sin6_port;
+    memcpy(la->addr, &((struct sockaddr_in6 *)sa)->sin6_addr, 16);
+  }
+  else {
+    la->port = ((struct sockaddr_in *)sa)->sin_port;
+    memcpy(la->addr, &((struct sockaddr_in *)sa)->sin_addr, 4);
+  }
+}
+
+/* the time of the records and the clock of the rate limit, set once
+   per loop iteration */
+void log_tick(uint64_t us) {
+  now = us;
+}
+
+/* log a datagram (LOGEV_KNOWN, LOGEV_NEW, len is its size) or an aged
+   out session (LOGEV_AGED, len is TIMEOUT), called by the loop */
+void log_event(int event, struct sockaddr *src, struct sockaddr *dst,
+               struct sockaddr *bind, size_t len) {
+  logrec_t local, *rec = &local;
+
+  if(! VERBOSE)
+    return;
+
+  if(ring != NULL) {
+    if(event != LOGEV_AGED) {
+      if(LOGEVERY > 1 && seen++ % LOGEVERY != 0)
+        return;
+      if(LOGRATE > 0) {
+        if(now / 1000000 != second) {
+          second = now / 1000000;
+          budget = LOGRATE;
+        }
+        if(budget == 0) {
+          atomic_fetch_add_explicit(&limited, 1, memory_order_relaxed);
+          return;
+        }
+        budget--;
+      }
+    }
+    if((rec = log_get()) == NULL)
+      return;
+  }
+
+  rec->us    = now;
+  rec->event = event;
+  rec->len   = len;
+  log_addr(&rec->u.addr.src, src);
+  log_addr(&rec->u.addr.dst, dst);
+  log_addr(&rec->u.addr.bind, bind);
+
+  if(ring != NULL)
+    log_put();
+  else
+    log_format(rec); /* no thread, e.g. not started yet */
+}
@@ -28,13 +28,64 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <syslog.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define LOG_RING    4096  /* records, must be a power of 2 */
+#define LOG_TEXTLEN 128   /* longest message of verbose() via the ring */
+#define LOG_TIMELEN 32    /* "YYYY-MM-DD HH:MM:SS.uuuuuu " */
+
+/* events logged by log_event() */
+#define LOGEV_TEXT  0     /* a message of verbose() */
+#define LOGEV_KNOWN 1     /* datagram of a known client forwarded */
+#define LOGEV_NEW   2     /* datagram of a new client forwarded */
+#define LOGEV_AGED  3     /* session closed after TIMEOUT */
+
+/* an address in a log record, port in network byte order */
+struct _logaddr_t {
+  uint16_t family;
+  uint16_t port;
+  uint8_t addr[16];
+};
+typedef struct _logaddr_t logaddr_t;
+
+/* what the loop hands over to the log thread, formatted there */
+struct _logrec_t {
+  uint64_t us;              /* when it happened, loop clock (CLOCK_MONOTONIC) */
+  int event;
+  uint32_t len;             /* datagram size, see log_event() */
+  union {
+    struct {
+      logaddr_t src;
+      logaddr_t dst;
+      logaddr_t bind;
+    } addr;
+    char text[LOG_TEXTLEN];
+  } u;
+};
+typedef struct _logrec_t logrec_t;
 
 extern int VERBOSE;
 extern int FORKED;
+extern int LOGRATE;
+extern int LOGEVERY;
 
 void verbose(const char * fmt, ...);
 
+int  log_start();
+void log_stop();
+void log_tick(uint64_t us);
+void log_event(int event, struct sockaddr *src, struct sockaddr *dst,
+               struct sockaddr *bind, size_t len);
+
 #endif
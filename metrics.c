@@ -0,0 +1,420 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "metrics.h"
+
+/*
+  The metrics endpoint (--metrics), answers every HTTP request with the
+  counters of stats.h in the Prometheus text format, e.g.:
+
+    curl http://127.0.0.1:9100/metrics
+    curl --unix-socket /var/run/udpxd.metrics http://localhost/metrics
+
+  Every worker counts into its own slot of a shared mapping (see
+  stats_init()), so the forwarding path needs no locks. The socket is
+  created before the workers are forked, whichever of them accepts a
+  connection reports the slots of all, labeled with worker="n". Values
+  may be a few datagrams apart from each other, as they are read while
+  being updated.
+*/
+
+static int metrics_socket = -1;
+static int metrics_evtype = EV_METRICS;  /* registered for the listening socket */
+static metricsconn_t *conns = NULL;
+static int nconns = 0;
+
+/* one sample, consecutive entries with the same name are one metric */
+struct _metric_t {
+  const char *name;
+  const char *type;
+  const char *help;
+  const char *labels;
+  size_t offset;            /* of the value in stats_t */
+};
+typedef struct _metric_t metric_t;
+
+#define M(name, type, help, labels, field) { name, type, help, labels, offsetof(stats_t, field) }
+
+static const metric_t metrics[] = {
+  M("udpxd_received_datagrams_total", "counter", "Datagrams received.",
+    "direction=\"in\"", fwd_rx_pkts),
+  M("udpxd_received_datagrams_total", "counter", NULL, "direction=\"out\"", rep_rx_pkts),
+  M("udpxd_received_bytes_total", "counter", "Bytes received.",
+    "direction=\"in\"", fwd_rx_bytes),
+  M("udpxd_received_bytes_total", "counter", NULL, "direction=\"out\"", rep_rx_bytes),
+  M("udpxd_sent_datagrams_total", "counter", "Datagrams sent.",
+    "direction=\"in\"", fwd_tx_pkts),
+  M("udpxd_sent_datagrams_total", "counter", NULL, "direction=\"out\"", rep_tx_pkts),
+  M("udpxd_sent_bytes_total", "counter", "Bytes sent.",
+    "direction=\"in\"", fwd_tx_bytes),
+  M("udpxd_sent_bytes_total", "counter", NULL, "direction=\"out\"", rep_tx_bytes),
+  M("udpxd_send_errors_total", "counter", "Datagrams which could not be sent.",
+    "direction=\"in\"", fwd_errors),
+  M("udpxd_send_errors_total", "counter", NULL, "direction=\"out\"", rep_errors),
+  M("udpxd_syscalls_total", "counter", "Receive and send syscalls.",
+    "direction=\"in\",call=\"recv\"", fwd_rx_calls),
+  M("udpxd_syscalls_total", "counter", NULL, "direction=\"in\",call=\"send\"", fwd_tx_calls),
+  M("udpxd_syscalls_total", "counter", NULL, "direction=\"out\",call=\"recv\"", rep_rx_calls),
+  M("udpxd_syscalls_total", "counter", NULL, "direction=\"out\",call=\"send\"", rep_tx_calls),
+  M("udpxd_stray_datagrams_total", "counter",
+    "Answers from an address other than the session's destination.", "", rep_stray),
+  M("udpxd_sessions_total", "counter", "Sessions created and closed.",
+    "event=\"created\"", sess_new),
+  M("udpxd_sessions_total", "counter", NULL, "event=\"expired\"", sess_expired),
+  M("udpxd_sessions_total", "counter", NULL, "event=\"closed\"", sess_closed),
+  M("udpxd_sessions_total", "counter", NULL, "event=\"refused\"", sess_refused),
+  M("udpxd_sessions", "gauge", "Sessions in use.", "", pool_used),
+  M("udpxd_sessions_allocated", "gauge", "Sessions allocated.", "", pool_total),
+  M("udpxd_sockets_total", "counter", "Outgoing sockets of new sessions.",
+    "kind=\"prebound\"", sock_warm),
+  M("udpxd_sockets_total", "counter", NULL, "kind=\"created\"", sock_cold),
+  M("udpxd_queue_datagrams_total", "counter", "Datagrams waiting for a full socket buffer.",
+    "event=\"queued\"", q_queued),
+  M("udpxd_queue_datagrams_total", "counter", NULL, "event=\"flushed\"", q_flushed),
+  M("udpxd_queue_datagrams_total", "counter", NULL, "event=\"dropped\"", q_dropped),
+  M("udpxd_queue_waiting", "gauge", "Buffers waiting in queues.", "", q_waiting),
+  M("udpxd_gro_buffers_total", "counter", "Buffers received holding several datagrams.",
+    "", gro_bufs),
+  M("udpxd_gso_split_total", "counter", "Such buffers sent one datagram at a time.",
+    "", gso_split),
+  M("udpxd_ring_enters_total", "counter", "io_uring_enter() syscalls.", "", ring_enters),
+};
+
+static const metric_t histograms[] = {
+  M("udpxd_response_seconds", "histogram",
+    "Time from a forward to the first answer of a session.", "", rtt),
+  M("udpxd_loop_busy_seconds", "histogram",
+    "Time spent handling the sockets ready at once.", "", busy),
+};
+
+/* parse ip:port, [ip]:port or a port, which listens on localhost */
+static host_t *metrics_host(const char *addr) {
+  char *ip = strdup(addr);
+  char *port;
+  host_t *host = NULL;
+
+  if((port = strrchr(ip, ':')) == NULL) {
+    free(ip);
+    return get_host("127.0.0.1", atoi(addr), NULL);
+  }
+
+  *port++ = '\0';
+  if(ip[0] == '[' && ip[strlen(ip) - 1] == ']') {
+    ip[strlen(ip) - 1] = '\0';
+    host = get_host(ip + 1, atoi(port), NULL);
+  }
+  else
+    host = get_host(ip, atoi(port), NULL);
+
+  free(ip);
+  return host;
+}
+
+/* create the metrics socket, a UNIX socket if addr starts with a slash,
+   a TCP socket otherwise. Must be called before dropping privileges. */
+int metrics_bind(const char *addr) {
+  struct sockaddr_un sun;
+  struct stat st;
+  host_t *host = NULL;
+  mode_t mask;
+  int fd, one = 1;
+
+  if(addr[0] == '/') {
+    memset(&sun, 0, sizeof(sun));
+    if(strlen(addr) >= sizeof(sun.sun_path)) {
+      fprintf(stderr, "metrics socket path is too long: %s\n", addr);
+      return -1;
+    }
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, addr, sizeof(sun.sun_path) - 1);
+
+    /* left over from a previous run, but don't remove anything else */
+    if(stat(addr, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(addr);
+
+    /* see ctl_bind(), no access for others from the start */
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mask = umask(007);
+    if(fd >= 0 && bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+      close(fd);
+      fd = -1;
+    }
+    umask(mask);
+    if(fd >= 0 && chmod(addr, 0660) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  else {
+    if((host = metrics_host(addr)) == NULL)
+      return -1;
+    fd = socket(host->is_v6 ? PF_INET6 : PF_INET, SOCK_STREAM, 0);
+    if(fd >= 0) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if(bind(fd, host_sa(host), host->size) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    host_clean(host);
+  }
+
+  if(fd < 0 || listen(fd, METRICS_CONNS) != 0) {
+    fprintf(stderr, "Cannot create metrics socket %s\n", addr);
+    perror(NULL);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
+
+/* serve the metrics socket fd created by metrics_bind(), -1 if none */
+void metrics_init(int fd) {
+  metrics_socket = fd;
+  if(fd >= 0 && ev_add(fd, EV_READ, &metrics_evtype) != 0)
+    perror("unable to watch metrics socket");
+}
+
+static void metrics_close(metricsconn_t *c) {
+  metricsconn_t **p;
+
+  for(p = &conns; *p != NULL; p = &(*p)->next) {
+    if(*p == c) {
+      *p = c->next;
+      break;
+    }
+  }
+
+  ev_del(c->socket);
+  close(c->socket);
+  free(c->out);
+  free(c);
+  nconns--;
+}
+
+/* the socket is shared with the other workers, it stays where it is */
+void metrics_done() {
+  while(conns != NULL)
+    metrics_close(conns);
+
+  if(metrics_socket >= 0) {
+    ev_del(metrics_socket);
+    close(metrics_socket);
+  }
+  metrics_socket = -1;
+}
+
+static void metrics_accept() {
+  metricsconn_t *c;
+  int fd;
+
+  while((fd = accept(metrics_socket, NULL, NULL)) >= 0) {
+    if(nconns >= METRICS_CONNS || (c = calloc(1, sizeof(metricsconn_t))) == NULL) {
+      close(fd);
+      continue;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    c->evtype = EV_METRICS;
+    c->socket = fd;
+    if(ev_add(fd, EV_READ, c) != 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+
+    c->next = conns;
+    conns = c;
+    nconns++;
+  }
+}
+
+/* append to the answer, returns -1 if out of memory */
+static int metrics_printf(metricsconn_t *c, const char *fmt, ...) {
+  va_list ap;
+  char *out;
+  int len;
+
+  for(;;) {
+    va_start(ap, fmt);
+    len = vsnprintf(c->out + c->outlen, c->outsize - c->outlen, fmt, ap);
+    va_end(ap);
+
+    if(len < 0)
+      return -1;
+    if((size_t)len < c->outsize - c->outlen)
+      break;
+
+    if((out = realloc(c->out, c->outsize * 2)) == NULL)
+      return -1;
+    c->out = out;
+    c->outsize *= 2;
+  }
+
+  c->outlen += len;
+  return 0;
+}
+
+/* the value a metric has for worker n */
+static uint64_t metrics_value(const metric_t *m, int n) {
+  return *(uint64_t *)((char *)stats_slot(n) + m->offset);
+}
+
+/* help and type, once per metric */
+static int metrics_header(metricsconn_t *c, const metric_t *m) {
+  if(m->help == NULL)
+    return 0;
+  return metrics_printf(c, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help, m->name, m->type);
+}
+
+static int metrics_hist(metricsconn_t *c, const metric_t *m, int n) {
+  hist_t *h = (hist_t *)((char *)stats_slot(n) + m->offset);
+  uint64_t sum = 0, total;
+  int i;
+
+  for(i=0; i<STATS_HIST_BUCKETS - 1; i++) {
+    sum += h->count[i];
+    if(metrics_printf(c, "%s_bucket{worker=\"%d\",le=\"%g\"} %llu\n", m->name, n,
+                      (double)stats_hist_bound(i) / 1e6, (unsigned long long)sum) != 0)
+      return -1;
+  }
+
+  /* the counts may be updated while we read them */
+  total = h->total > sum + h->count[i] ? h->total : sum + h->count[i];
+  return metrics_printf(c, "%s_bucket{worker=\"%d\",le=\"+Inf\"} %llu\n"
+                        "%s_sum{worker=\"%d\"} %g\n%s_count{worker=\"%d\"} %llu\n",
+                        m->name, n, (unsigned long long)total,
+                        m->name, n, (double)h->sum / 1e6,
+                        m->name, n, (unsigned long long)total);
+}
+
+/* the response to a request, returns -1 if out of memory */
+static int metrics_render(metricsconn_t *c) {
+  const char *status = "200 OK";
+  char head[256];
+  size_t i, headlen;
+  int n, err = 0;
+
+  c->outsize = 16384;
+  if((c->out = malloc(c->outsize)) == NULL)
+    return -1;
+
+  /* anything but GET / and GET /metrics is unknown */
+  if(strncmp(c->in, "GET / ", 6) != 0 && strncmp(c->in, "GET /metrics ", 13) != 0) {
+    status = "404 Not Found";
+    err = metrics_printf(c, "not found, try /metrics\n");
+  }
+  else {
+    for(i=0; i<sizeof(metrics) / sizeof(metrics[0]) && !err; i++) {
+      err = metrics_header(c, &metrics[i]);
+      for(n=0; n<stats_slots() && !err; n++)
+        err = metrics_printf(c, "%s{%s%sworker=\"%d\"} %llu\n", metrics[i].name,
+                             metrics[i].labels, metrics[i].labels[0] ? "," : "", n,
+                             (unsigned long long)metrics_value(&metrics[i], n));
+    }
+
+    for(i=0; i<sizeof(histograms) / sizeof(histograms[0]) && !err; i++) {
+      err = metrics_header(c, &histograms[i]);
+      for(n=0; n<stats_slots() && !err; n++)
+        err = metrics_hist(c, &histograms[i], n);
+    }
+  }
+
+  if(err)
+    return -1;
+
+  /* put the header in front, now that we know the length */
+  headlen = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %lu\r\n"
+                     "Connection: close\r\n\r\n", status, (unsigned long)c->outlen);
+  if(metrics_printf(c, "%s", head) != 0)
+    return -1;
+  memmove(c->out + headlen, c->out, c->outlen - headlen);
+  memcpy(c->out, head, headlen);
+
+  return 0;
+}
+
+/* send what we can, returns 1 when done, -1 if the connection is broken */
+static int metrics_send(metricsconn_t *c) {
+  ssize_t len;
+
+  while(c->outoff < c->outlen) {
+    len = send(c->socket, c->out + c->outoff, c->outlen - c->outoff, MSG_NOSIGNAL);
+    if(len < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    c->outoff += len;
+  }
+
+  return 1;
+}
+
+/* called by the loop if the metrics socket or a connection is ready */
+void metrics_handle(void *data, int events) {
+  metricsconn_t *c = (metricsconn_t *)data;
+  ssize_t len;
+
+  if(data == &metrics_evtype) {
+    metrics_accept();
+    return;
+  }
+
+  if(c->out == NULL) {
+    if(! (events & (EV_READ | EV_ERROR)))
+      return;
+
+    len = recv(c->socket, c->in + c->inlen, METRICS_INLEN - 1 - c->inlen, 0);
+    if(len <= 0) {
+      if(len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        metrics_close(c);
+      return;
+    }
+    c->inlen += len;
+    c->in[c->inlen] = '\0';
+
+    /* wait for the end of the request header, unless it does not fit */
+    if(strstr(c->in, "\r\n\r\n") == NULL && strstr(c->in, "\n\n") == NULL
+       && c->inlen < METRICS_INLEN - 1)
+      return;
+
+    if(metrics_render(c) != 0) {
+      metrics_close(c);
+      return;
+    }
+  }
+
+  switch(metrics_send(c)) {
+  case 0:
+    ev_mod(c->socket, EV_WRITE, c);
+    break;
+  default:
+    metrics_close(c);
+  }
+}
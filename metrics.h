@@ -0,0 +1,69 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_METRICS_H
+#define _HAVE_METRICS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/fcntl.h>
+
+#include "host.h"
+#include "event.h"
+#include "stats.h"
+
+#define METRICS_CONNS  8      /* scrapes at the same time, per worker */
+#define METRICS_INLEN  2048   /* longest request we wait for */
+
+/* a connection to the metrics socket, reads one request, answers it
+   and closes */
+struct _metricsconn_t {
+  int evtype;               /* EV_METRICS, must be first, see event.h */
+  int socket;
+  char in[METRICS_INLEN];   /* request received so far */
+  size_t inlen;
+  char *out;                /* answer, NULL until the request is complete */
+  size_t outlen;
+  size_t outsize;
+  size_t outoff;            /* bytes of out already sent */
+  struct _metricsconn_t *next;
+};
+typedef struct _metricsconn_t metricsconn_t;
+
+extern char *METRICS;
+
+int  metrics_bind(const char *addr);
+void metrics_init(int fd);
+void metrics_done();
+void metrics_handle(void *data, int events);
+
+#endif
@@ -23,43 +23,34 @@
 #include "client.h"
 #include "host.h"
 #include "log.h"
+#include "worker.h"
+#include "uring.h"
+#include "metrics.h"
+#include "shm.h"
+#include "health.h"
 
 
 
-/* called each time when the loop restarts to feed select() correctly */
-int fill_set(fd_set *fds) {
-  int max = 0;
-
-  client_t *current = NULL;
-  client_iter(clients, current) {
-    if (current->socket < (int)FD_SETSIZE) {
-      if (current->socket > max)
-        max = current->socket;
-      FD_SET(current->socket, fds);
-    }
-    else {
-      fprintf(stderr, "skipped client, socket too large!\n");
-    }
-  }
-
-  return max;
+/* monotonic clock in milliseconds */
+uint64_t clock_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-/* return file handle ready to read */
-int get_sender(fd_set *fds) {
-    int i = 0;
-
-    while(!FD_ISSET(i, fds))
-        i++;
-
-    return i;
+/* monotonic clock in microseconds */
+uint64_t clock_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-
-/* bind to a socket, either for listen() or for outgoing src ip binding */
-int bindsocket( host_t *sock_h) {
+/* bind to a socket, either for listen() or for outgoing src ip binding,
+   reuseport is used for the listen sockets of --workers */
+int bindsocket( host_t *sock_h, int reuseport) {
   int fd;
   int err = 0;
+  int one = 1;
 
   if(sock_h->is_v6) {
     fd = socket( PF_INET6, SOCK_DGRAM, IPPROTO_UDP );
@@ -68,12 +59,30 @@ int bindsocket( host_t *sock_h) {
     fd = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
   }
 
-  if( ! ( fd >= 0 && -1 != bind( fd, (struct sockaddr*)sock_h->sock, sock_h->size ) ) ) {
+#ifdef SO_REUSEPORT
+  if(fd >= 0 && reuseport) {
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+      perror("unable to set SO_REUSEPORT");
+  }
+#else
+  (void)one;
+  (void)reuseport;
+#endif
+
+  if( ! ( fd >= 0 && -1 != bind( fd, host_sa(sock_h), sock_h->size ) ) ) {
     err = 1;
   }
 
+  /* never block the loop on a full socket buffer, see queue.c */
+  if(!err && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    err = 1;
+
+  /* receive runs of datagrams as one buffer, if the kernel can do it */
+  if(!err && GSO)
+    batch_gro(fd);
+
   if(err) {
-    fprintf( stderr, "Cannot bind address ([%s]:%d)\n", sock_h->ip, sock_h->port );
+    fprintf( stderr, "Cannot bind address (%s:%d)\n", host_ip(sock_h), sock_h->port );
     perror(NULL);
     return -1;
   }
@@ -81,6 +90,64 @@ int bindsocket( host_t *sock_h) {
   return fd;
 }
 
+/*
+  Attach  a  classic  BPF  program  to  a  reuseport  group  of  n  listen
+  sockets, which selects the socket by a hash of the source address and
+  port of a datagram. The hash  only depends on the client, so it always
+  ends up at the same worker. Handles v4 and v6 (without extension
+  headers), v4 is also recognized on dual stack v6 sockets.
+*/
+int reuseport_steer(int fd, int n) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  struct sock_filter code[] = {
+    /* A = ip version */
+    { BPF_LD  | BPF_B | BPF_ABS,  0, 0, SKF_NET_OFF },
+    { BPF_ALU | BPF_RSH | BPF_K,  0, 0, 4 },
+    { BPF_JMP | BPF_JEQ | BPF_K,  0, 5, 4 },
+    /* v4: X = src port, A = src address */
+    { BPF_LDX | BPF_B | BPF_MSH,  0, 0, SKF_NET_OFF },
+    { BPF_LD  | BPF_H | BPF_IND,  0, 0, SKF_NET_OFF },
+    { BPF_MISC| BPF_TAX,          0, 0, 0 },
+    { BPF_LD  | BPF_W | BPF_ABS,  0, 0, SKF_NET_OFF + 12 },
+    { BPF_JMP | BPF_JA,           0, 0, 12 },
+    /* v6: X = src port, xor all 4 words of the src address */
+    { BPF_LD  | BPF_H | BPF_ABS,  0, 0, SKF_NET_OFF + 40 },
+    { BPF_MISC| BPF_TAX,          0, 0, 0 },
+    { BPF_LD  | BPF_W | BPF_ABS,  0, 0, SKF_NET_OFF + 8 },
+    { BPF_ALU | BPF_XOR | BPF_X,  0, 0, 0 },
+    { BPF_MISC| BPF_TAX,          0, 0, 0 },
+    { BPF_LD  | BPF_W | BPF_ABS,  0, 0, SKF_NET_OFF + 12 },
+    { BPF_ALU | BPF_XOR | BPF_X,  0, 0, 0 },
+    { BPF_MISC| BPF_TAX,          0, 0, 0 },
+    { BPF_LD  | BPF_W | BPF_ABS,  0, 0, SKF_NET_OFF + 16 },
+    { BPF_ALU | BPF_XOR | BPF_X,  0, 0, 0 },
+    { BPF_MISC| BPF_TAX,          0, 0, 0 },
+    { BPF_LD  | BPF_W | BPF_ABS,  0, 0, SKF_NET_OFF + 20 },
+    /* A = (A ^ X) * golden ratio >> 16, return A % n */
+    { BPF_ALU | BPF_XOR | BPF_X,  0, 0, 0 },
+    { BPF_ALU | BPF_MUL | BPF_K,  0, 0, 0x9e3779b1 },
+    { BPF_ALU | BPF_RSH | BPF_K,  0, 0, 16 },
+    { BPF_ALU | BPF_MOD | BPF_K,  0, 0, (uint32_t)n },
+    { BPF_RET | BPF_A,            0, 0, 0 },
+  };
+  struct sock_fprog prog;
+
+  prog.len    = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+
+  if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+    perror("SO_ATTACH_REUSEPORT_CBPF");
+    return -1;
+  }
+
+  return 0;
+#else
+  (void)fd;
+  (void)n;
+  return -1;
+#endif
+}
+
 /*
   returns:
  -1: error in any case
@@ -185,9 +252,75 @@ int drop_privileges(char *user, char *chrootdir) {
   return 0;
 }
 
-int start_listener (char *inip, char *inpt, char *srcip, char *srcpt, char *dstip,
-                    char *dstpt, char *pidfile, char *chrootdir, char *user) {
-  host_t *listen_h, *dst_h, *bind_h;
+/* a forwarding setup sending to the destinations of dsts, dst_off is
+   added to their ports, and binding to the addresses of binds. Both
+   may be shared with other setups. The limits are the defaults, see
+   config.c for others. */
+listener_t *listener_new(char *inip, char *inpt, dstset_t *dsts, int dst_off, bindset_t *binds) {
+  listener_t *listener = malloc(sizeof(listener_t));
+
+  if(listener == NULL)
+    return NULL;
+
+  listener->evtype   = EV_LISTEN;
+  listener->socket   = -1;
+  listener->id       = 0;
+  listener->listen_h = get_host(inip, atoi(inpt), NULL);
+  listener->dsts     = dstset_ref(dsts);
+  listener->dst_off  = dst_off;
+  listener->binds    = bindset_ref(binds);
+  listener->timeout  = TIMEOUT;
+  listener->limit    = 0;
+  listener->prebind  = PREBIND;
+  listener->sessions = 0;
+  listener->txq      = NULL;
+  listener->sockets  = NULL;
+  listener->next     = NULL;
+
+  return listener;
+}
+
+void listener_free(listener_t *listener) {
+  bindset_free(listener->binds);
+  host_clean(listener->listen_h);
+  dstset_free(listener->dsts);
+  free(listener->sockets);
+  free(listener);
+}
+
+/* the listener on addr, NULL if there is none */
+listener_t *listener_find(struct sockaddr *addr) {
+  listener_t *l;
+
+  for(l = listeners; l != NULL; l = l->next) {
+    if(host_is(l->listen_h, addr))
+      return l;
+  }
+
+  return NULL;
+}
+
+/* make room for n listen sockets, the preallocated sessions and a few
+   more, if the hard limit allows it */
+static void nofile_raise(int n) {
+  struct rlimit rl;
+  rlim_t want = (rlim_t)n + SESSIONS + 64;
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= want)
+    return;
+
+  rl.rlim_cur = (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < want) ? rl.rlim_max : want;
+  if(setrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur < want)
+    fprintf(stderr, "only %lu file descriptors allowed, %d listen sockets may not fit\n",
+            (unsigned long)rl.rlim_cur, n);
+}
+
+/* serve the forwarding setups in list, returns when udpxd is done */
+int start_listeners(listener_t *list, char *pidfile, char *chrootdir, char *user) {
+  server_t server;
+  listener_t *l;
+  bindset_t *bs;
+  int id = 0, i;
 
   int dm = daemonize(pidfile);
   switch(dm) {
@@ -202,41 +335,63 @@ int start_listener (char *inip, char *inpt, char *srcip, char *srcpt, char *dsti
   case 2:
     break;    /* child, fork ok, continue */
   }
-  
-  listen_h = get_host(inip, atoi(inpt), NULL, NULL);
-  dst_h    = get_host(dstip, atoi(dstpt), NULL, NULL);
-  bind_h   = NULL;
 
-  if(srcip != NULL) {
-    bind_h   = get_host(srcip, atoi(srcpt), NULL, NULL);
-  }
-  else {
-    if(dst_h->is_v6)
-      bind_h = get_host("::0", 0, NULL, NULL);
-    else
-      bind_h = get_host("0.0.0.0", 0, NULL, NULL);
-  }
+  server.listeners = list;
+  server.ctl       = -1;
+  server.ctlpath   = CONTROL;
+  server.metrics   = -1;
+  server.worker    = 0;
+
+  for(l = list; l != NULL; l = l->next)
+    l->id = id++;
 
-  int listen = bindsocket(listen_h);
+  /* the master keeps the listen sockets of all workers */
+  nofile_raise(id * WORKERS);
 
-  if(listen == -1)
+  /* shared by the workers, so any of them can report all counters */
+  if(stats_init(WORKERS > 1 ? WORKERS : 1) != 0)
+    return 1;
+  if(METRICS != NULL && (server.metrics = metrics_bind(METRICS)) < 0)
+    return 1;
+  if(SHM != NULL && shm_create(SHM, WORKERS > 1 ? WORKERS : 1) != 0)
     return 1;
 
+  if(WORKERS > 1) {
+    if(workers_bind(&server) != 0)
+      return 1;
+  }
+  else {
+    for(l = list; l != NULL; l = l->next) {
+      l->socket = bindsocket(l->listen_h, 0);
+      if(l->socket == -1)
+        return 1;
+    }
+    if(CONTROL != NULL && (server.ctl = ctl_bind(CONTROL)) < 0)
+      return 1;
+  }
+
   if(VERBOSE) {
-    verbose("Listening on %s:%s, forwarding to %s:%s",
-            listen_h->ip, inpt, dst_h->ip, dstpt);
-    if(srcip != NULL)
-      verbose(", binding to %s\n", bind_h->ip);
-    else
+    for(l = list; l != NULL; l = l->next) {
+      verbose("Listening on %s:%d, forwarding to", host_ip(l->listen_h), l->listen_h->port);
+      for(i=0; i<l->dsts->count; i++)
+        verbose("%s %s:%d", i == 0 ? "" : ",", host_ip(l->dsts->ups[i].host),
+                l->dsts->ups[i].host->port + l->dst_off);
+      bs = l->binds;
+      for(i=0; i<bs->count; i++) {
+        if(i == 0 && bs->count == 1 && host_is_any(bs->hosts[0]))
+          break;
+        verbose(i == 0 ? ", binding to %s" : ", %s", host_ip(bs->hosts[i]));
+        if(bs->hi > bs->hosts[i]->port)
+          verbose(":%d-%d", bs->hosts[i]->port, bs->hi);
+        else if(bs->hi)
+          verbose(":%d", bs->hi);
+      }
       verbose("\n");
+    }
   }
 
-  if(drop_privileges(user, chrootdir) != 0) {
-    host_clean(bind_h);
-    host_clean(listen_h);
-    host_clean(dst_h);
+  if(drop_privileges(user, chrootdir) != 0)
     return 1;
-  }
 
   if (dm) {
     close(STDIN_FILENO);
@@ -244,204 +399,839 @@ int start_listener (char *inip, char *inpt, char *srcip, char *srcpt, char *dsti
     close(STDERR_FILENO);
   }
     
-  main_loop(listen, listen_h, bind_h, dst_h);
-
-  host_clean(bind_h);
-  host_clean(listen_h);
-  host_clean(dst_h);
+  if(WORKERS > 1)
+    workers_run(&server);
+  else {
+    main_loop(&server);
+    shm_remove();
+  }
 
   closelog();
 
   return 0;
 }
 
-/* handle new or known incoming requests */
-void handle_inside(int inside, host_t *listen_h, host_t *bind_h, host_t *dst_h) {
-  int len;
-  unsigned char buffer[MAX_BUFFER_SIZE];
-  void *src;
+/* receive slots, shared by all sockets during one loop iteration */
+static pkt_t *rx = NULL;
+static int rx_used = 0;
+
+static txbatch_t *tx_fwd = NULL;   /* forwards to dst, via outgoing sockets */
+static txbatch_t *tx_rep = NULL;   /* answers to clients, via the listen socket */
+
+/* the forwarding setups main_loop() runs for */
+listener_t *listeners = NULL;
+
+/* bind addresses whose sockpools need a refill at the end of the iteration */
+static bindset_t *drained = NULL;
+
+/* when the loop woke up, in microseconds */
+static uint64_t loop_us = 0;
+
+/* send everything queued, after that the receive slots are free again */
+static void tx_flush() {
+  txbatch_flush(tx_fwd);
+  txbatch_flush(tx_rep);
+  rx_used = 0;
+}
+
+/* get at least want free receive slots, *max is set to the number available */
+static pkt_t *rx_reserve(int want, int *max) {
+  if(BATCH - rx_used < want)
+    tx_flush();
+  *max = BATCH - rx_used;
+  return &rx[rx_used];
+}
+
+static void fwd_error(txbatch_t *tx, void *owner, int err) {
+  (void)tx; (void)owner;
+  STATS->fwd_errors++;
+  fprintf(stderr, "unable to forward to destination: %s\n", strerror(err));
+}
+
+static void rep_error(txbatch_t *tx, void *owner, int err) {
+  (void)tx;
+  STATS->rep_errors++;
+  fprintf(stderr, "unable to send back to client: %s\n", strerror(err)); /* FIXME: add src+port */
+  /* the socket of the client might be queued for forwarding as well */
+  txbatch_flush(tx_fwd);
+  if(((client_t *)owner)->socket >= 0) /* not already closed by a previous error */
+    client_close((client_t *)owner);
+}
+
+/* queue a datagram which could not be sent without blocking, the
+   socket is watched for writability until the queue is empty again */
+static void tx_wait(txqueue_t **q, int fd, void *owner, struct sockaddr *to, socklen_t tolen,
+                    void *buf, size_t len, size_t gso) {
+  int rep = *(int *)owner == EV_LISTEN;
+
+  if(QUEUE == 0) {
+    STATS->q_dropped += batch_segments(len, gso);
+    return;
+  }
+
+  if(*q == NULL && (*q = txqueue_new(fd, QUEUE, rep ? &STATS->rep_tx_pkts : &STATS->fwd_tx_pkts,
+                                     rep ? &STATS->rep_tx_bytes : &STATS->fwd_tx_bytes)) == NULL) {
+    STATS->q_dropped += batch_segments(len, gso);
+    return;
+  }
+
+  if((*q)->count == 0 && ev_mod(fd, EV_READ | EV_WRITE, owner) != 0)
+    perror("unable to watch socket for writing");
+
+  txqueue_push(*q, to, tolen, buf, len, gso);
+}
+
+/* the socket of q is writable again, send what is waiting */
+static void tx_drain(txqueue_t *q, void *owner, const char *what) {
+  while(txqueue_flush(q) < 0) {
+    if(*(int *)owner == EV_LISTEN)
+      STATS->rep_errors++;
+    else
+      STATS->fwd_errors++;
+    fprintf(stderr, "unable to %s: %s\n", what, strerror(errno));
+  }
+
+  if(q->count == 0 && ev_mod(q->fd, EV_READ, owner) != 0)
+    perror("unable to watch socket");
+}
+
+static void fwd_blocked(txbatch_t *tx, void *owner, struct msghdr *msg, size_t gso) {
+  client_t *client = (client_t *)owner;
+  (void)tx;
+  tx_wait(&client->txq, client->socket, client, msg->msg_name, msg->msg_namelen,
+          msg->msg_iov->iov_base, msg->msg_iov->iov_len, gso);
+}
+
+static void rep_blocked(txbatch_t *tx, void *owner, struct msghdr *msg, size_t gso) {
+  listener_t *listener = ((client_t *)owner)->listener;
+  (void)tx;
+  tx_wait(&listener->txq, listener->socket, listener, msg->msg_name, msg->msg_namelen,
+          msg->msg_iov->iov_base, msg->msg_iov->iov_len, gso);
+}
+
+/* number of datagrams received in one buffer, see UDP_GRO */
+static int rx_count(pkt_t *pkt) {
+  if(pkt->gso == 0)
+    return 1;
+  STATS->gro_bufs++;
+  return batch_segments(pkt->len, pkt->gso);
+}
+
+/* send the forwards queued so far, before their sockets get closed */
+static void fwd_flush() {
+  if(ENGINE == ENGINE_URING)
+    uring_submit();
+  else
+    txbatch_flush(tx_fwd);
+}
+
+/* from now on the session sends to up */
+static void client_route(client_t *client, listener_t *listener, upstream_t *up) {
+  client->upstream = *up->host;
+  host_port(&client->upstream, up->host->port + listener->dst_off);
+  client->up = up;
+  up->sessions++;
+}
+
+/* find or create the client a datagram from the inside belongs to,
+   returns NULL if it has to be dropped */
+static client_t *inside_client(listener_t *listener, pkt_t *pkt) {
+  bindset_t *binds = listener->binds;
+  sockpool_t *sp;
   client_t *client;
-  host_t *src_h;
   int output;
-  size_t size = listen_h->size;
+  uint16_t port;
+  host_t local;
+
+  /* do we know it ? */
+  client = client_find_addr(listener->id, (struct sockaddr *)&pkt->addr);
+  if(client != NULL) {
+    /* its destination was ejected, fail over to a healthy one */
+    if(client->up->down && listener->dsts->healthy > 0) {
+      upstream_done(client->up, client->waiting != 0);
+      client->waiting = 0;
+      client_route(client, listener, dstset_pick(listener->dsts, (struct sockaddr *)&pkt->addr));
+    }
 
-  src = malloc(size);
-  
-  len = recvfrom( inside, buffer, sizeof( buffer ), 0,
-                  (struct sockaddr*)src, (socklen_t *)&size );
+    /* yes, we know it, send req out via existing bind socket */
+    if(VERBOSE)
+      log_event(LOGEV_KNOWN, (struct sockaddr *)&pkt->addr, host_sa(&client->upstream),
+                host_sa(client->sockpool->bind_h), pkt->len);
+  }
+  else {
+    /* unknown client, open new out socket */
+    if (binds->hosts[0]->port && ! binds->hi && listener->sessions > 0) {
+      /* the sockets of the clients we are going to close may be queued */
+      fwd_flush();
+      client_clean_owner(listener->id);
+      if(ENGINE == ENGINE_URING)
+        uring_sync(); /* release the port */
+    }
+    else if(listener->limit && listener->sessions >= listener->limit) {
+      STATS->sess_refused++;
+      return NULL;
+    }
 
-  if(len > 0) {
-    if(listen_h->is_v6)
-      src_h = get_host(NULL, 0, NULL, (struct sockaddr_in6 *)src);
-    else
-      src_h = get_host(NULL, 0, (struct sockaddr_in *)src, NULL);
-    /* do we know it ? */
-    client = client_find_src(src_h);
-    if(client != NULL) {
-      /* yes, we know it, send req out via existing bind socket */
-      verbose("Client %s:%d is known, forwarding %d bytes to %s:%d ",
-              src_h->ip, src_h->port, len, dst_h->ip, dst_h->port);
-      verb_prbind(bind_h);
-
-      if(sendto(client->socket, buffer, len, 0, (struct sockaddr*)dst_h->sock, dst_h->size) < 0) {
-        fprintf(stderr, "unable to forward to %s:%d\n", dst_h->ip, dst_h->port);
-        perror(NULL);
-      }
-      else {
-        client_seen(client);
-      }
-      host_clean(src_h);
+    output = bindset_get(binds, &sp, &port);
+    if (output < 0) {
+      if(errno == EADDRNOTAVAIL)
+        STATS->sess_refused++; /* all ports of the bind range(s) in use */
+      return NULL;
     }
-    else {
-      /* unknown client, open new out socket */
-      verbose("Client %s:%d is unknown, forwarding %d bytes to %s:%d ",
-              src_h->ip, src_h->port, len, dst_h->ip, dst_h->port);
-      verb_prbind(bind_h);
-
-      if (bind_h->port)
-        client_clean(1);
-      output = bindsocket(bind_h);
-      if (output >= 0) {
-        /* send req out */
-        if(sendto(output, buffer, len, 0, (struct sockaddr*)dst_h->sock, dst_h->size) < 0) {
-            fprintf(stderr, "unable to forward to %s:%d\n", dst_h->ip, dst_h->port);
-            perror(NULL);
-        }
-        else {
-          size = listen_h->size;
-          host_t *ret_h;
-          if(listen_h->is_v6) {
-            struct sockaddr_in6 *ret = malloc(size);
-            getsockname(output, (struct sockaddr*)ret, (socklen_t *)&size);
-            ret_h = get_host(NULL, 0, NULL, ret);
-            free(ret);
-            client = client_new(output, src_h, ret_h);
-          }
-          else {
-            struct sockaddr_in *ret = malloc(size);
-            getsockname(output, (struct sockaddr*)ret, (socklen_t *)&size);
-            ret_h = get_host(NULL, 0, ret, NULL);
-            free(ret);
-            client = client_new(output, src_h, ret_h);
-          }
-
-          client_add(client);
-        }
-      }
-      else {
-        host_clean(src_h);
-      }
+
+
+    if(! binds->drained) {
+      binds->drained = 1;
+      binds->refill  = drained;
+      drained = binds;
     }
+
+    /* the local address is the bind address with the port of the socket */
+    local = *sp->bind_h;
+    host_port(&local, port);
+
+    client = client_new(output, (struct sockaddr *)&pkt->addr, host_sa(&local),
+                        sp, listener->id, listener->timeout);
+    if(client == NULL) {
+      fprintf(stderr, "unable to allocate session, out of memory\n");
+      sockpool_close(sp, output, port);
+      return NULL;
+    }
+    client->listener = listener;
+
+    /* sticky, the same source gets the same destination next time */
+    client_route(client, listener, dstset_pick(listener->dsts, (struct sockaddr *)&pkt->addr));
+    client_add(client);
+
+    if(VERBOSE)
+      log_event(LOGEV_NEW, (struct sockaddr *)&pkt->addr, host_sa(&client->upstream),
+                host_sa(sp->bind_h), pkt->len);
   }
-  free(src);
+
+  client_seen(client);
+  if(client->waiting == 0) {
+    client->waiting = loop_us;
+    upstream_sent(client->up);
+  }
+  else if(loop_us - client->waiting > UPSTREAM_LOST_US) {
+    /* no answer for too long, time the new request instead */
+    upstream_lost(client->up);
+    client->waiting = loop_us;
+  }
+  client->fwd_pkts  += batch_segments(pkt->len, pkt->gso);
+  client->fwd_bytes += pkt->len;
+  return client;
 }
 
-/* handle answer from the outside */
-void handle_outside(int inside, int outside, host_t *outside_h) {
-  int len;
-  unsigned char buffer[MAX_BUFFER_SIZE];
-  void *src;
+/* handle new or known incoming requests */
+void handle_inside(listener_t *listener) {
   client_t *client;
+  pkt_t *pkts;
+  int i, n, max;
 
-  size_t size = outside_h->size;
-  src = malloc(size);
-  
-  len = recvfrom( outside, buffer, sizeof( buffer ), 0, (struct sockaddr*)src, (socklen_t *)&size );
-  free(src);
-
-  if(len > 0) {
-    /* do we know it? */
-    client = client_find_fd(outside);
-    if(client != NULL) {
-      /* yes, we know it */
-      /* FIXME: check src vs. client->src ? */
-      if(sendto(inside, buffer, len, 0,
-                (struct sockaddr*)client->src->sock, client->src->size) < 0) {
-        perror("unable to send back to client"); /* FIXME: add src+port */
-        client_close(client);
-      }
+  pkts = rx_reserve(BATCH, &max);
+  n = batch_recv(listener->socket, pkts, max);
+
+  if(n < 0) {
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+      perror("unable to receive from client");
+    return;
+  }
+
+  rx_used += n;
+  STATS->fwd_rx_calls++;
+
+  for(i=0; i<n; i++) {
+    STATS->fwd_rx_pkts  += rx_count(&pkts[i]);
+    STATS->fwd_rx_bytes += pkts[i].len;
+    if(pkts[i].len == 0)
+      continue;
+
+    client = inside_client(listener, &pkts[i]);
+    if(client == NULL)
+      continue;
+
+    /* don't overtake datagrams still waiting for the socket */
+    if(client->txq != NULL && client->txq->count > 0)
+      tx_wait(&client->txq, client->socket, client, host_sa(&client->upstream),
+              client->upstream.size, pkts[i].buf, pkts[i].len, pkts[i].gso);
+    else
+      txbatch_push(tx_fwd, client->socket, host_sa(&client->upstream), client->upstream.size,
+                   pkts[i].buf, pkts[i].len, pkts[i].gso, client);
+  }
+
+  txbatch_flush(tx_fwd);
+}
+
+/* time to the first answer after a forward */
+static void rtt_done(client_t *client) {
+  if(client->waiting) {
+    stats_hist_add(&STATS->rtt, loop_us - client->waiting);
+    upstream_answered(client->up, loop_us - client->waiting);
+    client->waiting = 0;
+  }
+}
+
+/* icmp errors for datagrams the session sent, see health.c. err is
+   the error of a receive, or 0 if the socket has an error queued,
+   returns 0 if err is about something else */
+static int outside_error(client_t *client, int err) {
+  if(err != ECONNREFUSED && err != EHOSTUNREACH && err != ENETUNREACH && err != 0)
+    return 0;
+  if(health_unreachable(client->socket, &client->upstream) > 0)
+    upstream_fail(client->up, 1);
+  return 1;
+}
+
+/* handle answer from the outside, client is the owner of the ready socket */
+void handle_outside(client_t *client) {
+  listener_t *listener = client->listener;
+  pkt_t *pkts;
+  int i, n, max;
+
+  pkts = rx_reserve(1, &max);
+  n = batch_recv(client->socket, pkts, max);
+
+  if(n < 0) {
+    if(errno != EAGAIN && errno != EWOULDBLOCK && ! outside_error(client, errno))
+      perror("unable to receive from destination");
+    return;
+  }
+
+  rx_used += n;
+  STATS->rep_rx_calls++;
+
+  /* queue the answers, they are sent  back together with the answers
+     for other clients */
+  for(i=0; i<n; i++) {
+    STATS->rep_rx_pkts  += rx_count(&pkts[i]);
+    STATS->rep_rx_bytes += pkts[i].len;
+    if(pkts[i].len == 0) {
+      fprintf(stderr, "weird, recvfrom returned 0 bytes!\n");
+      continue;
+    }
+
+    /* not from the destination, still forwarded, but counted */
+    if(! host_is(&client->upstream, (struct sockaddr *)&pkts[i].addr))
+      STATS->rep_stray++;
+
+    rtt_done(client);
+    client->rep_pkts  += batch_segments(pkts[i].len, pkts[i].gso);
+    client->rep_bytes += pkts[i].len;
+    if(listener->txq != NULL && listener->txq->count > 0)
+      tx_wait(&listener->txq, listener->socket, listener, host_sa(&client->src),
+              client->src.size, pkts[i].buf, pkts[i].len, pkts[i].gso);
+    else
+      txbatch_push(tx_rep, listener->socket, host_sa(&client->src), client->src.size,
+                   pkts[i].buf, pkts[i].len, pkts[i].gso, client);
+  }
+}
+
+/* set by the signal handlers, checked by main_loop() */
+volatile sig_atomic_t STOP = 0;
+volatile sig_atomic_t DUMP = 0;
+
+/* allocate receive slots and send batches */
+static int batch_init() {
+  int i;
+
+  rx = calloc(BATCH, sizeof(pkt_t));
+  if(rx == NULL) {
+    perror("unable to allocate receive buffers");
+    return 1;
+  }
+
+  for(i=0; i<BATCH; i++) {
+    rx[i].size = MAX_BUFFER_SIZE;
+    rx[i].buf  = malloc(MAX_BUFFER_SIZE);
+    if(rx[i].buf == NULL) {
+      perror("unable to allocate receive buffers");
+      return 1;
+    }
+  }
+
+  tx_fwd = txbatch_new(BATCH, fwd_error, fwd_blocked, &STATS->fwd_tx_calls, &STATS->fwd_tx_pkts,
+                       &STATS->fwd_tx_bytes);
+  tx_rep = txbatch_new(BATCH, rep_error, rep_blocked, &STATS->rep_tx_calls, &STATS->rep_tx_pkts,
+                       &STATS->rep_tx_bytes);
+
+  return 0;
+}
+
+static void batch_done() {
+  int i;
+
+  for(i=0; i<BATCH && rx != NULL; i++)
+    free(rx[i].buf);
+  free(rx);
+  rx = NULL;
+
+  if(tx_fwd != NULL)
+    txbatch_free(tx_fwd);
+  if(tx_rep != NULL)
+    txbatch_free(tx_rep);
+  tx_fwd = tx_rep = NULL;
+}
+
+/* engine specific part of client_add() */
+void client_watch(client_t *client) {
+  client->listener->sessions++;
+
+  if(ENGINE == ENGINE_URING) {
+    if(uring_recv(client->socket, client) == 0)
+      client->busy++;
+    else
+      perror("unable to watch client socket");
+  }
+  else if(ev_add(client->socket, EV_READ, client) != 0)
+    perror("unable to watch client socket");
+}
+
+/* engine specific part of client_del(), queued datagrams are dropped */
+void client_unwatch(client_t *client) {
+  client->listener->sessions--;
+
+  if(ENGINE == ENGINE_URING)
+    uring_cancel(client);
+  else
+    ev_del(client->socket);
+
+  if(client->txq != NULL) {
+    txqueue_free(client->txq);
+    client->txq = NULL;
+  }
+}
+
+/* handle every ready socket, not just the first one */
+static void ev_dispatch(ev_event_t *events, int n) {
+  int i;
+
+  for(i=0; i<n; i++) {
+    if(*(int *)events[i].data == EV_CTL) {
+      ctl_handle(events[i].data, events[i].events);
+    }
+    else if(*(int *)events[i].data == EV_METRICS) {
+      metrics_handle(events[i].data, events[i].events);
+    }
+    else if(*(int *)events[i].data == EV_PROBE) {
+      health_handle(events[i].data, events[i].events);
+    }
+    else if(*(int *)events[i].data == EV_LISTEN) {
+      listener_t *l = (listener_t *)events[i].data;
+
+      /* answers waiting for room in the socket buffer */
+      if((events[i].events & EV_WRITE) && l->txq != NULL)
+        tx_drain(l->txq, l, "send back to client");
+
+      /* incoming client on  the inside, get src, bind  output fd, add
+         to list if known, otherwise just handle it */
+      if(events[i].events & (EV_READ | EV_ERROR))
+        handle_inside(l);
     }
     else {
-      fprintf(stderr, "weird, no matching client found!\n");
+      client_t *client = (client_t *)events[i].data;
+      if(client->socket < 0) /* closed by a previous event */
+        continue;
+
+      if((events[i].events & EV_WRITE) && client->txq != NULL)
+        tx_drain(client->txq, client, "forward to destination");
+
+      /* the error queue keeps the socket ready until it is read */
+      if(events[i].events & EV_ERROR)
+        outside_error(client, 0);
+
+      /* remote answer came in on an output fd, proxy back to the inside */
+      if(events[i].events & (EV_READ | EV_ERROR))
+        handle_outside(client);
+    }
+  }
+}
+
+/* time spent on an iteration, only measured if somebody looks at it */
+static void loop_busy() {
+  if(METRICS != NULL || SHM != NULL)
+    stats_hist_add(&STATS->busy, clock_us() - loop_us);
+}
+
+/* milliseconds to wait for events, -1 for ever */
+static int loop_timeout() {
+  int a = client_timeout();
+  int b = shm_timeout();
+  int c = health_timeout(loop_us);
+  if(a < 0 || (b >= 0 && b < a))
+    a = b;
+  if(a < 0 || (c >= 0 && c < a))
+    a = c;
+  return a;
+}
+
+/* setups binding to the same addresses without a fixed port, or to the
+   same range of ports, share their sockets */
+static int loop_shared(listener_t *a, listener_t *b) {
+  return a->binds == b->binds || ((a->binds->hosts[0]->port == 0 || a->binds->hi > 0)
+                                  && bindset_is(a->binds, b->binds));
+}
+
+/* the sockets of one bind address, with -w every worker binds to its
+   own part of a range of ports */
+static sockpool_t *loop_sockpool(listener_t *l, host_t *bind_h, int worker) {
+  int lo = bind_h->port, hi = l->binds->hi, n, per;
+
+  if(hi == 0)
+    return sockpool_new(bind_h, 0, 0, l->prebind);
+
+  n = hi - lo + 1;
+  if(WORKERS > 1 && n >= WORKERS) {
+    per = n / WORKERS;
+    lo += worker * per;
+    return sockpool_new(bind_h, lo, worker == WORKERS - 1 ? hi : lo + per - 1, l->prebind);
+  }
+
+  return sockpool_new(bind_h, lo, hi, l->prebind);
+}
+
+/* prepare sockets for new clients of the bind addresses which used some */
+static void loop_refill() {
+  bindset_t *bs;
+
+  while(drained != NULL) {
+    bs = drained;
+    drained = bs->refill;
+    bs->drained = 0;
+    bindset_fill(bs, PREBIND_REFILL);
+  }
+}
+
+/* the loop of the event engine */
+static int ev_loop() {
+  ev_event_t events[EV_MAXEVENTS];
+  listener_t *l;
+  uint64_t now;
+  int n;
+
+  if(batch_init() != 0) {
+    batch_done();
+    return 1;
+  }
+
+  for(l = listeners; l != NULL; l = l->next) {
+    if(ev_add(l->socket, EV_READ, l) != 0) {
+      perror("unable to watch listen socket");
+      batch_done();
+      return 1;
+    }
+  }
+
+  while(! STOP) {
+    if(DUMP) {
+      DUMP = 0;
+      stats_dump();
+    }
+
+    /* wake up when the next client may age out, a statistics snapshot
+       or health probes are due, even without traffic */
+    n = ev_wait(events, EV_MAXEVENTS, loop_timeout());
+
+    /* the only clock read per iteration, but see loop_busy() */
+    loop_us = clock_us();
+    now = loop_us / 1000;
+    client_tick(now);
+    log_tick(loop_us);
+    health_run(loop_us);
+
+    if(n < 0) {
+      if(errno != EINTR)
+        perror("ev_wait");
+      continue;
+    }
+
+    ev_dispatch(events, n);
+
+    /* send the answers collected during this iteration */
+    tx_flush();
+
+    /* control commands, now that nothing refers to the sessions */
+    ctl_run();
+
+    /* close aged out outputs, if any */
+    client_clean(0);
+    client_reap();
+
+    /* prepare sockets for new clients, now that nobody is waiting */
+    loop_refill();
+
+    loop_busy();
+    shm_publish(loop_us);
+  }
+
+  /* sessions still hold sockets watched by the event engine */
+  client_clean(1);
+  batch_done();
+
+  return 0;
+}
+
+static void fwd_sent(void *owner, int res, int pkts) {
+  client_t *client = (client_t *)owner;
+
+  client->busy--;
+  STATS->fwd_tx_pkts += pkts;
+  if(res < 0) {
+    STATS->fwd_errors++;
+    fprintf(stderr, "unable to forward to destination: %s\n", strerror(-res));
+  }
+  else
+    STATS->fwd_tx_bytes += res;
+}
+
+static void rep_sent(void *owner, int res, int pkts) {
+  client_t *client = (client_t *)owner;
+
+  client->busy--;
+  STATS->rep_tx_pkts += pkts;
+  if(res >= 0)
+    STATS->rep_tx_bytes += res;
+  else {
+    STATS->rep_errors++;
+    fprintf(stderr, "unable to send back to client: %s\n", strerror(-res));
+    if(client->socket >= 0)
+      client_close(client);
+  }
+}
+
+/* a datagram arrived, from the inside on the listen socket or from the
+   outside on the socket of a client, it is sent from the buffer it has
+   been received into */
+static void uring_recvd(void *owner, pkt_t *pkt) {
+  listener_t *listener;
+  client_t *client;
+
+  if(*(int *)owner == EV_LISTEN) {
+    listener = (listener_t *)owner;
+    STATS->fwd_rx_pkts  += rx_count(pkt);
+    STATS->fwd_rx_bytes += pkt->len;
+    if(pkt->len == 0)
+      return;
+
+    client = inside_client(listener, pkt);
+    if(client == NULL)
+      return;
+
+    if(uring_send(client->socket, host_sa(&client->upstream), client->upstream.size, pkt->buf,
+                  pkt->len, pkt->gso, client, fwd_sent) == 0)
+      client->busy++;
+    else
+      perror("unable to forward to destination");
+  }
+  else {
+    client = (client_t *)owner;
+    if(client->socket < 0)
+      return; /* closed, the receive is being cancelled */
+    listener = client->listener;
+
+    STATS->rep_rx_pkts  += rx_count(pkt);
+    STATS->rep_rx_bytes += pkt->len;
+    if(pkt->len == 0) {
+      fprintf(stderr, "weird, recvfrom returned 0 bytes!\n");
+      return;
     }
+
+    if(! host_is(&client->upstream, (struct sockaddr *)&pkt->addr))
+      STATS->rep_stray++;
+
+    rtt_done(client);
+    client->rep_pkts  += batch_segments(pkt->len, pkt->gso);
+    client->rep_bytes += pkt->len;
+
+    if(uring_send(listener->socket, host_sa(&client->src), client->src.size,
+                  pkt->buf, pkt->len, pkt->gso, client, rep_sent) == 0)
+      client->busy++;
+    else
+      perror("unable to send back to client");
   }
+}
+
+/* a multishot receive has ended, e.g. because all buffers were in use,
+   start it again unless the socket has been closed */
+static void uring_stopped(void *owner, int err) {
+  client_t *client = NULL;
+  int fd;
+
+  if(*(int *)owner == EV_LISTEN)
+    fd = ((listener_t *)owner)->socket;
   else {
-    fprintf(stderr, "weird, recvfrom returned 0 bytes!\n");
+    client = (client_t *)owner;
+    client->busy--;
+    fd = client->socket;
+    if(fd < 0)
+      return;
+  }
+
+  if(err < 0 && err != -ENOBUFS && (client == NULL || ! outside_error(client, -err)))
+    fprintf(stderr, "unable to receive: %s\n", strerror(-err));
+
+  if(uring_recv(fd, owner) == 0) {
+    if(client != NULL)
+      client->busy++;
   }
+  else
+    perror("unable to restart receiving");
 }
 
-/* stores system specific information, used by longjmp(), see below */
-jmp_buf  JumpBuffer;
+/* the loop of the io_uring engine, the event engine is only used for
+   other sockets, its descriptor is polled via io_uring */
+static int uring_loop() {
+  ev_event_t events[EV_MAXEVENTS];
+  listener_t *l;
+  uint64_t now;
+  int n, polled;
+
+  for(l = listeners; l != NULL; l = l->next) {
+    if(uring_recv(l->socket, l) != 0) {
+      perror("unable to watch listen socket");
+      return 1;
+    }
+  }
+  if(ev_fd() >= 0)
+    uring_poll(ev_fd());
+
+  while(! STOP) {
+    if(DUMP) {
+      DUMP = 0;
+      stats_dump();
+    }
+
+    /* submit the answers of the last iteration and wait for more */
+    uring_wait(loop_timeout());
+
+    /* the only clock read per iteration, but see loop_busy() */
+    loop_us = clock_us();
+    now = loop_us / 1000;
+    client_tick(now);
+    log_tick(loop_us);
+    health_run(loop_us);
+
+    polled = 0;
+    uring_run(&polled);
+
+    if(polled) {
+      n = ev_wait(events, EV_MAXEVENTS, 0);
+      if(n > 0)
+        ev_dispatch(events, n);
+    }
+
+    /* hand the sends collected during this iteration to the kernel */
+    uring_submit();
+
+    /* control commands, now that nothing refers to the sessions */
+    ctl_run();
+
+    /* close aged out outputs, if any */
+    client_clean(0);
+    client_reap();
+
+    /* prepare sockets for new clients, now that nobody is waiting */
+    loop_refill();
+
+    loop_busy();
+    shm_publish(loop_us);
+  }
+
+  client_clean(1);
+
+  return 0;
+}
 
 /* runs forever, handles incoming requests on the inside and answers on the outside */
-int main_loop(int listensocket, host_t *listen_h, host_t *bind_h, host_t *dst_h) {
-  int max, sender;
-  fd_set fds;
+int main_loop(server_t *server) {
+  listener_t *l, *o, *prev;
+  int err, i;
 
   /* we want to properly tear  down running sessions when interrupted,
      int_handler() will be called on INT or TERM signals */
   signal(SIGINT, int_handler);
   signal(SIGTERM, int_handler);
+  signal(SIGUSR1, usr_handler);
 
-  for(;;) {
-    /*
-      Normally returns 0, that is, if it's the first instruction after
-      entering the loop.  However, it  will return 1, when called from
-      longjmp(), which will be called by int_handler() if a SIGINT- or
-      TERM  arrives.  In  that  case  we leave  the  loop,  tear  down
-      everything and exit.
-     */
-    if (setjmp(JumpBuffer) == 1) {
-      break;
-    }
+  if(ev_init() != 0)
+    return 1;
 
-    FD_ZERO(&fds);
-    max = fill_set(&fds);
+  listeners = server->listeners;
 
-    FD_SET(listensocket, &fds);
-    if (listensocket > max)
-      max = listensocket;
+  /* formats the log messages of the loop, with -v */
+  log_start();
 
-    select(max + 1, &fds, NULL, NULL, NULL);
+  ctl_init(server->ctl, server->ctlpath);
+  metrics_init(server->metrics);
 
-    if (FD_ISSET(listensocket, &fds)) {
-      /* incoming client on  the inside, get src, bind  output fd, add
-         to list if known, otherwise just handle it */
-      handle_inside(listensocket, listen_h, bind_h, dst_h);
+  if(ENGINE == ENGINE_URING && uring_init(uring_recvd, uring_stopped) != 0) {
+    fprintf(stderr, "io_uring not available, falling back to the event engine\n");
+    ENGINE = ENGINE_EVENT;
+  }
+
+  client_init(clock_ms(), SESSIONS);
+  health_init();
+
+  /* per process, workers must not share outgoing sockets */
+  for(l = listeners, prev = NULL; l != NULL; prev = l, l = l->next) {
+    /* mostly the ports of a range, check the previous one first */
+    if(prev != NULL && loop_shared(prev, l))
+      o = prev;
+    else
+      for(o = listeners; o != l && ! loop_shared(o, l); o = o->next)
+        ;
+    if(o != l && o->binds != l->binds) {
+      bindset_free(l->binds);
+      l->binds = bindset_ref(o->binds);
     }
-    else {
-      /* remote answer came in on an output fd, proxy back to the inside */
-      sender = get_sender(&fds);
-      handle_outside(listensocket, sender, dst_h);
+    if(l->binds->pools == NULL) {
+      l->binds->pools = malloc(sizeof(sockpool_t *) * l->binds->count);
+      for(i=0; i<l->binds->count; i++)
+        l->binds->pools[i] = loop_sockpool(l, l->binds->hosts[i], server->worker);
+      bindset_fill(l->binds, l->prebind);
     }
-
-    /* close old outputs, if any */
-    client_clean(0);
   }
-  
+
+  if(ENGINE == ENGINE_URING)
+    err = uring_loop();
+  else
+    err = ev_loop();
+
   /* we came here via signal handler, clean up */
-  close(listensocket);
-  client_clean(1);
+  if(VERBOSE)
+    stats_dump();
+  client_reap();
+  if(ENGINE == ENGINE_URING)
+    uring_done(); /* cancels the pending requests of closed clients */
+  client_done();
+  for(l = listeners; l != NULL; l = l->next) {
+    bindset_close(l->binds);
+    if(l->txq != NULL)
+      txqueue_free(l->txq);
+    l->txq = NULL;
+    close(l->socket);
+  }
+  health_done();
+  ctl_done();
+  metrics_done();
+  ev_done();
+  log_stop();
 
-  return 0;
+  return err;
 }
 
 /*
-  Handle SIGINT- and TERM, call  longjmp(), which jumps right into the
-  main loop, where it causes the loop to be left.
+  Handle SIGINT- and TERM, tell main_loop() to leave, the blocking
+  ev_wait() call gets interrupted by the signal.
  */
 void int_handler(int  sig) {
   signal(sig, SIG_IGN);
-  longjmp(JumpBuffer, 1);
+  STOP = 1;
 }
 
-void verb_prbind (host_t *bind_h) {
-  if(VERBOSE) {
-    if(strcmp(bind_h->ip, "0.0.0.0") != 0 || strcmp(bind_h->ip, "[::0]") != 0) {
-      verbose("from %s:%d\n", bind_h->ip, bind_h->port);
-    }
-    else {
-      verbose("\n");
-    }
-  }
+/* SIGUSR1: dump statistics */
+void usr_handler(int  sig) {
+  (void)sig;
+  DUMP = 1;
 }
+
@@ -29,43 +29,99 @@
 #include <unistd.h>
 #include <time.h>
 #include <signal.h>
-#include <setjmp.h>
+#include <errno.h>
 #include <syslog.h>
 
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/fcntl.h>
 #include <arpa/inet.h>
 #include <pwd.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 
 #include "client.h"
+#include "event.h"
+#include "batch.h"
+#include "queue.h"
+#include "ctl.h"
+#include "stats.h"
+#include "upstream.h"
 
 #define MAX_BUFFER_SIZE 65535
 
+/* values of ENGINE, see main_loop() */
+#define ENGINE_EVENT 0  /* event.c, epoll or poll */
+#define ENGINE_URING 1  /* uring.c */
+
+/* one forwarding setup: where we listen, where we bind to and where we
+   send to, from the command line or one line of the config file */
+struct _listener_t {
+  int evtype;               /* EV_LISTEN, must be first, see event.h */
+  int socket;               /* listen socket, inside */
+  int id;                   /* position in the list, see client_find_addr() */
+  host_t *listen_h;         /* listen ip+port */
+  bindset_t *binds;         /* bind ip(s)[+port] for outgoing sockets */
+  dstset_t *dsts;           /* destination(s) ip+port */
+  int dst_off;              /* added to the destination ports, in a listen range */
+  int timeout;              /* idle timeout of sessions, seconds */
+  int limit;                /* max sessions, 0 for no limit */
+  int prebind;              /* prebound outgoing sockets */
+  int sessions;             /* sessions in use */
+  txqueue_t *txq;           /* answers waiting for the listen socket, or NULL */
+  int *sockets;             /* listen socket per worker, see worker.c */
+  struct _listener_t *next;
+};
+typedef struct _listener_t listener_t;
+
+/* everything a process serves */
+struct _server_t {
+  listener_t *listeners;    /* the forwarding setups */
+  int ctl;                  /* control socket, -1 if none */
+  char *ctlpath;            /* its path */
+  int metrics;              /* metrics socket, -1 if none */
+  int worker;               /* number of this worker, 0 without -w */
+};
+typedef struct _server_t server_t;
+
 extern client_t *clients;
+extern listener_t *listeners;
 extern int VERBOSE;
 extern int FORKED;
+extern int BATCH;
+extern int SESSIONS;
+extern int PREBIND;
+extern int ENGINE;
+extern int GSO;
+extern int BINDMODE;
+extern int BALANCE;
+
 
 
+void handle_inside(listener_t *listener);
+void handle_outside(client_t *client);
 
-void handle_inside(int inside, host_t *listen_h, host_t *bind_h, host_t *dst_h);
-void handle_outside(int inside, int outside, host_t *outside_h);
+listener_t *listener_new(char *inip, char *inpt, dstset_t *dsts, int dst_off, bindset_t *binds);
+void listener_free(listener_t *listener);
+listener_t *listener_find(struct sockaddr *addr);
 
-int main_loop(int listensocket, host_t *listen_h, host_t *bind_h, host_t *dst_h);
-int start_listener (char *inip, char *inpt, char *srcip, char *srcpt, char *dstip,
-		    char *dstpt, char *pidfile, char *chrootdir, char *user);
+int main_loop(server_t *server);
+int start_listeners(listener_t *list, char *pidfile, char *chrootdir, char *user);
 int daemonize(char *pidfile);
 int drop_privileges(char *user, char *chrootdir);
 
-int fill_set(fd_set *fds);
-int get_sender(fd_set *fds);
-int bindsocket( host_t *sock_h);
+int bindsocket( host_t *sock_h, int reuseport);
+int reuseport_steer(int fd, int n);
 void int_handler(int  sig);
-void verb_prbind (host_t *bind_h);
+void usr_handler(int  sig);
+uint64_t clock_ms();
+uint64_t clock_us();
 
 #define _IS_LINK_LOCAL(a) do { IN6_IS_ADDR_LINKLOCAL(a); } while(0)
 
@@ -0,0 +1,99 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "pool.h"
+
+/* allocate another slab of count objects and put them on the free list */
+static int pool_grow(pool_t *pool, size_t count) {
+  slab_t *slab;
+  char *obj;
+  size_t i;
+
+  /* the header is padded to 16 bytes to keep the objects aligned */
+  slab = malloc(16 + pool->size * count);
+  if(slab == NULL)
+    return -1;
+
+  slab->next  = pool->slabs;
+  pool->slabs = slab;
+
+  obj = (char *)slab + 16;
+  for(i=0; i<count; i++) {
+    *(void **)obj = pool->free;
+    pool->free = obj;
+    obj += pool->size;
+  }
+
+  pool->total += count;
+
+  return 0;
+}
+
+pool_t *pool_new(size_t size, size_t prealloc) {
+  pool_t *pool = malloc(sizeof(pool_t));
+
+  if(size < sizeof(void *))
+    size = sizeof(void *);
+
+  pool->size  = (size + 15) & ~(size_t)15;
+  pool->used  = 0;
+  pool->total = 0;
+  pool->free  = NULL;
+  pool->slabs = NULL;
+
+  if(prealloc > 0 && pool_grow(pool, prealloc) != 0) {
+    fprintf(stderr, "unable to preallocate %lu objects\n", (unsigned long)prealloc);
+  }
+
+  return pool;
+}
+
+/* returns an uninitialized object, NULL if we are out of memory */
+void *pool_get(pool_t *pool) {
+  void *obj;
+
+  if(pool->free == NULL && pool_grow(pool, POOL_SLAB) != 0)
+    return NULL;
+
+  obj = pool->free;
+  pool->free = *(void **)obj;
+  pool->used++;
+
+  return obj;
+}
+
+void pool_put(pool_t *pool, void *obj) {
+  *(void **)obj = pool->free;
+  pool->free = obj;
+  pool->used--;
+}
+
+void pool_free(pool_t *pool) {
+  slab_t *slab;
+
+  while(pool->slabs != NULL) {
+    slab = pool->slabs;
+    pool->slabs = slab->next;
+    free(slab);
+  }
+
+  free(pool);
+}
@@ -0,0 +1,57 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_POOL_H
+#define _HAVE_POOL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+  Fixed size object pool. Objects are carved out of slabs of many
+  objects each, released objects go to a free list and are handed out
+  again, memory is only returned to the system by pool_free().
+*/
+
+#define POOL_SLAB 256 /* objects per slab if the pool has to grow */
+
+struct _slab_t {
+  struct _slab_t *next;
+};
+typedef struct _slab_t slab_t;
+
+struct _pool_t {
+  size_t size;              /* object size, rounded up to 16 bytes */
+  size_t used;              /* objects handed out */
+  size_t total;             /* objects allocated */
+  void *free;               /* free list, linked through the objects themselves */
+  slab_t *slabs;            /* all slabs, for pool_free() */
+};
+typedef struct _pool_t pool_t;
+
+pool_t *pool_new(size_t size, size_t prealloc);
+void *pool_get(pool_t *pool);
+void pool_put(pool_t *pool, void *obj);
+void pool_free(pool_t *pool);
+
+#endif
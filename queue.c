@@ -0,0 +1,178 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "queue.h"
+
+/*
+  All sockets are non-blocking, so a send into a full socket buffer
+  fails with EAGAIN instead of stalling the loop for every client. The
+  datagrams which could not be sent wait in a small queue per socket,
+  which main_loop() flushes when the socket becomes writable again.
+
+  A queue holds at most QUEUE datagrams, if it is full either the new
+  one (DROP_TAIL) or the oldest one (DROP_HEAD) is dropped, the latter
+  being the better choice for latency sensitive traffic.
+*/
+
+/* datagrams and bytes flushed are added to *sent and *bytes */
+txqueue_t *txqueue_new(int fd, int max, uint64_t *sent, uint64_t *bytes) {
+  txqueue_t *q = malloc(sizeof(txqueue_t));
+
+  if(q == NULL)
+    return NULL;
+
+  q->fd    = fd;
+  q->head  = 0;
+  q->count = 0;
+  q->max   = max;
+  q->sent  = sent;
+  q->bytes = bytes;
+  q->pkts  = calloc(max, sizeof(qpkt_t));
+
+  if(q->pkts == NULL) {
+    free(q);
+    return NULL;
+  }
+
+  return q;
+}
+
+/* forget the oldest datagram */
+static void txqueue_pop(txqueue_t *q) {
+  free(q->pkts[q->head].buf);
+  q->pkts[q->head].buf = NULL;
+  q->head = (q->head + 1) % q->max;
+  q->count--;
+  STATS->q_waiting--;
+}
+
+/* datagrams still queued are dropped */
+void txqueue_free(txqueue_t *q) {
+  while(q->count > 0) {
+    STATS->q_dropped += batch_segments(q->pkts[q->head].len - q->pkts[q->head].off,
+                                      q->pkts[q->head].gso);
+    txqueue_pop(q);
+  }
+  free(q->pkts);
+  free(q);
+}
+
+/* queue a copy of the datagram(s) in buf, to be sent by txqueue_flush() */
+void txqueue_push(txqueue_t *q, struct sockaddr *to, socklen_t tolen,
+                  void *buf, size_t len, size_t gso) {
+  int segs = batch_segments(len, gso);
+  qpkt_t *p;
+
+  if(q->count == q->max) {
+    if(DROP == DROP_TAIL) {
+      STATS->q_dropped += segs;
+      return;
+    }
+    STATS->q_dropped += batch_segments(q->pkts[q->head].len - q->pkts[q->head].off,
+                                      q->pkts[q->head].gso);
+    txqueue_pop(q);
+  }
+
+  p = &q->pkts[(q->head + q->count) % q->max];
+  p->buf = malloc(len);
+  if(p->buf == NULL) {
+    STATS->q_dropped += segs;
+    return;
+  }
+
+  memcpy(p->buf, buf, len);
+  memcpy(&p->to, to, tolen);
+  p->tolen = tolen;
+  p->len   = len;
+  p->gso   = gso < len ? gso : 0;
+  p->off   = 0;
+  p->split = 0;
+  q->count++;
+
+  STATS->q_queued += segs;
+  STATS->q_waiting++;
+}
+
+/* send the next datagram of p, all of them at once with UDP_SEGMENT
+   unless that has failed before, returns the number of datagrams sent */
+static int txqueue_send(txqueue_t *q, qpkt_t *p) {
+  struct msghdr hdr;
+  struct iovec iov;
+  cmsgbuf_t ctl;
+  size_t len = p->len - p->off;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_name    = &p->to;
+  hdr.msg_namelen = p->tolen;
+  hdr.msg_iov     = &iov;
+  hdr.msg_iovlen  = 1;
+
+  iov.iov_base = p->buf + p->off;
+  if(p->split)
+    iov.iov_len = len < p->gso ? len : p->gso;
+  else {
+    iov.iov_len = len;
+    if(p->gso)
+      batch_gso_set(&hdr, &ctl, p->gso);
+  }
+
+  if(sendmsg(q->fd, &hdr, 0) < 0)
+    return -1;
+
+  p->off += iov.iov_len;
+  *q->bytes += iov.iov_len;
+  return p->split ? 1 : batch_segments(len, p->gso);
+}
+
+/* send queued datagrams until the socket buffer is full again. Returns
+   -1 if one could not be sent for another reason, it is dropped then
+   and errno is set, call again for the rest. */
+int txqueue_flush(txqueue_t *q) {
+  qpkt_t *p;
+  int sent;
+
+  while(q->count > 0) {
+    p = &q->pkts[q->head];
+    sent = txqueue_send(q, p);
+
+    if(sent < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      if(p->gso && ! p->split && batch_gso_failed(errno)) {
+        STATS->gso_split++;
+        p->split = 1;
+        continue;
+      }
+      STATS->q_dropped += batch_segments(p->len - p->off, p->gso);
+      txqueue_pop(q);
+      return -1;
+    }
+
+    STATS->q_flushed += sent;
+    *q->sent += sent;
+    if(p->off >= p->len)
+      txqueue_pop(q);
+  }
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_QUEUE_H
+#define _HAVE_QUEUE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "stats.h"
+
+#define QUEUE_DEFAULT 64  /* datagrams waiting per socket */
+
+/* values of DROP, what to do if a queue is full */
+#define DROP_TAIL 0       /* drop the new datagram */
+#define DROP_HEAD 1       /* drop the oldest queued datagram */
+
+/* a datagram waiting for room in the socket buffer, a copy of the
+   receive buffer, which is reused right away */
+struct _qpkt_t {
+  struct sockaddr_storage to;
+  socklen_t tolen;
+  unsigned char *buf;
+  size_t len;
+  size_t gso;               /* datagram size if buf holds several, 0 otherwise */
+  size_t off;               /* bytes already sent, if sent one by one */
+  int split;                /* the kernel could not segment it, see txqueue_flush() */
+};
+typedef struct _qpkt_t qpkt_t;
+
+/* datagrams which could not be sent from a socket without blocking, in
+   order, a ring of max entries */
+struct _txqueue_t {
+  int fd;
+  int head;                 /* oldest datagram */
+  int count;
+  int max;
+  qpkt_t *pkts;
+  uint64_t *sent;           /* counters: datagrams and bytes flushed */
+  uint64_t *bytes;
+};
+typedef struct _txqueue_t txqueue_t;
+
+extern int QUEUE;
+extern int DROP;
+
+txqueue_t *txqueue_new(int fd, int max, uint64_t *sent, uint64_t *bytes);
+void txqueue_free(txqueue_t *q);
+void txqueue_push(txqueue_t *q, struct sockaddr *to, socklen_t tolen,
+                  void *buf, size_t len, size_t gso);
+int  txqueue_flush(txqueue_t *q);
+
+#endif
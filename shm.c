@@ -0,0 +1,141 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "shm.h"
+#include "client.h"
+
+/*
+  With --shm every worker publishes a snapshot of its counters into a
+  shared file, e.g. in /dev/shm, so a monitoring agent can read them
+  as often as it likes without talking to udpxd, see udpxstat.c.
+
+  The loop calls shm_publish() once per iteration, which copies the
+  counters at most every SHM_INTERVAL us, protected by a sequence
+  counter instead of a lock: the worker never waits for a reader.
+*/
+
+static unsigned char *region = NULL;
+static size_t regsize = 0;
+static shmslot_t *slot = NULL;
+static char *shmpath = NULL;
+static uint64_t published = 0;
+static int pending = 0;             /* counters changed since */
+static pid_t pid = 0;
+
+/* create the file for n workers, before forking and dropping privileges */
+int shm_create(const char *path, int n) {
+  shmhead_t *head;
+  int fd, i;
+
+  regsize = SHM_HEADSIZE + SHM_SLOTSIZE * n;
+
+  /* always a new file, never follow a link planted in a world writable
+     directory, and never truncate the file another instance has mapped */
+  if(unlink(path) != 0 && errno != ENOENT)
+    fd = -1;
+  else
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if(fd < 0 || ftruncate(fd, regsize) != 0) {
+    fprintf(stderr, "Cannot create statistics file %s\n", path);
+    perror(NULL);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  region = mmap(NULL, regsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(region == MAP_FAILED) {
+    perror("unable to map statistics file");
+    region = NULL;
+    return -1;
+  }
+
+  /* the file is new and zeroed, the head is written once */
+  head = (shmhead_t *)region;
+  head->version  = SHM_VERSION;
+  head->slotsize = SHM_SLOTSIZE;
+  head->slots    = n;
+  head->started  = time(NULL);
+  head->pid      = getpid();
+  for(i=0; i<n; i++)
+    atomic_init(&((shmslot_t *)(region + SHM_HEADSIZE + SHM_SLOTSIZE * i))->seq, 0);
+  /* last, readers ignore the file until it is complete */
+  atomic_thread_fence(memory_order_release);
+  head->magic    = SHM_MAGIC;
+
+  shmpath = strdup(path);
+  slot = (shmslot_t *)(region + SHM_HEADSIZE);
+  pid  = getpid();
+  return 0;
+}
+
+/* publish into slot n, the one of this worker */
+void shm_select(int n) {
+  if(region != NULL) {
+    slot = (shmslot_t *)(region + SHM_HEADSIZE + SHM_SLOTSIZE * n);
+    pid  = getpid();
+  }
+}
+
+/* copy the counters, if the last snapshot is older than SHM_INTERVAL */
+void shm_publish(uint64_t us) {
+  uint64_t seq;
+
+  if(slot == NULL)
+    return;
+  if(us - published < SHM_INTERVAL && published != 0) {
+    pending = 1;
+    return;
+  }
+  published = us;
+  pending   = 0;
+
+  seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->updated  = us;
+  slot->pid      = pid;
+  slot->timeout  = TIMEOUT;
+  slot->sessions = STATS->pool_used;
+  slot->queued   = STATS->q_waiting;
+  memcpy(&slot->stats, STATS, sizeof(stats_t));
+
+  atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+/* milliseconds until a skipped snapshot is due, -1 if none */
+int shm_timeout() {
+  return pending ? SHM_INTERVAL / 1000 : -1;
+}
+
+/* remove the file when the master exits, fails after chroot, never mind */
+void shm_remove() {
+  if(region != NULL)
+    munmap(region, regsize);
+  if(shmpath != NULL)
+    unlink(shmpath);
+  free(shmpath);
+  region  = NULL;
+  slot    = NULL;
+  shmpath = NULL;
+}
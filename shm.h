@@ -0,0 +1,85 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_SHM_H
+#define _HAVE_SHM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/fcntl.h>
+
+#include "stats.h"
+
+/*
+  Layout of the file written with --shm, read by udpxstat. A head
+  followed by one slot per worker, each SHM_ALIGN aligned. Readers
+  must check magic, version and slotsize, the version changes with
+  any change of shmhead_t, shmslot_t or stats_t.
+*/
+#define SHM_MAGIC    0x78706475   /* "udpx" */
+#define SHM_VERSION  2
+#define SHM_ALIGN    64
+#define SHM_INTERVAL 1000         /* us between two snapshots of a worker */
+
+struct _shmhead_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotsize;        /* bytes per slot, sizeof(shmslot_t) rounded up */
+  uint32_t slots;           /* number of workers */
+  uint64_t started;         /* unix time */
+  uint32_t pid;             /* of the master */
+};
+typedef struct _shmhead_t shmhead_t;
+
+/* a snapshot of one worker. seq is odd while the snapshot is written,
+   a reader copies the slot and retries if seq was odd or has changed */
+struct _shmslot_t {
+  _Atomic uint64_t seq;
+  uint64_t updated;         /* CLOCK_MONOTONIC, us */
+  uint32_t pid;
+  uint32_t timeout;         /* idle timeout of sessions, seconds */
+  uint64_t sessions;        /* sessions in use */
+  uint64_t queued;          /* datagrams waiting in queues */
+  stats_t stats;
+};
+typedef struct _shmslot_t shmslot_t;
+
+#define SHM_HEADSIZE  ((sizeof(shmhead_t) + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1))
+#define SHM_SLOTSIZE  ((sizeof(shmslot_t) + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1))
+
+extern char *SHM;
+
+int  shm_create(const char *path, int n);
+void shm_select(int n);
+void shm_publish(uint64_t us);
+int  shm_timeout();
+void shm_remove();
+
+#endif
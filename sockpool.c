@@ -0,0 +1,313 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "sockpool.h"
+
+/*
+  Creating and  binding an outgoing  socket for a  new client costs
+  several syscalls right before its  first datagram can be forwarded.
+  So we keep a few of them ready, refilled by main_loop() after the
+  datagrams of an iteration have been handled. The socket of a closed
+  or aged out session is never put back, late answers for it would
+  reach the next client, so the pool only holds freshly bound ones.
+
+  Only possible if the bind address has no fixed port (-b ip:port),
+  otherwise the size of the pool is 0 and sockets are created on demand.
+
+  With a range of bind ports (-b ip:lo-hi) every socket is bound to a
+  port of the range that no other session uses. Unused ports wait in a
+  ring and the one unused for the longest time is taken first, so late
+  answers for a closed session rarely reach the next one. Ports come
+  back with sockpool_close().
+
+  A setup may bind to several addresses (-b ip,ip or a CIDR), each with
+  its own pool and ports, see bindset_get(). Forwarding setups with the
+  same bind addresses share them, so a listen port range doesn't keep
+  thousands of sockets ready.
+*/
+
+/* with hi > 0 the sockets are bound to the ports lo to hi, otherwise to
+   the port of bind_h */
+sockpool_t *sockpool_new(host_t *bind_h, int lo, int hi, int size) {
+  sockpool_t *sp = malloc(sizeof(sockpool_t));
+  int i;
+
+  sp->nports = hi > 0 ? hi - lo + 1 : 0;
+  sp->free   = NULL;
+  sp->head   = 0;
+  sp->nfree  = sp->nports;
+  if(sp->nports > 0) {
+    sp->free = malloc(sizeof(uint16_t) * sp->nports);
+    for(i=0; i<sp->nports; i++)
+      sp->free[i] = lo + i;
+    if(size > sp->nports)
+      size = sp->nports;
+  }
+  else if(bind_h->port != 0)
+    size = 0;
+
+  sp->bind_h = bind_h;
+  sp->count  = 0;
+  sp->size   = size;
+  sp->stalled = 0;
+  sp->used   = 0;
+  sp->fds    = malloc(sizeof(int) * (size + 1));
+  sp->ports  = malloc(sizeof(uint16_t) * (size + 1));
+
+  return sp;
+}
+
+/* a port is free again, it is used after all others */
+static void sockpool_release(sockpool_t *sp, uint16_t port) {
+  if(sp->nports == 0)
+    return;
+  sp->free[(sp->head + sp->nfree) % sp->nports] = port;
+  sp->nfree++;
+}
+
+/* let the kernel queue icmp errors for datagrams sent on fd, they
+   tell about destinations which are down, see health_unreachable() */
+static void sockpool_recverr(int fd, int v6) {
+#ifdef IP_RECVERR
+  int one = 1;
+  if(v6)
+    setsockopt(fd, IPPROTO_IPV6, IPV6_RECVERR, &one, sizeof(one));
+  else
+    setsockopt(fd, IPPROTO_IP, IP_RECVERR, &one, sizeof(one));
+#else
+  (void)fd;
+  (void)v6;
+#endif
+}
+
+/* create a socket bound to the next free port of the range, ports in
+   use by someone else are tried again later */
+static int sockpool_create_range(sockpool_t *sp, uint16_t *port) {
+  host_t bind_h = *sp->bind_h;
+  int tries, fd;
+
+  for(tries = sp->nfree; tries > 0; tries--) {
+    *port = sp->free[sp->head];
+    sp->head = (sp->head + 1) % sp->nports;
+    sp->nfree--;
+
+    host_port(&bind_h, *port);
+    if((fd = bindsocket(&bind_h, 0)) >= 0) {
+      sockpool_recverr(fd, bind_h.is_v6);
+      return fd;
+    }
+
+    sockpool_release(sp, *port);
+    if(errno != EADDRINUSE)
+      return -1;
+  }
+
+  errno = EADDRNOTAVAIL;
+  return -1;
+}
+
+/* create and bind a socket, remember its local port */
+static int sockpool_create(sockpool_t *sp, uint16_t *port) {
+  struct sockaddr_storage addr;
+  socklen_t size = sizeof(addr);
+  int fd;
+
+  if(sp->nports > 0)
+    return sockpool_create_range(sp, port);
+
+  fd = bindsocket(sp->bind_h, 0);
+
+  if(fd < 0)
+    return -1;
+
+  sockpool_recverr(fd, sp->bind_h->is_v6);
+
+  if(sp->bind_h->port != 0) {
+    *port = sp->bind_h->port;
+  }
+  else {
+    getsockname(fd, (struct sockaddr *)&addr, &size);
+    if(addr.ss_family == AF_INET6)
+      *port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    else
+      *port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+  }
+
+  return fd;
+}
+
+/* returns a bound socket and its local port, -1 on error */
+int sockpool_get(sockpool_t *sp, uint16_t *port) {
+  int fd;
+
+  if(sp->count > 0) {
+    sp->count--;
+    *port = sp->ports[sp->count];
+    sp->used++;
+    STATS->sock_warm++;
+    return sp->fds[sp->count];
+  }
+
+  STATS->sock_cold++;
+  if((fd = sockpool_create(sp, port)) >= 0)
+    sp->used++;
+  return fd;
+}
+
+/* close the socket of a client, its port may be used again */
+void sockpool_close(sockpool_t *sp, int fd, uint16_t port) {
+  close(fd);
+  sp->used--;
+  sp->stalled = 0;
+  sockpool_release(sp, port);
+}
+
+/* create up to max sockets, until the pool is full. Stops after an
+   error (e.g. out of file descriptors) until a socket is closed. */
+void sockpool_fill(sockpool_t *sp, int max) {
+  int fd;
+  uint16_t port;
+
+  while(! sp->stalled && sp->count < sp->size && max-- > 0) {
+    fd = sockpool_create(sp, &port);
+    if(fd < 0) {
+      sp->stalled = 1;
+      break;
+    }
+    sp->fds[sp->count]    = fd;
+    sp->ports[sp->count]  = port;
+    sp->count++;
+  }
+}
+
+void sockpool_free(sockpool_t *sp) {
+  while(sp->count > 0)
+    close(sp->fds[--sp->count]);
+  free(sp->fds);
+  free(sp->ports);
+  free(sp->free);
+  free(sp);
+}
+
+/* takes over hosts, the pools are opened by main_loop() */
+bindset_t *bindset_new(host_t **hosts, int count, int hi) {
+  bindset_t *bs = malloc(sizeof(bindset_t));
+
+  if(bs == NULL)
+    return NULL;
+
+  bs->hosts   = hosts;
+  bs->count   = count;
+  bs->hi      = hi;
+  bs->mode    = BIND_LEAST;
+  bs->next    = 0;
+  bs->pools   = NULL;
+  bs->drained = 0;
+  bs->refill  = NULL;
+  bs->users   = 1;
+
+  return bs;
+}
+
+/* one more setup using the set */
+bindset_t *bindset_ref(bindset_t *bs) {
+  bs->users++;
+  return bs;
+}
+
+/* same addresses, ports and mode */
+int bindset_is(bindset_t *a, bindset_t *b) {
+  int i;
+
+  if(a->count != b->count || a->hi != b->hi || a->mode != b->mode)
+    return 0;
+  for(i=0; i<a->count; i++)
+    if(a->hosts[i]->port != b->hosts[i]->port || ! host_is(a->hosts[i], host_sa(b->hosts[i])))
+      return 0;
+
+  return 1;
+}
+
+/* a socket for a new session from the pool of one of the addresses,
+   the others are tried if it has no port left. Returns -1 on error,
+   with errno EADDRNOTAVAIL if all ports of all addresses are in use. */
+int bindset_get(bindset_t *bs, sockpool_t **sp, uint16_t *port) {
+  int i, first = 0, fd;
+
+  if(bs->count == 1) {
+    *sp = bs->pools[0];
+    return sockpool_get(*sp, port);
+  }
+
+  if(bs->mode == BIND_RR) {
+    first = bs->next;
+    bs->next = (first + 1) % bs->count;
+  }
+  else {
+    for(i=1; i<bs->count; i++)
+      if(bs->pools[i]->used < bs->pools[first]->used)
+        first = i;
+  }
+
+  for(i=0; i<bs->count; i++) {
+    *sp = bs->pools[(first + i) % bs->count];
+    if((fd = sockpool_get(*sp, port)) >= 0)
+      return fd;
+    if(errno != EADDRNOTAVAIL && errno != EADDRINUSE)
+      return -1;
+  }
+
+  errno = EADDRNOTAVAIL;
+  return -1;
+}
+
+/* refill the pools of all addresses */
+void bindset_fill(bindset_t *bs, int max) {
+  int i;
+
+  for(i=0; i<bs->count; i++)
+    sockpool_fill(bs->pools[i], max);
+}
+
+/* close the pools, each process has its own */
+void bindset_close(bindset_t *bs) {
+  int i;
+
+  if(bs->pools == NULL)
+    return;
+  for(i=0; i<bs->count; i++)
+    sockpool_free(bs->pools[i]);
+  free(bs->pools);
+  bs->pools = NULL;
+}
+
+/* the set is gone when its last user is done */
+void bindset_free(bindset_t *bs) {
+  int i;
+
+  if(--bs->users > 0)
+    return;
+  bindset_close(bs);
+  for(i=0; i<bs->count; i++)
+    host_clean(bs->hosts[i]);
+  free(bs->hosts);
+  free(bs);
+}
@@ -0,0 +1,95 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_SOCKPOOL_H
+#define _HAVE_SOCKPOOL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "stats.h"
+
+#define PREBIND_DEFAULT 32  /* warm sockets per bind address */
+#define PREBIND_REFILL  16  /* sockets created per loop iteration */
+
+/* outgoing sockets, already bound to the bind address, ready to be used
+   by new clients */
+struct _sockpool_t {
+  host_t *bind_h;           /* address the sockets are bound to */
+  int *fds;                 /* warm sockets, used as stack */
+  uint16_t *ports;          /* local port of each socket */
+  int count;                /* sockets available */
+  int size;                 /* refill target */
+  int stalled;              /* creating sockets failed, don't refill for now */
+  int used;                 /* sockets given out and not yet returned */
+  uint16_t *free;           /* bind port range: unused ports, oldest first */
+  int nports;               /* size of the range, 0 if there is none */
+  int head;                 /* next port to use in free */
+  int nfree;                /* unused ports */
+};
+typedef struct _sockpool_t sockpool_t;
+
+/* how new sessions are spread over the bind addresses of a setup */
+#define BIND_LEAST 0  /* address with the fewest sessions */
+#define BIND_RR    1  /* round robin */
+
+#define BIND_MAX 256  /* bind addresses per setup */
+
+/* the bind addresses of a forwarding setup with a pool of sockets each,
+   shared by the setups of a listen port range */
+struct _bindset_t {
+  host_t **hosts;           /* bind addresses, with the same port */
+  int count;                /* number of addresses */
+  int hi;                   /* last port of a bind port range, 0 if none */
+  int mode;                 /* BIND_LEAST or BIND_RR */
+  int next;                 /* next address with BIND_RR */
+  sockpool_t **pools;       /* one per address, per process, see main_loop() */
+  int drained;              /* pools need a refill */
+  struct _bindset_t *refill; /* list of drained bind sets */
+  int users;                /* forwarding setups using the set */
+};
+typedef struct _bindset_t bindset_t;
+
+sockpool_t *sockpool_new(host_t *bind_h, int lo, int hi, int size);
+int  sockpool_get(sockpool_t *sp, uint16_t *port);
+void sockpool_close(sockpool_t *sp, int fd, uint16_t port);
+void sockpool_fill(sockpool_t *sp, int max);
+void sockpool_free(sockpool_t *sp);
+
+bindset_t *bindset_new(host_t **hosts, int count, int hi);
+bindset_t *bindset_ref(bindset_t *bs);
+int  bindset_is(bindset_t *a, bindset_t *b);
+int  bindset_get(bindset_t *bs, sockpool_t **sp, uint16_t *port);
+void bindset_fill(bindset_t *bs, int max);
+void bindset_close(bindset_t *bs);
+void bindset_free(bindset_t *bs);
+
+/* from net.c */
+int bindsocket( host_t *sock_h, int reuseport);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "stats.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/*
+  The counters of this process. With --workers every worker has its own
+  slot in a shared mapping created before forking, see stats_init(), so
+  they are only written by one process and need no locks, while any of
+  them can read all slots, see metrics.c.
+*/
+static stats_t local;
+stats_t *STATS = &local;
+
+static unsigned char *slots = NULL;
+static size_t stride = 0;
+static int nslots = 1;
+
+/* allocate n shared slots, the first one is used until stats_select() */
+int stats_init(int n) {
+  /* a cache line of their own per slot */
+  stride = (sizeof(stats_t) + 63) & ~(size_t)63;
+  slots  = mmap(NULL, stride * n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(slots == MAP_FAILED) {
+    perror("unable to allocate statistics");
+    slots = NULL;
+    return -1;
+  }
+
+  nslots = n;
+  memcpy(slots, &local, sizeof(stats_t));
+  STATS = (stats_t *)slots;
+  return 0;
+}
+
+/* count into slot n from now on, a restarted worker continues where
+   its predecessor stopped */
+void stats_select(int n) {
+  if(slots != NULL && n < nslots)
+    STATS = (stats_t *)(slots + stride * n);
+}
+
+int stats_slots() {
+  return nslots;
+}
+
+/* the counters of worker n, updated while being read */
+stats_t *stats_slot(int n) {
+  if(slots == NULL)
+    return &local;
+  return (stats_t *)(slots + stride * n);
+}
+
+static int stats_hist_index(uint64_t v) {
+  int e, i;
+  if(v < STATS_HIST_SUB)
+    return (int)v;
+  e = 63 - __builtin_clzll(v);
+  i = STATS_HIST_SUB + (e - STATS_HIST_SHIFT) * STATS_HIST_SUB
+    + (int)((v >> (e - STATS_HIST_SHIFT)) - STATS_HIST_SUB);
+  return i < STATS_HIST_BUCKETS ? i : STATS_HIST_BUCKETS - 1;
+}
+
+/* smallest value of bucket i */
+static uint64_t stats_hist_value(int i) {
+  int e;
+  if(i < STATS_HIST_SUB)
+    return i;
+  e = (i - STATS_HIST_SUB) / STATS_HIST_SUB + STATS_HIST_SHIFT;
+  return (uint64_t)(STATS_HIST_SUB + (i - STATS_HIST_SUB) % STATS_HIST_SUB) << (e - STATS_HIST_SHIFT);
+}
+
+/* largest value of bucket i, not meaningful for the last one */
+uint64_t stats_hist_bound(int i) {
+  return stats_hist_value(i + 1) - 1;
+}
+
+void stats_hist_add(hist_t *h, uint64_t v) {
+  h->count[stats_hist_index(v)]++;
+  h->total++;
+  h->sum += v;
+}
+
+/* heap bytes in use and obtained from the system, 0 if unknown. The
+   difference is free memory the allocator could not give back. */
+static void stats_heap(uint64_t *used, uint64_t *total) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 mi = mallinfo2();
+  *used  = mi.uordblks + mi.hblkhd;
+  *total = mi.arena + mi.hblkhd;
+#else
+  *used = *total = 0;
+#endif
+}
+
+/* average number of datagrams per syscall */
+static double stats_fill(uint64_t pkts, uint64_t calls) {
+  return calls ? (double)pkts / (double)calls : 0.0;
+}
+
+/* print the counters, to syslog if running as daemon */
+void stats_dump() {
+  char msg[1024];
+  uint64_t used, total;
+
+  stats_heap(&used, &total);
+
+  snprintf(msg, sizeof(msg),
+           "stats: batch size %d, "
+           "fwd rx %llu pkts/%llu calls (avg %.2f), "
+           "fwd tx %llu pkts/%llu calls (avg %.2f), "
+           "rep rx %llu pkts/%llu calls (avg %.2f), "
+           "rep tx %llu pkts/%llu calls (avg %.2f), "
+           "sessions %llu/%llu allocated, "
+           "%llu created/%llu expired/%llu closed/%llu refused, "
+           "send errors %llu fwd/%llu rep, "
+           "stray answers %llu, "
+           "sockets %llu prebound/%llu created, "
+           "coalesced %llu/%llu split, "
+           "ring enters %llu, "
+           "queued %llu/%llu flushed/%llu dropped, "
+           "heap %llu/%llu bytes used\n",
+           BATCH,
+           (unsigned long long)STATS->fwd_rx_pkts, (unsigned long long)STATS->fwd_rx_calls,
+           stats_fill(STATS->fwd_rx_pkts, STATS->fwd_rx_calls),
+           (unsigned long long)STATS->fwd_tx_pkts, (unsigned long long)STATS->fwd_tx_calls,
+           stats_fill(STATS->fwd_tx_pkts, STATS->fwd_tx_calls),
+           (unsigned long long)STATS->rep_rx_pkts, (unsigned long long)STATS->rep_rx_calls,
+           stats_fill(STATS->rep_rx_pkts, STATS->rep_rx_calls),
+           (unsigned long long)STATS->rep_tx_pkts, (unsigned long long)STATS->rep_tx_calls,
+           stats_fill(STATS->rep_tx_pkts, STATS->rep_tx_calls),
+           (unsigned long long)STATS->pool_used, (unsigned long long)STATS->pool_total,
+           (unsigned long long)STATS->sess_new, (unsigned long long)STATS->sess_expired,
+           (unsigned long long)STATS->sess_closed, (unsigned long long)STATS->sess_refused,
+           (unsigned long long)STATS->fwd_errors, (unsigned long long)STATS->rep_errors,
+           (unsigned long long)STATS->rep_stray,
+           (unsigned long long)STATS->sock_warm, (unsigned long long)STATS->sock_cold,
+           (unsigned long long)STATS->gro_bufs, (unsigned long long)STATS->gso_split,
+           (unsigned long long)STATS->ring_enters,
+           (unsigned long long)STATS->q_queued, (unsigned long long)STATS->q_flushed,
+           (unsigned long long)STATS->q_dropped,
+           (unsigned long long)used, (unsigned long long)total);
+
+  if(FORKED)
+    syslog(LOG_INFO, "%s", msg);
+  else
+    fprintf(stderr, "%s", msg);
+}
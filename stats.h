@@ -0,0 +1,96 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_STATS_H
+#define _HAVE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+
+/*
+  latency histogram in microseconds, log-linear: values below
+  STATS_HIST_SUB have their own bucket, above that STATS_HIST_SUB
+  buckets per power of 2, the last one holds everything above ~2 min
+*/
+#define STATS_HIST_SHIFT   1
+#define STATS_HIST_SUB     (1 << STATS_HIST_SHIFT)
+#define STATS_HIST_BUCKETS (STATS_HIST_SUB + 26 * STATS_HIST_SUB)
+
+struct _hist_t {
+  uint64_t count[STATS_HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;             /* of all values */
+};
+typedef struct _hist_t hist_t;
+
+/* runtime counters, dumped on SIGUSR1 and exported by metrics.c */
+struct _stats_t {
+  uint64_t fwd_rx_calls;    /* receive syscalls on the listen socket */
+  uint64_t fwd_rx_pkts;     /* datagrams received from clients */
+  uint64_t fwd_rx_bytes;
+  uint64_t fwd_tx_calls;    /* send syscalls on outgoing sockets */
+  uint64_t fwd_tx_pkts;     /* datagrams forwarded to the destination */
+  uint64_t fwd_tx_bytes;
+  uint64_t fwd_errors;      /* forwards which could not be sent */
+  uint64_t rep_rx_calls;    /* receive syscalls on outgoing sockets */
+  uint64_t rep_rx_pkts;     /* datagrams received from the destination */
+  uint64_t rep_rx_bytes;
+  uint64_t rep_stray;       /* of those, sent from another address */
+  uint64_t rep_tx_calls;    /* send syscalls on the listen socket */
+  uint64_t rep_tx_pkts;     /* datagrams sent back to clients */
+  uint64_t rep_tx_bytes;
+  uint64_t rep_errors;      /* answers which could not be sent */
+  uint64_t sess_new;        /* sessions created */
+  uint64_t sess_expired;    /* sessions closed after TIMEOUT */
+  uint64_t sess_closed;     /* sessions closed because of an error or killed */
+  uint64_t sess_refused;    /* new clients dropped because of a session limit */
+  uint64_t pool_used;       /* sessions in use */
+  uint64_t pool_total;      /* sessions allocated */
+  uint64_t sock_warm;       /* new sessions which got a prebound socket */
+  uint64_t sock_cold;       /* new sessions which had to create a socket */
+  uint64_t gro_bufs;        /* buffers received holding several datagrams */
+  uint64_t gso_split;       /* such buffers sent one datagram at a time */
+  uint64_t ring_enters;     /* io_uring_enter() syscalls, --engine uring */
+  uint64_t q_queued;        /* datagrams queued because a socket buffer was full */
+  uint64_t q_flushed;       /* queued datagrams sent later */
+  uint64_t q_dropped;       /* datagrams dropped because a queue was full */
+  uint64_t q_waiting;       /* buffers in queues right now */
+  hist_t rtt;               /* first answer after a forward, per session */
+  hist_t busy;              /* time spent per loop iteration, with --metrics */
+};
+typedef struct _stats_t stats_t;
+
+extern stats_t *STATS;
+extern int FORKED;
+extern int BATCH;
+
+int  stats_init(int n);
+void stats_select(int n);
+int  stats_slots();
+stats_t *stats_slot(int n);
+void stats_hist_add(hist_t *h, uint64_t v);
+uint64_t stats_hist_bound(int i);
+void stats_dump();
+
+#endif
@@ -0,0 +1,202 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+/*
+  udpxctl - talk to the control socket of udpxd (--control)
+
+  Usage: udpxctl [-s path] list | kill <ip:port> [<listen>] | timeout [<seconds> [<listen>]]
+                           | upstreams
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CTL_DEFAULT "/var/run/udpxd.sock"
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: udpxctl [-s path] <command>\n\n"
+          "Commands:\n"
+          "list                  list the sessions\n"
+          "kill <ip:port> [<listen>]\n"
+          "                      close the sessions of a client, e.g. [::1]:5353,\n"
+          "                      only the one with the setup on listen ip:port if given\n"
+          "timeout [<seconds> [<listen>]]\n"
+          "                      show or change the idle timeout of sessions, of all\n"
+          "                      setups or only the one on listen ip:port\n"
+          "upstreams             show the destinations with their sessions, time to\n"
+          "                      the first answer, share of lost requests and state\n\n"
+          "Options:\n"
+          "-s <path>             control socket of udpxd, default: %s\n"
+          "-h                    print help message\n\n"
+          "With udpxd --workers every worker has its own control socket,\n"
+          "the path with the number of the worker appended.\n",
+          CTL_DEFAULT);
+}
+
+static int ctl_connect(const char *path) {
+  struct sockaddr_un sun;
+  int fd;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+    fprintf(stderr, "unable to connect to %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  return fd;
+}
+
+/* print a session line of the list command as a table row */
+static void print_session(char *line, int *header) {
+  char client[128], listen[128], upstream[128] = "-";
+  unsigned long long fp, fb, rp, rb;
+  double age, idle;
+  int port;
+
+  if(sscanf(line, "%127s %d %lf %lf %llu %llu %llu %llu %127s %127s",
+            client, &port, &age, &idle, &fp, &fb, &rp, &rb, listen, upstream) < 9) {
+    printf("%s\n", line);
+    return;
+  }
+
+  if(! *header) {
+    printf("%-46s %5s %9s %7s %10s %12s %10s %12s  %-22s %s\n", "client", "port", "age", "idle",
+           "fwd pkts", "fwd bytes", "rep pkts", "rep bytes", "listen", "upstream");
+    *header = 1;
+  }
+
+  printf("%-46s %5d %9.1f %7.1f %10llu %12llu %10llu %12llu  %-22s %s\n",
+         client, port, age, idle, fp, fb, rp, rb, listen, upstream);
+}
+
+/* print a line of the upstreams command as a table row */
+static void print_upstream(char *line, int *header) {
+  char listen[128], dst[128], state[8] = "";
+  double rtt, loss;
+  int sessions;
+
+  if(sscanf(line, "%127s %127s %d %lf %lf %7s", listen, dst, &sessions, &rtt, &loss, state) < 5) {
+    printf("%s\n", line);
+    return;
+  }
+
+  if(! *header) {
+    printf("%-28s %-28s %8s %10s %6s %5s\n", "listen", "destination", "sessions", "rtt ms",
+           "loss %", "state");
+    *header = 1;
+  }
+
+  printf("%-28s %-28s %8d %10.3f %6.1f %5s\n", listen, dst, sessions, rtt, loss, state);
+}
+
+int main(int argc, char *argv[]) {
+  char *path = CTL_DEFAULT;
+  char buf[65536], cmd[256];
+  size_t fill = 0;
+  ssize_t len;
+  char *line, *nl;
+  int opt, fd, i, header = 0, list, upstreams;
+
+  while((opt = getopt(argc, argv, "s:h?")) != -1) {
+    switch(opt) {
+    case 's':
+      path = optarg;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if(optind >= argc) {
+    usage();
+    return 1;
+  }
+
+  /* the command line is the command */
+  cmd[0] = '\0';
+  for(i=optind; i<argc; i++) {
+    if(strlen(cmd) + strlen(argv[i]) + 2 >= sizeof(cmd)) {
+      fprintf(stderr, "command is too long\n");
+      return 1;
+    }
+    strcat(cmd, argv[i]);
+    strcat(cmd, i < argc - 1 ? " " : "\n");
+  }
+  list = strcmp(argv[optind], "list") == 0;
+  upstreams = strcmp(argv[optind], "upstreams") == 0;
+
+  if((fd = ctl_connect(path)) < 0)
+    return 1;
+
+  if(write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd)) {
+    perror("unable to send command");
+    return 1;
+  }
+
+  /* answer lines until one starts with ok or error */
+  for(;;) {
+    len = read(fd, buf + fill, sizeof(buf) - 1 - fill);
+    if(len <= 0) {
+      fprintf(stderr, "connection closed by udpxd\n");
+      return 1;
+    }
+    fill += len;
+    buf[fill] = '\0';
+
+    for(line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+      *nl = '\0';
+      if(strncmp(line, "ok", 2) == 0) {
+        if(line[2] != '\0')
+          printf("%s\n", line + 3);
+        close(fd);
+        return 0;
+      }
+      if(strncmp(line, "error:", 6) == 0) {
+        fprintf(stderr, "%s\n", line);
+        close(fd);
+        return 1;
+      }
+      if(list)
+        print_session(line, &header);
+      else if(upstreams)
+        print_upstream(line, &header);
+      else
+        printf("%s\n", line);
+    }
+
+    fill -= line - buf;
+    memmove(buf, line, fill);
+  }
+}
@@ -22,17 +22,39 @@
 #include "udpxd.h"
 #include "net.h"
 #include "client.h"
+#include "worker.h"
+#include "config.h"
+#include "health.h"
 
 /* global client list */
 client_t *clients = NULL;
 int VERBOSE = 0;
 int FORKED = 0;
+int BATCH = BATCH_DEFAULT;
+int SESSIONS = SESSIONS_DEFAULT;
+int WORKERS = 1;
+int PREBIND = PREBIND_DEFAULT;
+int ENGINE = ENGINE_EVENT;
+int GSO = GSO_DEFAULT;
+int BINDMODE = BIND_LEAST;
+int BALANCE = BALANCE_HASH;
+int QUEUE = QUEUE_DEFAULT;
+int DROP = DROP_TAIL;
+int LOGRATE = 0;
+int LOGEVERY = 1;
+int TIMEOUT = MAXAGE;
+char *CONTROL = NULL;
+char *METRICS = NULL;
+char *SHM = NULL;
+char *PROBE = NULL;
+char *EXPECT = NULL;
+int INTERVAL = HEALTH_INTERVAL;
 
-/* parse ip:port */
+/* parse ip:port, the port may be a range lo-hi, see config_range() */
 int parse_ip(char *src, char *ip, char *pt) {
   char *ptr = NULL;
 
-  if (strchr(optarg, '[')) {
+  if (strchr(src, '[')) {
     /* v6 */
     ptr = strtok(&src[1], "]");
 
@@ -46,7 +68,7 @@ int parse_ip(char *src, char *ip, char *pt) {
     if(ptr)
       ptr = &ptr[1]; /* remove : */
   }
-  else if(strchr(optarg, ':')) {
+  else if(strchr(src, ':')) {
     /* v4 */
     ptr = strtok(src, ":");
     
@@ -63,7 +85,15 @@ int parse_ip(char *src, char *ip, char *pt) {
     return 1;
   }
 
-  if(ptr != NULL) {
+  if(ptr != NULL && strchr(ptr, '-') != NULL) {
+    /* got a range, checked by config_range() */
+    if(strlen(ptr) >= PORT_LEN) {
+      fprintf(stderr, "port range is too long!\n");
+      return 1;
+    }
+    strncpy(pt, ptr, strlen(ptr)+1);
+  }
+  else if(ptr != NULL) {
     /* got a port */
     if(strlen(ptr) > 5) {
       fprintf(stderr, "port is too long!\n");
@@ -89,21 +119,49 @@ int parse_ip(char *src, char *ip, char *pt) {
 
 void usage() {
   fprintf(stderr,
-          "Usage: udpxd [-lbdfpvhV]\n\n"
+          "Usage: udpxd [-lbmatkKifdpucBSwPeGqDRLCMsvhV]\n\n"
           "Options:\n"
           "--listen     -l <ip:port>     listen for incoming requests\n"
           "--bind       -b <ip[:port]>   bind ip used for outgoing requests\n"
           "                              specify port for promiscuous mode\n"
+          "                              or ports lo-hi, one per session\n"
+          "                              several ips or prefixes: ip,ip/n\n"
+          "--spread     -m <mode>        spread sessions over bind ips: least\n"
+          "                              sessions (default) or rr\n"
           "--to         -t <ip:port>     destination to forward requests to\n"
+          "                              several: ip:port,ip:port, by client\n"
+          "--balance    -a <mode>        choose one of several -t by client\n"
+          "                              hash (default) or faster answers: rtt\n"
+          "--probe      -k <payload>     check the health of -t with probes,\n"
+          "                              escapes: \\xNN \\0 \\t \\r \\n \\\\\n"
+          "--expect     -K <answer>      the answer to -k starts with, default: any\n"
+          "--interval   -i <s>           seconds between two probes, default: %d\n"
+          "--config     -f <file>        forwarding setups, one per line\n"
           "--daemon     -d               daemon mode, fork into background\n"
           "--pidfile    -p <file>        pidfile, default: /var/run/udpxd.pid\n"
           "--user       -u <user>        run as user (only in daemon mode)\n"
           "--chroot     -c <path>        chroot to <path> (only in daemon mode)\n"
+          "--batch      -B <n>           datagrams per send/receive syscall, default: %d\n"
+          "--sessions   -S <n>           sessions to preallocate, default: %d\n"
+          "--workers    -w <n>           number of worker processes, default: 1\n"
+          "--prebind    -P <n>           prebound outgoing sockets, default: %d\n"
+          "--engine     -e <name>        event (default) or uring (linux 6.0+)\n"
+          "--nogso      -G               don't coalesce datagrams (UDP GRO/GSO)\n"
+          "--queue      -q <n>           datagrams waiting per socket, default: %d\n"
+          "--drop       -D <policy>      if a queue is full, drop tail (default) or head\n"
+          "--control    -C <path>        control socket for udpxctl\n"
+          "--metrics    -M <addr>        serve metrics via http on ip:port or path\n"
+          "--shm        -s <file>        publish statistics in file for udpxstat\n"
           "--help       -h -?            print help message\n"
           "--version    -V               print program version\n"
-          "--verbose    -v               enable verbose logging\n\n"
-          "Options -l and -t are mandatory.\n\n"
-          "This is udpxd version %s.\n", UDPXD_VERSION
+          "--verbose    -v               enable verbose logging\n"
+          "--lograte    -R <n>           log at most n datagrams per second\n"
+          "--logevery   -L <n>           log only every n-th datagram\n\n"
+          "Options -l and -t are mandatory, unless -f is given. The port of -l\n"
+          "may be a range, e.g. 10000-19999, forwarded to a range of the same\n"
+          "size, or starting at the port of -t.\n\n"
+          "This is udpxd version %s.\n", HEALTH_INTERVAL, BATCH_DEFAULT, SESSIONS_DEFAULT, PREBIND_DEFAULT, QUEUE_DEFAULT,
+          UDPXD_VERSION
           );
 }
 
@@ -111,7 +169,10 @@ void usage() {
 
 int main ( int argc, char* argv[] ) {
   int opt, err;
-  char *inip, *inpt, *srcip, *srcpt, *dstip, *dstpt;
+  char *inip, *inpt, *srcip, *dstip;
+  char *config = NULL;
+  const char *msg;
+  listener_t *list = NULL, *l;
   char pidfile[MAX_BUFFER_SIZE];
   char user[128];
   char chroot[MAX_BUFFER_SIZE];
@@ -121,7 +182,13 @@ int main ( int argc, char* argv[] ) {
   static struct option longopts[] = {
     { "listen",    required_argument, NULL,           'l' },
     { "bind",      required_argument, NULL,           'b' },
+    { "spread",    required_argument, NULL,           'm' },
+    { "balance",   required_argument, NULL,           'a' },
     { "to",        required_argument, NULL,           't' },
+    { "probe",     required_argument, NULL,           'k' },
+    { "expect",    required_argument, NULL,           'K' },
+    { "interval",  required_argument, NULL,           'i' },
+    { "config",    required_argument, NULL,           'f' },
     { "version",   no_argument,       NULL,           'V' },
     { "help",      no_argument,       NULL,           'h' },
     { "verbose",   no_argument,       NULL,           'v' },
@@ -129,6 +196,20 @@ int main ( int argc, char* argv[] ) {
     { "pidfile",   required_argument, NULL,           'p' },
     { "user",      required_argument, NULL,           'u' },
     { "chroot",    required_argument, NULL,           'c' },
+    { "batch",     required_argument, NULL,           'B' },
+    { "sessions",  required_argument, NULL,           'S' },
+    { "workers",   required_argument, NULL,           'w' },
+    { "prebind",   required_argument, NULL,           'P' },
+    { "engine",    required_argument, NULL,           'e' },
+    { "nogso",     no_argument,       NULL,           'G' },
+    { "queue",     required_argument, NULL,           'q' },
+    { "drop",      required_argument, NULL,           'D' },
+    { "lograte",   required_argument, NULL,           'R' },
+    { "logevery",  required_argument, NULL,           'L' },
+    { "control",   required_argument, NULL,           'C' },
+    { "metrics",   required_argument, NULL,           'M' },
+    { "shm",       required_argument, NULL,           's' },
+    { NULL,        0,                 NULL,           0   }
   };
 
   if( argc < 2 ) {
@@ -136,14 +217,14 @@ int main ( int argc, char* argv[] ) {
     return 1;
   }
 
-  srcip = srcpt = dstip = inip = dstpt = inpt = NULL;
+  srcip = dstip = inip = inpt = NULL;
 
   /* set defaults */
   strncpy(pidfile, "/var/run/udpxd.pid", 19);
   strncpy(user, "nobody", 7);
   strncpy(chroot, "/var/empty", 11);
   
-  while ((opt = getopt_long(argc, argv, "l:b:t:u:c:vdVh?", longopts, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "l:b:m:a:t:k:K:i:f:u:c:p:B:S:w:P:e:Gq:D:R:L:C:M:s:vdVh?", longopts, NULL)) != -1) {
     switch (opt) {
     case 'V':
       fprintf(stderr, "This is %s version %s\n", argv[0], UDPXD_VERSION);
@@ -162,35 +243,46 @@ int main ( int argc, char* argv[] ) {
       break;
     case 'l':
       inip  = malloc(INET6_ADDRSTRLEN+1);
-      inpt  = malloc(6);
+      inpt  = malloc(PORT_LEN);
       if (parse_ip(optarg, inip, inpt) != 0) {
         fprintf(stderr, "Parameter -l has the format <ip-address:port>!\n");
         err = 1;
       }
       break;
     case 't':
-      dstip = malloc(INET6_ADDRSTRLEN+1);
-      dstpt = malloc(6);
-      if (parse_ip(optarg, dstip, dstpt) != 0) {
-        fprintf(stderr, "Parameter -t has the format <ip-address:port>!\n");
+      dstip = optarg; /* one or more destinations, checked by config_range() */
+      break;
+    case 'b':
+      srcip = optarg; /* one or more addresses, checked by config_range() */
+      break;
+    case 'k':
+      PROBE = optarg; /* checked by config_range() */
+      break;
+    case 'K':
+      EXPECT = optarg;
+      break;
+    case 'i':
+      INTERVAL = atoi(optarg);
+      if(INTERVAL < 1) {
+        fprintf(stderr, "Parameter -i must be 1 or more seconds!\n");
         err = 1;
       }
       break;
-    case 'b':
-      srcip = malloc(INET6_ADDRSTRLEN+1+5); // +5 is for port
-      srcpt = malloc(6);
-      if(strlen(optarg) > INET6_ADDRSTRLEN+5) {
-        fprintf(stderr, "Bind ip address is too long!\n");
+    case 'a':
+      if((BALANCE = config_balance(optarg)) < 0) {
+        fprintf(stderr, "Parameter -a must be hash or rtt!\n");
         err = 1;
       }
-      else {
-        if (strchr(optarg, ':') == NULL || parse_ip(optarg, srcip, srcpt) != 0) {
-          strncpy(srcip, optarg, INET6_ADDRSTRLEN+5);
-          srcip[INET6_ADDRSTRLEN+5-1] = '\0';
-          strncpy(srcpt, "0", 2);
-        }
+      break;
+    case 'm':
+      if((BINDMODE = config_spread(optarg)) < 0) {
+        fprintf(stderr, "Parameter -m must be least or rr!\n");
+        err = 1;
       }
       break;
+    case 'f':
+      config = optarg;
+      break;
     case 'p':
       strncpy(pidfile, optarg, MAX_BUFFER_SIZE);
       pidfile[MAX_BUFFER_SIZE-1] = '\0';
@@ -203,6 +295,87 @@ int main ( int argc, char* argv[] ) {
       strncpy(chroot, optarg, MAX_BUFFER_SIZE);
       chroot[MAX_BUFFER_SIZE-1] = '\0';
       break;
+    case 'B':
+      BATCH = atoi(optarg);
+      if(BATCH < 1 || BATCH > BATCH_MAX) {
+        fprintf(stderr, "Parameter -B must be between 1 and %d!\n", BATCH_MAX);
+        err = 1;
+      }
+      break;
+    case 'S':
+      SESSIONS = atoi(optarg);
+      if(SESSIONS < 0) {
+        fprintf(stderr, "Parameter -S must be a positive number!\n");
+        err = 1;
+      }
+      break;
+    case 'w':
+      WORKERS = atoi(optarg);
+      if(WORKERS < 1 || WORKERS > WORKERS_MAX) {
+        fprintf(stderr, "Parameter -w must be between 1 and %d!\n", WORKERS_MAX);
+        err = 1;
+      }
+      break;
+    case 'P':
+      PREBIND = atoi(optarg);
+      if(PREBIND < 0) {
+        fprintf(stderr, "Parameter -P must be a positive number!\n");
+        err = 1;
+      }
+      break;
+    case 'G':
+      GSO = 0;
+      break;
+    case 'q':
+      QUEUE = atoi(optarg);
+      if(QUEUE < 0) {
+        fprintf(stderr, "Parameter -q must be a positive number!\n");
+        err = 1;
+      }
+      break;
+    case 'D':
+      if(strcmp(optarg, "tail") == 0)
+        DROP = DROP_TAIL;
+      else if(strcmp(optarg, "head") == 0)
+        DROP = DROP_HEAD;
+      else {
+        fprintf(stderr, "Parameter -D must be tail or head!\n");
+        err = 1;
+      }
+      break;
+    case 'R':
+      LOGRATE = atoi(optarg);
+      if(LOGRATE < 0) {
+        fprintf(stderr, "Parameter -R must be a positive number!\n");
+        err = 1;
+      }
+      break;
+    case 'L':
+      LOGEVERY = atoi(optarg);
+      if(LOGEVERY < 1) {
+        fprintf(stderr, "Parameter -L must be 1 or more!\n");
+        err = 1;
+      }
+      break;
+    case 'C':
+      CONTROL = optarg;
+      break;
+    case 'M':
+      METRICS = optarg;
+      break;
+    case 's':
+      SHM = optarg;
+      break;
+    case 'e':
+      if(strcmp(optarg, "event") == 0)
+        ENGINE = ENGINE_EVENT;
+      else if(strcmp(optarg, "uring") == 0)
+        ENGINE = ENGINE_URING;
+      else {
+        fprintf(stderr, "Parameter -e must be event or uring!\n");
+        err = 1;
+      }
+      break;
     default:
       usage();
       return 1;
@@ -210,41 +383,47 @@ int main ( int argc, char* argv[] ) {
     }
   }
 
-  if(inip == NULL) {
+  if(inip == NULL && (config == NULL || dstip != NULL)) {
     fprintf(stderr, "-l parameter is required!\n");
     usage();
     err = 1;
   }
   
-  if(dstip == NULL) {
+  if(dstip == NULL && (config == NULL || inip != NULL)) {
     fprintf(stderr, "-t parameter is required!\n");
     usage();
     err = 1;
   }
 
-  if(srcip != NULL && dstip != NULL) {
-    if(is_v6(srcip) != is_v6(dstip)) {
-      fprintf(stderr, "Bind ip and destination ip must be both v4 or v6 and can't be mixed!\n");
+  if(EXPECT != NULL && PROBE == NULL) {
+    fprintf(stderr, "Parameter -K needs -k!\n");
+    err = 1;
+  }
+
+  if(! err && inip != NULL) {
+    if((msg = config_range(&list, inip, inpt, srcip, dstip)) != NULL) {
+      fprintf(stderr, "%s!\n", msg);
       err = 1;
     }
   }
 
+  if(! err && config != NULL)
+    err = config_load(config, &list);
+
   if(! err) {
-    err = start_listener (inip, inpt, srcip, srcpt, dstip, dstpt, pidfile, chroot, user);
+    err = start_listeners(list, pidfile, chroot, user);
+  }
+
+  while(list != NULL) {
+    l = list->next;
+    listener_free(list);
+    list = l;
   }
   
-  if(srcip != NULL)
-    free(srcip);
-  if(srcpt != NULL)
-    free(srcpt);
-  if(dstip != NULL)
-    free(dstip);
   if(inip != NULL)
     free(inip);
   if(inpt != NULL)
     free(inpt);
-  if(dstpt != NULL)
-    free(dstpt);
 
   return err;
 }
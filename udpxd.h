@@ -38,6 +38,8 @@
 
 #define UDPXD_VERSION "0.0.4"
 
+#define PORT_LEN 12 /* a port or a range of ports, "65535-65535" + \0 */
+
 
 void usage();
 int parse_ip(char *src, char *ip, char *pt);
@@ -0,0 +1,284 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+/*
+  udpxstat - print the statistics udpxd publishes with --shm
+
+  Usage: udpxstat [-i seconds] [-n count] [file]
+
+  Only reads the file, udpxd doesn't notice, see shm.c.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "shm.h"
+
+#define SHM_DEFAULT "/dev/shm/udpxd"
+#define MAXWORKERS  64         /* columns printed */
+
+/* a row of the table, a counter of stats_t */
+struct _field_t {
+  const char *name;
+  size_t offset;
+};
+typedef struct _field_t field_t;
+
+#define F(name, field) { name, offsetof(stats_t, field) }
+
+static const field_t fields[] = {
+  F("fwd rx pkts", fwd_rx_pkts),    F("fwd rx bytes", fwd_rx_bytes),
+  F("fwd rx calls", fwd_rx_calls),  F("fwd tx pkts", fwd_tx_pkts),
+  F("fwd tx bytes", fwd_tx_bytes),  F("fwd tx calls", fwd_tx_calls),
+  F("fwd errors", fwd_errors),      F("rep rx pkts", rep_rx_pkts),
+  F("rep rx bytes", rep_rx_bytes),  F("rep rx calls", rep_rx_calls),
+  F("rep stray", rep_stray),        F("rep tx pkts", rep_tx_pkts),
+  F("rep tx bytes", rep_tx_bytes),  F("rep tx calls", rep_tx_calls),
+  F("rep errors", rep_errors),      F("sessions new", sess_new),
+  F("sessions expired", sess_expired), F("sessions closed", sess_closed),
+  F("sessions refused", sess_refused),
+  F("sessions allocated", pool_total), F("sockets prebound", sock_warm),
+  F("sockets created", sock_cold),
+  F("queued", q_queued),            F("queue flushed", q_flushed),
+  F("queue dropped", q_dropped),    F("gro buffers", gro_bufs),
+  F("gso split", gso_split),        F("ring enters", ring_enters),
+};
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: udpxstat [-i seconds] [-n count] [file]\n\n"
+          "Options:\n"
+          "-i <seconds>          print again every n seconds\n"
+          "-n <count>            stop after count times, default: 1, 0 with -i\n"
+          "-h                    print help message\n\n"
+          "file is the one given to udpxd --shm, default: %s\n",
+          SHM_DEFAULT);
+}
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* copy a consistent snapshot of a slot, returns -1 if it is being
+   written for too long, e.g. because the worker died meanwhile */
+static int snapshot(shmslot_t *slot, shmslot_t *copy) {
+  uint64_t seq;
+  int tries;
+
+  for(tries=0; tries<1000000; tries++) {
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if(seq & 1)
+      continue;
+    memcpy((char *)copy + sizeof(copy->seq), (char *)slot + sizeof(slot->seq),
+           sizeof(shmslot_t) - sizeof(slot->seq));
+    atomic_thread_fence(memory_order_acquire);
+    if(atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+      return 0;
+  }
+
+  return -1;
+}
+
+/* smallest value of histogram bucket i, see stats.c */
+static uint64_t hist_value(int i) {
+  int e;
+  if(i < STATS_HIST_SUB)
+    return i;
+  e = (i - STATS_HIST_SUB) / STATS_HIST_SUB + STATS_HIST_SHIFT;
+  return (uint64_t)(STATS_HIST_SUB + (i - STATS_HIST_SUB) % STATS_HIST_SUB) << (e - STATS_HIST_SHIFT);
+}
+
+/* upper bound of the bucket holding percentile p */
+static uint64_t hist_pct(hist_t *h, double p) {
+  uint64_t sum = 0, want = (uint64_t)(h->total * p);
+  int i;
+
+  if(h->total == 0)
+    return 0;
+  for(i=0; i<STATS_HIST_BUCKETS - 1; i++) {
+    sum += h->count[i];
+    if(sum > want)
+      return hist_value(i + 1) - 1;
+  }
+  return hist_value(i);
+}
+
+static void hist_merge(hist_t *to, hist_t *from) {
+  int i;
+  for(i=0; i<STATS_HIST_BUCKETS; i++)
+    to->count[i] += from->count[i];
+  to->total += from->total;
+  to->sum   += from->sum;
+}
+
+static void row_u64(const char *name, uint64_t *v, int n) {
+  int i;
+  printf("%-20s", name);
+  for(i=0; i<n; i++)
+    printf(" %14llu", (unsigned long long)v[i]);
+  printf("\n");
+}
+
+static void row_hist(const char *name, hist_t *h, int n, double p) {
+  int i;
+  printf("%-20s", name);
+  for(i=0; i<n; i++)
+    printf(" %14llu", (unsigned long long)hist_pct(&h[i], p));
+  printf("\n");
+}
+
+/* print all workers and the total, returns -1 if the file is unusable */
+static int dump(unsigned char *region, size_t size) {
+  shmhead_t *head = (shmhead_t *)region;
+  static shmslot_t slots[MAXWORKERS + 1];
+  static hist_t rtt[MAXWORKERS + 1], busy[MAXWORKERS + 1];
+  uint64_t v[MAXWORKERS + 1], now = now_us();
+  size_t f;
+  int i, j, n;
+
+  if(head->magic != SHM_MAGIC || head->version != SHM_VERSION
+     || head->slotsize != SHM_SLOTSIZE || SHM_HEADSIZE + head->slotsize * head->slots > size) {
+    fprintf(stderr, "not a statistics file of this udpxd version\n");
+    return -1;
+  }
+
+  n = head->slots < MAXWORKERS ? head->slots : MAXWORKERS;
+  memset(&rtt[n], 0, sizeof(hist_t));
+  memset(&busy[n], 0, sizeof(hist_t));
+
+  for(i=0; i<n; i++) {
+    if(snapshot((shmslot_t *)(region + SHM_HEADSIZE + SHM_SLOTSIZE * i), &slots[i]) != 0) {
+      fprintf(stderr, "worker %d: no consistent snapshot\n", i);
+      memset(&slots[i], 0, sizeof(shmslot_t));
+    }
+    rtt[i]  = slots[i].stats.rtt;
+    busy[i] = slots[i].stats.busy;
+    hist_merge(&rtt[n], &rtt[i]);
+    hist_merge(&busy[n], &busy[i]);
+  }
+
+  printf("%-20s", "udpxd");
+  for(i=0; i<n; i++)
+    printf(" %13s%d", "worker ", i);
+  printf(" %14s\n", "total");
+
+  printf("%-20s", "pid");
+  for(i=0; i<n; i++)
+    printf(" %14u", slots[i].pid);
+  printf(" %14u\n", head->pid);
+
+  printf("%-20s", "updated ms ago");
+  for(i=0; i<n; i++) {
+    if(slots[i].updated == 0)
+      printf(" %14s", "never");
+    else
+      printf(" %14.1f", (now - slots[i].updated) / 1000.0);
+  }
+  printf("\n");
+
+  for(i=0; i<n; i++)
+    v[i] = slots[i].timeout;
+  row_u64("timeout", v, n);
+
+  for(v[n]=0, i=0; i<n; i++)
+    v[n] += v[i] = slots[i].sessions;
+  row_u64("sessions", v, n + 1);
+
+  for(v[n]=0, i=0; i<n; i++)
+    v[n] += v[i] = slots[i].queued;
+  row_u64("queue waiting", v, n + 1);
+
+  for(f=0; f<sizeof(fields) / sizeof(fields[0]); f++) {
+    for(v[n]=0, j=0; j<n; j++)
+      v[n] += v[j] = *(uint64_t *)((char *)&slots[j].stats + fields[f].offset);
+    row_u64(fields[f].name, v, n + 1);
+  }
+
+  row_hist("response p50 us", rtt, n + 1, 0.50);
+  row_hist("response p99 us", rtt, n + 1, 0.99);
+  row_hist("loop busy p50 us", busy, n + 1, 0.50);
+  row_hist("loop busy p99 us", busy, n + 1, 0.99);
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  char *path = SHM_DEFAULT;
+  unsigned char *region;
+  struct stat st;
+  int opt, fd, interval = 0, count = -1, i;
+
+  while((opt = getopt(argc, argv, "i:n:h?")) != -1) {
+    switch(opt) {
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    case 'n':
+      count = atoi(optarg);
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if(optind < argc)
+    path = argv[optind];
+  if(count < 0)
+    count = interval ? 0 : 1;
+
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "unable to open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  if((size_t)st.st_size < SHM_HEADSIZE) {
+    fprintf(stderr, "%s is not a statistics file\n", path);
+    return 1;
+  }
+
+  region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(region == MAP_FAILED) {
+    perror("unable to map statistics file");
+    return 1;
+  }
+
+  for(i=0; count == 0 || i < count; i++) {
+    if(i > 0) {
+      sleep(interval);
+      printf("\n");
+    }
+    if(dump(region, st.st_size) != 0)
+      return 1;
+    fflush(stdout);
+  }
+
+  return 0;
+}
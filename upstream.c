@@ -0,0 +1,314 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+
+#include "upstream.h"
+
+/*
+  A forwarding setup may send to several destinations (-t ip:port,ip:port).
+  Every new session is assigned one of them by a hash of the client
+  source address and port, so a client keeps its destination when its
+  session is closed and opened again later, see dstset_pick().
+
+  The hash is looked up in a table as in Google's Maglev load
+  balancer: every destination fills the slots of its own permutation
+  of the table in turns, until all slots are taken. Each destination
+  owns about the same number of slots, and adding or removing one
+  moves only few slots of the others. A lookup is one modulo and one
+  array access.
+
+  With --balance rtt the hash only suggests a destination: it is
+  compared with another one picked at random and the session goes to
+  the one with the lower expected time to an answer ("power of two
+  choices"). For this every destination keeps a moving average of the
+  time to the first answer after a request and of the share of
+  requests which got no answer at all, see upstream_answered() and
+  upstream_lost(), and counts the sessions waiting for an answer, so a
+  destination which stopped answering is avoided right away. The
+  estimates are per process, with -w every worker measures its own
+  sessions.
+
+  A destination is ejected from the lookup table when the kernel
+  reports it unreachable (icmp, see health.c), or when UPSTREAM_FAILS
+  requests in a row got no answer. The latter only counts for
+  destinations which answered before, some protocols never answer.
+  Rebuilding the table moves only the slots of the ejected one, its
+  sessions move on with their next request. With --probe it is taken
+  back when it answers a probe, otherwise it gets sessions again after
+  UPSTREAM_HOLD seconds. If all destinations of a set are ejected, the
+  table uses all of them.
+*/
+
+/* fnv-1a with a murmur3 finalizer, the seed gives independent hashes */
+static uint32_t upstream_hash(const uint8_t *data, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  size_t i;
+
+  for(i=0; i<len; i++) {
+    h ^= data[i];
+    h *= 16777619u;
+  }
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* address and port of sa as bytes to hash, returns their length */
+static size_t upstream_key(struct sockaddr *sa, uint8_t *key) {
+  if(sa->sa_family == AF_INET6) {
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)sa;
+    memcpy(key, &v6->sin6_addr, 16);
+    memcpy(key + 16, &v6->sin6_port, 2);
+    return 18;
+  }
+  else {
+    struct sockaddr_in *v4 = (struct sockaddr_in *)sa;
+    memcpy(key, &v4->sin_addr, 4);
+    memcpy(key + 4, &v4->sin_port, 2);
+    return 6;
+  }
+}
+
+/* fill the lookup table, every destination takes the next free slot
+   of its permutation in turn */
+static void dstset_build(dstset_t *ds) {
+  uint32_t next[UPSTREAM_MAX];
+  uint32_t slot;
+  int i, filled = 0;
+
+  memset(ds->table, UPSTREAM_NONE, UPSTREAM_TABLE);
+  memset(next, 0, sizeof(next));
+
+  while(1) {
+    for(i=0; i<ds->count; i++) {
+      if(ds->ups[i].down && ds->healthy > 0)
+        continue;
+      do {
+        slot = (ds->ups[i].offset + next[i] * ds->ups[i].skip) % UPSTREAM_TABLE;
+        next[i]++;
+      } while(ds->table[slot] != UPSTREAM_NONE);
+
+      ds->table[slot] = i;
+      if(++filled == UPSTREAM_TABLE)
+        return;
+    }
+  }
+}
+
+/* takes over the hosts and frees the array, at most UPSTREAM_MAX */
+dstset_t *dstset_new(host_t **hosts, int count) {
+  dstset_t *ds = malloc(sizeof(dstset_t));
+  uint8_t key[18];
+  size_t len;
+  int i;
+
+  if(ds == NULL)
+    return NULL;
+
+  ds->ups   = calloc(count, sizeof(upstream_t));
+  ds->count = count;
+  ds->table = NULL;
+  ds->healthy = count;
+  ds->mode  = BALANCE_HASH;
+  ds->probe = ds->expect = NULL;
+  ds->probe_len = ds->expect_len = 0;
+  ds->users = 1;
+
+  if(ds->ups == NULL || (count > 1 && (ds->table = malloc(UPSTREAM_TABLE)) == NULL)) {
+    free(ds->ups);
+    free(ds);
+    return NULL;
+  }
+
+  for(i=0; i<count; i++) {
+    ds->ups[i].host   = hosts[i];
+    ds->ups[i].set    = ds;
+    len = upstream_key(host_sa(hosts[i]), key);
+    ds->ups[i].offset = upstream_hash(key, len, 0) % UPSTREAM_TABLE;
+    ds->ups[i].skip   = upstream_hash(key, len, 1) % (UPSTREAM_TABLE - 1) + 1;
+  }
+  free(hosts);
+
+  if(ds->table != NULL)
+    dstset_build(ds);
+
+  return ds;
+}
+
+/* one more setup using the set */
+dstset_t *dstset_ref(dstset_t *ds) {
+  ds->users++;
+  return ds;
+}
+
+/* expected time to an answer, a lost request costs UPSTREAM_LOST_US
+   like one to a destination which never answered yet. A new session has
+   to wait for those still waiting. */
+static int64_t upstream_cost(upstream_t *up) {
+  int64_t rtt = up->rtt ? up->rtt : UPSTREAM_LOST_US;
+  return rtt * (up->pending + 1) + (int64_t)up->loss * UPSTREAM_LOST_US / UPSTREAM_ONE;
+}
+
+/* xorshift, good enough to pick the second choice */
+static uint32_t upstream_random() {
+  static uint32_t x = 0;
+
+  if(x == 0)
+    x = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ 0x9e3779b9u;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return x;
+}
+
+/* the destination of a new session from src */
+upstream_t *dstset_pick(dstset_t *ds, struct sockaddr *src) {
+  upstream_t *a, *b;
+  uint8_t key[18];
+  size_t len;
+  int i;
+
+  if(ds->table == NULL)
+    return &ds->ups[0];
+
+  len = upstream_key(src, key);
+  i = ds->table[upstream_hash(key, len, 2) % UPSTREAM_TABLE];
+  a = &ds->ups[i];
+
+  /* some sessions keep it anyway, so slow destinations are still measured */
+  if(ds->mode == BALANCE_HASH || upstream_random() % UPSTREAM_EXPLORE == 0)
+    return a;
+
+  /* any other one */
+  b = &ds->ups[(i + 1 + upstream_random() % (ds->count - 1)) % ds->count];
+  if(b->down && ds->healthy > 0)
+    return a;
+  if(upstream_cost(b) < upstream_cost(a)
+     || (upstream_cost(b) == upstream_cost(a) && b->sessions < a->sessions))
+    return b;
+
+  return a;
+}
+
+/* a session sent a request and waits for the answer */
+void upstream_sent(upstream_t *up) {
+  up->pending++;
+}
+
+/* the first answer after a request came after us microseconds */
+void upstream_answered(upstream_t *up, int64_t us) {
+  up->pending--;
+  up->fails = 0;
+  if(up->rtt == 0)
+    up->rtt = us > 0 ? us : 1;
+  else
+    up->rtt += (us - up->rtt) / 8;
+  up->loss -= (up->loss + 7) / 8;
+}
+
+/* a request got no answer, the session may still be waiting for the
+   next one */
+void upstream_lost(upstream_t *up) {
+  up->loss += (UPSTREAM_ONE - up->loss) / 8;
+  if(up->rtt != 0)
+    upstream_fail(up, 0);
+}
+
+/* a session is closed, waiting for an answer which never came */
+void upstream_done(upstream_t *up, int waiting) {
+  if(waiting) {
+    upstream_lost(up);
+    up->pending--;
+  }
+  up->sessions--;
+}
+
+static int ejected = 0; /* destinations of all sets */
+
+/* a request or probe got no answer, or with hard the destination is
+   unreachable: eject it after UPSTREAM_FAILS in a row, or at once */
+void upstream_fail(upstream_t *up, int hard) {
+  up->fails++;
+  if(up->down || (! hard && up->fails < UPSTREAM_FAILS))
+    return;
+
+  up->down  = 1;
+  up->since = time(NULL);
+  up->set->healthy--;
+  ejected++;
+  if(up->set->table != NULL)
+    dstset_build(up->set);
+
+  fprintf(stderr, "destination %s:%d is down, %s\n", host_ip(up->host), up->host->port,
+          hard ? "unreachable" : "no answer");
+}
+
+/* back into the lookup table */
+static void upstream_admit(upstream_t *up, const char *why) {
+  up->down = 0;
+  up->set->healthy++;
+  ejected--;
+  if(up->set->table != NULL)
+    dstset_build(up->set);
+
+  fprintf(stderr, "destination %s:%d is up again, %s\n", host_ip(up->host), up->host->port, why);
+}
+
+/* answered a probe, take it back if ejected */
+void upstream_alive(upstream_t *up) {
+  up->fails = 0;
+  if(up->down)
+    upstream_admit(up, "answered");
+}
+
+/* give an ejected destination without probes another chance, one more
+   failure ejects it again */
+void upstream_retry(upstream_t *up) {
+  up->fails = UPSTREAM_FAILS - 1;
+  if(up->down)
+    upstream_admit(up, "on probation");
+}
+
+/* number of ejected destinations */
+int upstream_ejected() {
+  return ejected;
+}
+
+/* the set is gone when its last user is done */
+void dstset_free(dstset_t *ds) {
+  int i;
+
+  if(--ds->users > 0)
+    return;
+  for(i=0; i<ds->count; i++)
+    host_clean(ds->ups[i].host);
+  free(ds->ups);
+  free(ds->table);
+  free(ds->probe);
+  free(ds->expect);
+  free(ds);
+}
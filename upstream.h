@@ -0,0 +1,97 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+
+#ifndef _HAVE_UPSTREAM_H
+#define _HAVE_UPSTREAM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "host.h"
+
+#define UPSTREAM_MAX   64   /* destinations per setup */
+#define UPSTREAM_TABLE 4093 /* slots of the lookup table, prime, see dstset_build() */
+#define UPSTREAM_NONE  0xff /* empty slot */
+
+#define UPSTREAM_ONE     65536   /* loss of 100% */
+#define UPSTREAM_LOST_US 1000000 /* a request not answered after 1s is lost */
+#define UPSTREAM_EXPLORE 32      /* every n-th session keeps its hash destination */
+#define UPSTREAM_FAILS   3       /* ejected after this many requests or probes in a row got no answer */
+#define UPSTREAM_HOLD    10      /* seconds an ejected destination gets no sessions, without probes */
+
+/* how a new session chooses its destination, see dstset_pick() */
+#define BALANCE_HASH 0  /* by the hash of the client address */
+#define BALANCE_RTT  1  /* the faster of two */
+
+struct _dstset_t;
+
+/* one destination of a forwarding setup */
+struct _upstream_t {
+  host_t *host;             /* ip+port, the first port of a listen range */
+  struct _dstset_t *set;    /* the set it belongs to */
+  uint32_t offset;          /* first slot in the lookup table */
+  uint32_t skip;            /* distance of its next slots */
+  int64_t rtt;              /* smoothed time to the first answer, us, 0 if unknown */
+  int32_t loss;             /* smoothed share of lost requests, of UPSTREAM_ONE */
+  int sessions;             /* sessions sending to it */
+  int pending;              /* sessions waiting for an answer */
+  int fails;                /* requests or probes in a row without an answer */
+  int down;                 /* ejected, gets no new sessions */
+  time_t since;             /* when it was ejected */
+};
+typedef struct _upstream_t upstream_t;
+
+/* the destinations of a forwarding setup, shared by the setups of a
+   listen port range */
+struct _dstset_t {
+  upstream_t *ups;          /* destinations */
+  int count;                /* number of destinations */
+  uint8_t *table;           /* slot => index into ups, NULL with one destination */
+  int healthy;              /* destinations not ejected */
+  int mode;                 /* BALANCE_HASH or BALANCE_RTT */
+  char *probe;              /* payload of health probes, NULL if not probed */
+  size_t probe_len;
+  char *expect;             /* an answer to a probe starts with it, NULL for any */
+  size_t expect_len;
+  int users;                /* forwarding setups using the set */
+};
+typedef struct _dstset_t dstset_t;
+
+dstset_t *dstset_new(host_t **hosts, int count);
+dstset_t *dstset_ref(dstset_t *ds);
+upstream_t *dstset_pick(dstset_t *ds, struct sockaddr *src);
+void upstream_sent(upstream_t *up);
+void upstream_answered(upstream_t *up, int64_t us);
+void upstream_lost(upstream_t *up);
+void upstream_done(upstream_t *up, int waiting);
+void upstream_fail(upstream_t *up, int hard);
+void upstream_alive(upstream_t *up);
+void upstream_retry(upstream_t *up);
+int upstream_ejected();
+void dstset_free(dstset_t *ds);
+
+#endif
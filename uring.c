@@ -0,0 +1,749 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "uring.h"
+
+/*
+  io_uring engine, used by main_loop() instead of the event engine in
+  event.c if requested  with --engine uring. Instead of  waiting for a
+  socket to become readable and then receiving from it, every socket has
+  one multishot recvmsg request pending, which delivers each datagram
+  into a buffer taken from a ring of provided buffers. Sends are queued
+  as sendmsg requests, the datagram is sent straight from the buffer it
+  has been received into. Everything queued during one loop iteration is
+  submitted with the same io_uring_enter() call which waits for the next
+  completions, so at high packet rates there is about one syscall per
+  loop iteration instead of one per socket and direction.
+
+  Other file descriptors (e.g. the epoll set of event.c) can be watched
+  with uring_poll().
+
+  Requires linux 6.0 or newer, uring_init() fails on older kernels so
+  that the caller can fall back to the event engine. We use the raw
+  syscalls, liburing is not required.
+*/
+
+#ifdef HAVE_URING
+
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#define URING_BGID     1          /* our buffer group */
+#define URING_NAMELEN  sizeof(struct sockaddr_in6)
+#define URING_TXS      (URING_BUFS * 4) /* split sends need more than one per buffer */
+#define URING_PAYLOAD  65536      /* more than the largest udp datagram */
+
+/* the user_data of a request is a pointer to its owner or send context
+   with the kind of request in the lower bits */
+#define UD_RECV  0UL
+#define UD_SEND  1UL
+#define UD_POLL  2UL
+#define UD_MASK  3UL
+
+/* a pending send */
+struct _uring_tx_t {
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_storage to;   /* copied, the owner might be gone before it completes */
+  cmsgbuf_t ctl;                /* UDP_SEGMENT */
+  size_t gso;                   /* datagram size, 0 if just one */
+  int fd;
+  int bid;                      /* provided buffer to give back afterwards, -1 if none */
+  void *owner;
+  uring_sent_f onsent;
+  struct _uring_tx_t *parent;   /* set for the single datagrams of a split send */
+  int pending;                  /* single datagrams not completed yet */
+  int sent;                     /* single datagrams sent */
+  int err;                      /* error of one of them */
+  struct _uring_tx_t *next;     /* free list */
+};
+typedef struct _uring_tx_t uring_tx_t;
+
+static int ring = -1;
+
+/* submission queue */
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned sq_entries;
+static unsigned sq_local;       /* our tail, published by uring_submit() */
+static struct io_uring_sqe *sqes;
+
+/* completion queue */
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+
+static void *sq_map = NULL, *cq_map = NULL;
+static size_t sq_len, cq_len, sqes_len;
+
+/* provided buffers */
+static struct io_uring_buf_ring *bring = NULL;
+static size_t bring_len;
+static unsigned short bring_tail;
+static unsigned char *bufs = NULL;
+static size_t bufsize;          /* recvmsg header + address + payload */
+static int bufrefs[URING_BUFS]; /* pending users of each buffer */
+
+/* the header of every buffer, see io_uring_recvmsg_out */
+static struct msghdr recv_msg;
+
+static uring_tx_t *txs = NULL;
+static uring_tx_t *txfree = NULL;
+
+static uring_recv_f onrecv = NULL;
+static uring_stop_f onstop = NULL;
+
+static int poll_fd = -1;
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(unsigned submit, unsigned min, unsigned flags, void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, ring, submit, min, flags, arg, argsz);
+}
+
+static int sys_register(unsigned op, void *arg, unsigned n) {
+  return (int)syscall(__NR_io_uring_register, ring, op, arg, n);
+}
+
+/* multishot recvmsg appeared in 6.0 and cannot be probed for */
+static int uring_kernel_ok() {
+  struct utsname un;
+  int major = 0, minor = 0;
+
+  if(uname(&un) != 0 || sscanf(un.release, "%d.%d", &major, &minor) != 2)
+    return 0;
+
+  return major > 6 || (major == 6 && minor >= 0);
+}
+
+/* give a buffer back to the kernel, tail shares memory with bufs[0],
+   therefore only the other members are written */
+static void buf_put(int bid) {
+  struct io_uring_buf *b = &bring->bufs[bring_tail & (URING_BUFS - 1)];
+
+  b->addr = (uint64_t)(uintptr_t)(bufs + (size_t)bid * bufsize);
+  b->len  = bufsize;
+  b->bid  = bid;
+  bring_tail++;
+  __atomic_store_n(&bring->tail, bring_tail, __ATOMIC_RELEASE);
+}
+
+static void buf_unref(int bid) {
+  if(bid >= 0 && --bufrefs[bid] == 0)
+    buf_put(bid);
+}
+
+/* the provided buffer buf points into, -1 if none */
+static int buf_id(void *buf) {
+  unsigned char *p = buf;
+  if(p < bufs || p >= bufs + (size_t)URING_BUFS * bufsize)
+    return -1;
+  return (int)((p - bufs) / bufsize);
+}
+
+/* next free submission entry, NULL if the queue is full even after submitting */
+static struct io_uring_sqe *uring_sqe() {
+  struct io_uring_sqe *sqe;
+  unsigned idx;
+
+  if(sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+    uring_submit();
+    if(sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+      return NULL;
+  }
+
+  idx = sq_local & *sq_mask;
+  sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sq_array[idx] = idx;
+  sq_local++;
+
+  return sqe;
+}
+
+static int uring_map(struct io_uring_params *p) {
+  sq_len   = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  cq_len   = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+
+  if(p->features & IORING_FEAT_SINGLE_MMAP) {
+    if(cq_len > sq_len)
+      sq_len = cq_len;
+    cq_len = sq_len;
+  }
+
+  sq_map = mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                ring, IORING_OFF_SQ_RING);
+  if(sq_map == MAP_FAILED) {
+    sq_map = NULL;
+    return -1;
+  }
+
+  if(p->features & IORING_FEAT_SINGLE_MMAP)
+    cq_map = sq_map;
+  else {
+    cq_map = mmap(NULL, cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  ring, IORING_OFF_CQ_RING);
+    if(cq_map == MAP_FAILED) {
+      cq_map = NULL;
+      return -1;
+    }
+  }
+
+  sqes = mmap(NULL, sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+              ring, IORING_OFF_SQES);
+  if(sqes == MAP_FAILED) {
+    sqes = NULL;
+    return -1;
+  }
+
+  sq_head    = (unsigned *)((char *)sq_map + p->sq_off.head);
+  sq_tail    = (unsigned *)((char *)sq_map + p->sq_off.tail);
+  sq_mask    = (unsigned *)((char *)sq_map + p->sq_off.ring_mask);
+  sq_array   = (unsigned *)((char *)sq_map + p->sq_off.array);
+  sq_entries = p->sq_entries;
+  sq_local   = *sq_tail;
+
+  cq_head = (unsigned *)((char *)cq_map + p->cq_off.head);
+  cq_tail = (unsigned *)((char *)cq_map + p->cq_off.tail);
+  cq_mask = (unsigned *)((char *)cq_map + p->cq_off.ring_mask);
+  cqes    = (struct io_uring_cqe *)((char *)cq_map + p->cq_off.cqes);
+
+  return 0;
+}
+
+/* the provided buffers, only pages the kernel writes into get memory */
+static int uring_bufs() {
+  struct io_uring_buf_reg reg;
+  int i;
+
+  bufsize = sizeof(struct io_uring_recvmsg_out) + URING_NAMELEN + BATCH_CTLLEN + URING_PAYLOAD;
+  bufsize = (bufsize + 63) & ~(size_t)63;
+
+  bufs = mmap(NULL, URING_BUFS * bufsize, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if(bufs == MAP_FAILED) {
+    bufs = NULL;
+    return -1;
+  }
+
+  bring_len = URING_BUFS * sizeof(struct io_uring_buf);
+  bring = mmap(NULL, bring_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(bring == MAP_FAILED) {
+    bring = NULL;
+    return -1;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr    = (uint64_t)(uintptr_t)bring;
+  reg.ring_entries = URING_BUFS;
+  reg.bgid         = URING_BGID;
+
+  if(sys_register(IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    return -1;
+
+  bring_tail = 0;
+  for(i=0; i<URING_BUFS; i++) {
+    bufrefs[i] = 0;
+    buf_put(i);
+  }
+
+  memset(&recv_msg, 0, sizeof(recv_msg));
+  recv_msg.msg_namelen    = URING_NAMELEN;
+  recv_msg.msg_controllen = BATCH_CTLLEN;
+
+  return 0;
+}
+
+/* returns -1 if io_uring is not available, the reason has been printed */
+int uring_init(uring_recv_f recvcb, uring_stop_f stopcb) {
+  struct io_uring_params p;
+  int i;
+
+  if(! uring_kernel_ok()) {
+    fprintf(stderr, "io_uring engine requires linux 6.0 or newer\n");
+    return -1;
+  }
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  p.cq_entries = URING_ENTRIES * 4;
+
+  ring = sys_setup(URING_ENTRIES, &p);
+  if(ring < 0) {
+    perror("io_uring_setup");
+    return -1;
+  }
+
+  if(! (p.features & IORING_FEAT_EXT_ARG)) {
+    fprintf(stderr, "io_uring engine not supported by the kernel\n");
+    uring_done();
+    return -1;
+  }
+
+  if(uring_map(&p) != 0) {
+    perror("unable to map io_uring");
+    uring_done();
+    return -1;
+  }
+
+  if(uring_bufs() != 0) {
+    perror("unable to register io_uring buffers");
+    uring_done();
+    return -1;
+  }
+
+  txs = calloc(URING_TXS, sizeof(uring_tx_t));
+  if(txs == NULL) {
+    perror("unable to allocate io_uring sends");
+    uring_done();
+    return -1;
+  }
+  txfree = NULL;
+  for(i=0; i<URING_TXS; i++) {
+    txs[i].next = txfree;
+    txfree = &txs[i];
+  }
+
+  onrecv  = recvcb;
+  onstop  = stopcb;
+  poll_fd = -1;
+
+  return 0;
+}
+
+/* pending requests are cancelled by the kernel when the ring is closed */
+void uring_done() {
+  if(ring >= 0)
+    close(ring);
+  ring = -1;
+
+  if(sqes != NULL)
+    munmap(sqes, sqes_len);
+  if(cq_map != NULL && cq_map != sq_map)
+    munmap(cq_map, cq_len);
+  if(sq_map != NULL)
+    munmap(sq_map, sq_len);
+  if(bring != NULL)
+    munmap(bring, bring_len);
+  if(bufs != NULL)
+    munmap(bufs, URING_BUFS * bufsize);
+
+  sqes   = NULL;
+  sq_map = cq_map = NULL;
+  bring  = NULL;
+  bufs   = NULL;
+
+  free(txs);
+  txs = txfree = NULL;
+}
+
+/* receive all datagrams arriving at fd, until uring_cancel(owner) */
+int uring_recv(int fd, void *owner) {
+  struct io_uring_sqe *sqe = uring_sqe();
+
+  if(sqe == NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  sqe->opcode    = IORING_OP_RECVMSG;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t)(uintptr_t)&recv_msg;
+  sqe->len       = 1;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = (uint64_t)(uintptr_t)owner | UD_RECV;
+
+  return 0;
+}
+
+/* stop receiving for owner, onstop() is called once it is done */
+void uring_cancel(void *owner) {
+  struct io_uring_sqe *sqe = uring_sqe();
+
+  if(sqe == NULL) {
+    fprintf(stderr, "unable to cancel io_uring receive, submission queue full\n");
+    return;
+  }
+
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->fd        = -1;
+  sqe->addr      = (uint64_t)(uintptr_t)owner | UD_RECV;
+  sqe->user_data = 0; /* ignored */
+}
+
+/* uring_run() tells us if fd became readable */
+int uring_poll(int fd) {
+  struct io_uring_sqe *sqe = uring_sqe();
+
+  if(sqe == NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fd;
+  sqe->len           = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data     = UD_POLL;
+
+  poll_fd = fd;
+
+  return 0;
+}
+
+static uring_tx_t *tx_get() {
+  uring_tx_t *tx = txfree;
+  if(tx != NULL)
+    txfree = tx->next;
+  return tx;
+}
+
+/* give back a send context and its reference to the buffer, see tx_prepare() */
+static void tx_put(uring_tx_t *tx) {
+  buf_unref(tx->bid);
+  tx->next = txfree;
+  txfree = tx;
+}
+
+/* queue the sendmsg request of a prepared send context */
+static int tx_queue(uring_tx_t *tx) {
+  struct io_uring_sqe *sqe = uring_sqe();
+
+  if(sqe == NULL)
+    return -1;
+
+  sqe->opcode    = IORING_OP_SENDMSG;
+  sqe->fd        = tx->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)&tx->msg;
+  sqe->len       = 1;
+  sqe->user_data = (uint64_t)(uintptr_t)tx | UD_SEND;
+
+  return 0;
+}
+
+/* every send context keeps the buffer it sends from */
+static void tx_prepare(uring_tx_t *tx, int fd, struct sockaddr *to, socklen_t tolen,
+                       void *buf, size_t len) {
+  memcpy(&tx->to, to, tolen);
+  tx->iov.iov_base = buf;
+  tx->iov.iov_len  = len;
+  memset(&tx->msg, 0, sizeof(tx->msg));
+  tx->msg.msg_name    = &tx->to;
+  tx->msg.msg_namelen = tolen;
+  tx->msg.msg_iov     = &tx->iov;
+  tx->msg.msg_iovlen  = 1;
+  tx->fd      = fd;
+  tx->bid     = buf_id(buf);
+  if(tx->bid >= 0)
+    bufrefs[tx->bid]++;
+  tx->gso     = 0;
+  tx->parent  = NULL;
+  tx->pending = tx->sent = tx->err = 0;
+}
+
+/* send the datagrams of a buffer one by one, the send of the whole buffer
+   completes when all of them have, returns the number queued */
+static int tx_split(uring_tx_t *tx) {
+  unsigned char *buf = tx->iov.iov_base;
+  size_t len = tx->iov.iov_len;
+  size_t off;
+  uring_tx_t *one;
+
+  STATS->gso_split++;
+
+  for(off=0; off<len; off+=tx->gso) {
+    if((one = tx_get()) == NULL) {
+      tx->err = -ENOBUFS;
+      break;
+    }
+    tx_prepare(one, tx->fd, (struct sockaddr *)&tx->to, tx->msg.msg_namelen,
+               buf + off, len - off < tx->gso ? len - off : tx->gso);
+    one->parent = tx;
+    if(tx_queue(one) != 0) {
+      tx_put(one);
+      tx->err = -ENOBUFS;
+      break;
+    }
+    tx->pending++;
+  }
+
+  return tx->pending;
+}
+
+/* a send has completed, res is the result of sendmsg() or -errno */
+static void tx_done(uring_tx_t *tx, int res, int pkts) {
+  uring_tx_t *parent = tx->parent;
+
+  if(parent == NULL) {
+    tx->onsent(tx->owner, res, pkts);
+    tx_put(tx);
+    return;
+  }
+
+  tx_put(tx);
+
+  if(res < 0)
+    parent->err = res;
+  else
+    parent->sent += pkts;
+
+  if(--parent->pending == 0)
+    tx_done(parent, parent->err, parent->sent);
+}
+
+/* queue a datagram, buf must stay valid until onsent() has been called,
+   which is the case for buffers given to uring_recv_f. If gso is set, buf
+   holds datagrams of gso bytes each. */
+int uring_send(int fd, struct sockaddr *to, socklen_t tolen, void *buf, size_t len,
+               size_t gso, void *owner, uring_sent_f onsent) {
+  uring_tx_t *tx = tx_get();
+
+  if(tx == NULL) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  tx_prepare(tx, fd, to, tolen, buf, len);
+  tx->owner  = owner;
+  tx->onsent = onsent;
+  tx->gso    = gso < len ? gso : 0;
+
+  if(tx->gso && !GSO) {
+    /* no segmentation offload */
+    if(tx_split(tx) > 0)
+      return 0;
+  }
+  else {
+    if(tx->gso)
+      batch_gso_set(&tx->msg, &tx->ctl, tx->gso);
+    if(tx_queue(tx) == 0)
+      return 0;
+  }
+
+  tx_put(tx);
+  errno = ENOBUFS;
+  return -1;
+}
+
+/* hand everything queued to the kernel */
+int uring_submit() {
+  unsigned pending;
+  int n;
+
+  __atomic_store_n(sq_tail, sq_local, __ATOMIC_RELEASE);
+  pending = sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if(pending == 0)
+    return 0;
+
+  STATS->ring_enters++;
+  n = sys_enter(pending, 0, 0, NULL, 0);
+  if(n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    perror("io_uring_enter");
+
+  return n;
+}
+
+/* submit everything  queued and let the  kernel finish its deferred
+   work, afterwards the sockets of cancelled receives are released */
+int uring_sync() {
+  int n = uring_submit();
+
+  if(n >= 0) {
+    STATS->ring_enters++;
+    n = sys_enter(0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+  }
+
+  return n;
+}
+
+/* submit everything queued and wait up to timeout ms (-1: forever) for
+   completions, unless there already are some */
+int uring_wait(int timeout) {
+  struct io_uring_getevents_arg arg;
+  struct timespec ts;
+  unsigned pending;
+  int n;
+
+  __atomic_store_n(sq_tail, sq_local, __ATOMIC_RELEASE);
+  pending = sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+  if(*cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    return pending ? uring_submit() : 0;
+
+  memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if(timeout >= 0) {
+    ts.tv_sec  = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+
+  STATS->ring_enters++;
+  n = sys_enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  if(n < 0) {
+    if(errno == EINTR || errno == ETIME || errno == EAGAIN || errno == EBUSY)
+      return 0;
+    perror("io_uring_enter");
+  }
+
+  return n;
+}
+
+static void uring_recvd(void *owner, struct io_uring_cqe *cqe) {
+  struct io_uring_recvmsg_out *out;
+  unsigned char *buf;
+  size_t hdr = sizeof(struct io_uring_recvmsg_out) + URING_NAMELEN + BATCH_CTLLEN;
+  struct msghdr msg;
+  pkt_t pkt;
+  int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  buf = bufs + (size_t)bid * bufsize;
+  out = (struct io_uring_recvmsg_out *)buf;
+
+  /* the control messages follow the address */
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_control    = buf + sizeof(struct io_uring_recvmsg_out) + URING_NAMELEN;
+  msg.msg_controllen = out->controllen;
+  pkt.gso = batch_gro_size(&msg);
+
+  pkt.addrlen = out->namelen < URING_NAMELEN ? out->namelen : URING_NAMELEN;
+  memcpy(&pkt.addr, buf + sizeof(struct io_uring_recvmsg_out), pkt.addrlen);
+  pkt.buf  = buf + hdr;
+  pkt.size = URING_PAYLOAD;
+  pkt.len  = (size_t)cqe->res > hdr ? (size_t)cqe->res - hdr : 0;
+  if(pkt.len > out->payloadlen)
+    pkt.len = out->payloadlen;
+
+  /* a send of the datagram during the callback keeps the buffer */
+  bufrefs[bid] = 1;
+  onrecv(owner, &pkt);
+  buf_unref(bid);
+}
+
+/* handle all completions, *polled is set if the polled fd is readable */
+int uring_run(int *polled) {
+  unsigned head = *cq_head;
+  unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  struct io_uring_cqe *cqe;
+  uring_tx_t *tx;
+  void *ptr;
+  int n = 0;
+
+  while(head != tail) {
+    cqe = &cqes[head & *cq_mask];
+    ptr = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)UD_MASK);
+
+    switch(cqe->user_data & UD_MASK) {
+    case UD_SEND:
+      tx = ptr;
+      /* the kernel or device could not segment it, try one by one */
+      if(cqe->res < 0 && tx->gso && batch_gso_failed(-cqe->res) && tx_split(tx) > 0)
+        break;
+      tx_done(tx, cqe->res, cqe->res < 0 ? 0 : batch_segments(tx->iov.iov_len, tx->gso));
+      break;
+    case UD_POLL:
+      *polled = 1;
+      if(! (cqe->flags & IORING_CQE_F_MORE) && poll_fd >= 0)
+        uring_poll(poll_fd);
+      break;
+    default:
+      if(ptr == NULL)
+        break; /* result of a cancel request */
+      if(cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+        uring_recvd(ptr, cqe);
+      if(! (cqe->flags & IORING_CQE_F_MORE))
+        onstop(ptr, cqe->res < 0 ? cqe->res : 0);
+      break;
+    }
+
+    n++;
+    head++;
+
+    /* callbacks may have submitted, which can produce new completions */
+    if(head == tail)
+      tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+#else /* no io_uring */
+
+int uring_init(uring_recv_f recvcb, uring_stop_f stopcb) {
+  (void)recvcb; (void)stopcb;
+  fprintf(stderr, "io_uring engine not supported on this system\n");
+  return -1;
+}
+
+void uring_done() {
+}
+
+int uring_recv(int fd, void *owner) {
+  (void)fd; (void)owner;
+  errno = ENOSYS;
+  return -1;
+}
+
+void uring_cancel(void *owner) {
+  (void)owner;
+}
+
+int uring_poll(int fd) {
+  (void)fd;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_send(int fd, struct sockaddr *to, socklen_t tolen, void *buf, size_t len,
+               size_t gso, void *owner, uring_sent_f onsent) {
+  (void)fd; (void)to; (void)tolen; (void)buf; (void)len; (void)gso; (void)owner; (void)onsent;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_submit() {
+  return 0;
+}
+
+int uring_sync() {
+  return 0;
+}
+
+int uring_wait(int timeout) {
+  (void)timeout;
+  return 0;
+}
+
+int uring_run(int *polled) {
+  (void)polled;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_URING_H
+#define _HAVE_URING_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "stats.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_URING
+#endif
+#endif
+#endif
+
+#define URING_ENTRIES 1024  /* submission queue size, the completion queue is 4 times bigger */
+#define URING_BUFS    1024  /* provided receive buffers, a power of 2 */
+
+/* called for every datagram received on a watched socket, the buffer is
+   only valid during the call unless it is handed over to uring_send() */
+typedef void (*uring_recv_f)(void *owner, pkt_t *pkt);
+
+/* called when receiving on a socket has stopped for good (err < 0) or
+   after uring_cancel() (err == -ECANCELED) */
+typedef void (*uring_stop_f)(void *owner, int err);
+
+/* called when a send has completed, res is the result of sendmsg()
+   or -errno, pkts the number of datagrams sent */
+typedef void (*uring_sent_f)(void *owner, int res, int pkts);
+
+int  uring_init(uring_recv_f onrecv, uring_stop_f onstop);
+void uring_done();
+int  uring_recv(int fd, void *owner);
+void uring_cancel(void *owner);
+int  uring_poll(int fd);
+int  uring_send(int fd, struct sockaddr *to, socklen_t tolen, void *buf, size_t len,
+                size_t gso, void *owner, uring_sent_f onsent);
+int  uring_submit();
+int  uring_sync();
+int  uring_wait(int timeout);
+int  uring_run(int *polled);
+
+#endif
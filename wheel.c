@@ -0,0 +1,161 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "wheel.h"
+
+/* all times given to the wheel_*() functions are in milliseconds */
+
+static void wheel_link(wtimer_t *head, wtimer_t *timer) {
+  timer->next = head->next;
+  timer->prev = head;
+  head->next->prev = timer;
+  head->next = timer;
+}
+
+static void wheel_unlink(wtimer_t *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = NULL;
+}
+
+/* put the timer into the slot matching its expiry tick, timers due now
+   are only accepted during a cascade, which happens right before the
+   current slot is run */
+static void wheel_place(wheel_t *wheel, wtimer_t *timer, int cascade) {
+  uint64_t delta;
+  int level;
+
+  if(timer->expires < wheel->now + (cascade ? 0 : 1))
+    timer->expires = wheel->now + (cascade ? 0 : 1);
+
+  delta = timer->expires - wheel->now;
+
+  for(level=0; level<WHEEL_LEVELS-1; level++) {
+    if(delta < ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+      break;
+  }
+
+  if(level == WHEEL_LEVELS-1) {
+    uint64_t max = ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    if(delta > max)
+      timer->expires = wheel->now + max; /* the owner will re-arm it */
+  }
+
+  wheel_link(&wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK], timer);
+}
+
+void wheel_init(wheel_t *wheel, uint64_t now) {
+  int level, slot;
+
+  wheel->now   = now / WHEEL_TICK;
+  wheel->count = 0;
+
+  for(level=0; level<WHEEL_LEVELS; level++) {
+    for(slot=0; slot<WHEEL_SLOTS; slot++) {
+      wheel->slots[level][slot].next = &wheel->slots[level][slot];
+      wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+    }
+  }
+}
+
+int wheel_armed(wtimer_t *timer) {
+  return timer->next != NULL;
+}
+
+void wheel_add(wheel_t *wheel, wtimer_t *timer, uint64_t expires) {
+  if(wheel_armed(timer))
+    wheel_del(wheel, timer);
+  timer->expires = (expires + WHEEL_TICK - 1) / WHEEL_TICK;
+  wheel_place(wheel, timer, 0);
+  wheel->count++;
+}
+
+void wheel_del(wheel_t *wheel, wtimer_t *timer) {
+  if(wheel_armed(timer)) {
+    wheel_unlink(timer);
+    wheel->count--;
+  }
+}
+
+/* move the timers of the current slot of a higher level one level down */
+static void wheel_cascade(wheel_t *wheel, int level) {
+  wtimer_t *head = &wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+  wtimer_t *timer;
+
+  while(head->next != head) {
+    timer = head->next;
+    wheel_unlink(timer);
+    wheel_place(wheel, timer, 1);
+  }
+}
+
+/* run all timers due until now, the callback may re-arm the timer */
+void wheel_advance(wheel_t *wheel, uint64_t now, wheel_expire_f expire) {
+  uint64_t tick = now / WHEEL_TICK;
+  wtimer_t *head, *timer;
+  int level;
+
+  if(wheel->count == 0) {
+    if(tick > wheel->now)
+      wheel->now = tick;
+    return;
+  }
+
+  while(wheel->now < tick) {
+    wheel->now++;
+
+    for(level=1; level<WHEEL_LEVELS; level++) {
+      if((wheel->now & (((uint64_t)1 << (WHEEL_BITS * level)) - 1)) != 0)
+        break;
+      wheel_cascade(wheel, level);
+    }
+
+    head = &wheel->slots[0][wheel->now & WHEEL_MASK];
+    while(head->next != head) {
+      timer = head->next;
+      wheel_unlink(timer);
+      wheel->count--;
+      expire(timer);
+    }
+  }
+}
+
+/* milliseconds until the next timer may expire, -1 if there is none */
+int wheel_timeout(wheel_t *wheel, uint64_t now) {
+  uint64_t tick;
+  int64_t ms;
+  int i;
+
+  if(wheel->count == 0)
+    return -1;
+
+  /* next used slot on level 0, or the next cascade otherwise */
+  for(i=1; i<=WHEEL_SLOTS; i++) {
+    tick = wheel->now + i;
+    if((tick & WHEEL_MASK) == 0)
+      break;
+    if(wheel->slots[0][tick & WHEEL_MASK].next != &wheel->slots[0][tick & WHEEL_MASK])
+      break;
+  }
+
+  ms = (int64_t)(tick * WHEEL_TICK) - (int64_t)now;
+  return ms < 0 ? 0 : (int)ms;
+}
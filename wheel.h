@@ -0,0 +1,67 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#ifndef _HAVE_WHEEL_H
+#define _HAVE_WHEEL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+  Hierarchical timer wheel: 4 levels of 64 slots, level n covers 64^(n+1)
+  ticks. Adding and removing a timer is O(1), advancing the wheel only
+  touches timers which are due (plus an occasional cascade of a higher
+  level slot into the lower ones).
+*/
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_TICK   100  /* milliseconds per tick */
+
+struct _wtimer_t {
+  struct _wtimer_t *next;
+  struct _wtimer_t *prev;
+  uint64_t expires;         /* tick */
+  void *data;               /* owner, passed to the expire callback */
+};
+typedef struct _wtimer_t wtimer_t;
+
+struct _wheel_t {
+  uint64_t now;             /* current tick */
+  uint64_t count;           /* number of armed timers */
+  wtimer_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* list heads */
+};
+typedef struct _wheel_t wheel_t;
+
+typedef void (*wheel_expire_f)(wtimer_t *timer);
+
+void wheel_init(wheel_t *wheel, uint64_t now);
+void wheel_add(wheel_t *wheel, wtimer_t *timer, uint64_t expires);
+void wheel_del(wheel_t *wheel, wtimer_t *timer);
+void wheel_advance(wheel_t *wheel, uint64_t now, wheel_expire_f expire);
+int  wheel_timeout(wheel_t *wheel, uint64_t now);
+int  wheel_armed(wtimer_t *timer);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+    This file is part of udpxd.
+
+    Copyright (C) 2015-2016 T.v.Dein.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    You can contact me by mail: <tom AT vondein DOT org>.
+*/
+
+#include "worker.h"
+#include "log.h"
+#include "shm.h"
+
+/*
+  With --workers the master creates one SO_REUSEPORT listen socket per
+  worker and forwarding setup and forks the workers. Each worker runs
+  its own main_loop() with its own client list, nothing is shared. The
+  kernel distributes incoming datagrams by the steering program attached
+  by reuseport_steer(), which hashes the source address and port, so a
+  client always ends up at the same worker.
+
+  The master keeps all listen sockets open, so the reuseport group and
+  with it the mapping of clients to workers doesn't change if a worker
+  dies. It is restarted using the same socket.
+
+  With --control every worker has its own control socket, the path
+  with the number of the worker appended, e.g. udpxd.sock.0.
+*/
+
+static listener_t *listeners_all = NULL; /* listener->sockets per worker */
+static int *ctls = NULL;       /* control socket per worker, -1 if none */
+static char **ctlpaths = NULL; /* their paths */
+static pid_t *pids = NULL;     /* pid per worker, 0 if not running */
+static volatile sig_atomic_t MSTOP = 0;
+
+/* master: forward signals to the workers */
+static void worker_signal(int sig) {
+  int i;
+
+  if(sig != SIGUSR1)
+    MSTOP = 1;
+
+  for(i=0; i<WORKERS; i++) {
+    if(pids[i] > 0)
+      kill(pids[i], sig);
+  }
+}
+
+/* close the sockets of worker n, or of all workers but n if others is set */
+static void worker_close(int n, int others) {
+  listener_t *l;
+  int i;
+
+  for(i=0; i<WORKERS; i++) {
+    if((i == n) == others)
+      continue;
+    for(l = listeners_all; l != NULL; l = l->next) {
+      if(l->sockets[i] >= 0)
+        close(l->sockets[i]);
+      l->sockets[i] = -1;
+    }
+    if(ctls[i] >= 0)
+      close(ctls[i]);
+    ctls[i] = -1;
+  }
+}
+
+/* create the listen sockets, must be called before dropping privileges */
+int workers_bind(server_t *server) {
+  listener_t *l;
+  int i;
+
+  listeners_all = server->listeners;
+  ctls     = malloc(sizeof(int) * WORKERS);
+  ctlpaths = calloc(WORKERS, sizeof(char *));
+  pids     = calloc(WORKERS, sizeof(pid_t));
+
+  for(i=0; i<WORKERS; i++)
+    ctls[i] = -1;
+  for(l = listeners_all; l != NULL; l = l->next) {
+    l->sockets = malloc(sizeof(int) * WORKERS);
+    for(i=0; i<WORKERS; i++)
+      l->sockets[i] = -1;
+  }
+
+  for(i=0; i<WORKERS; i++) {
+    for(l = listeners_all; l != NULL; l = l->next) {
+      if((l->sockets[i] = bindsocket(l->listen_h, 1)) < 0) {
+        worker_close(-1, 1);
+        return 1;
+      }
+    }
+    if(CONTROL != NULL) {
+      ctlpaths[i] = malloc(strlen(CONTROL) + 8);
+      sprintf(ctlpaths[i], "%s.%d", CONTROL, i);
+      if((ctls[i] = ctl_bind(ctlpaths[i])) < 0) {
+        worker_close(-1, 1);
+        return 1;
+      }
+    }
+  }
+
+  for(l = listeners_all; l != NULL; l = l->next) {
+    /* applies to the whole reuseport group */
+    if(reuseport_steer(l->sockets[0], WORKERS) != 0) {
+      fprintf(stderr, "unable to attach steering program, clients are "
+              "distributed by the default kernel hash\n");
+    }
+    l->socket = l->sockets[0];
+  }
+
+  return 0;
+}
+
+/* start worker n, returns the pid in the master and 0 in the worker */
+static pid_t worker_fork(int n) {
+  pid_t pid = fork();
+
+  if(pid < 0) {
+    perror("unable to fork worker");
+    return -1;
+  }
+
+  if(pid == 0) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    worker_close(n, 1);
+    return 0;
+  }
+
+  verbose("started worker %d, pid %d\n", n, (int)pid);
+  pids[n] = pid;
+
+  return pid;
+}
+
+/* worker n: take over its sockets, the rest of the master state is
+   not needed */
+static void worker_setup(server_t *server, int n) {
+  listener_t *l;
+  int i;
+
+  for(l = server->listeners; l != NULL; l = l->next)
+    l->socket = l->sockets[n];
+  server->ctl     = ctls[n];
+  server->ctlpath = ctlpaths[n];
+  server->worker  = n;
+  stats_select(n);
+  shm_select(n);
+
+  for(i=0; i<WORKERS; i++) {
+    if(i != n)
+      free(ctlpaths[i]);
+  }
+  free(ctls);
+  free(ctlpaths);
+  free(pids);
+}
+
+/* returns in the master when all workers are gone, and in each worker
+   when its main_loop() is done */
+int workers_run(server_t *server) {
+  int i, status;
+  pid_t pid;
+
+  signal(SIGINT, worker_signal);
+  signal(SIGTERM, worker_signal);
+  signal(SIGUSR1, worker_signal);
+
+  for(i=0; i<WORKERS; i++) {
+    pid = worker_fork(i);
+    if(pid == 0) {
+      worker_setup(server, i);
+      return main_loop(server);
+    }
+    if(pid < 0) {
+      worker_signal(SIGTERM);
+      break;
+    }
+  }
+
+  for(;;) {
+    pid = wait(&status);
+
+    if(pid < 0) {
+      if(errno == EINTR)
+        continue;
+      break; /* no workers left */
+    }
+
+    for(i=0; i<WORKERS; i++) {
+      if(pids[i] == pid)
+        break;
+    }
+    if(i == WORKERS)
+      continue;
+
+    pids[i] = 0;
+
+    if(! MSTOP) {
+      fprintf(stderr, "worker %d (pid %d) died, restarting\n", i, (int)pid);
+      sleep(1);
+      if(worker_fork(i) == 0) {
+        worker_setup(server, i);
+        return main_loop(server);
+      }
+    }
+  }
+
+  worker_close(-1, 1);
+  for(i=0; i<WORKERS; i++)
+    free(ctlpaths[i]);
+  free(ctls);
+  free(ctlpaths);
+  free(pids);
+  shm_remove();
+
+  return 0;
+}